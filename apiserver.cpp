@@ -0,0 +1,292 @@
+#include "apiserver.h"
+#include "audioengine.h"
+#include "latencymetrics.h"
+#include "playbackmodel.h"
+#include "soundbank.h"
+#include "statechannel.h"
+#include "webassets.h"
+
+#include <QHttpServer>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QUrlQuery>
+#include <QDebug>
+
+#include <algorithm>
+
+class ApiServer::RequestTimer
+{
+public:
+    explicit RequestTimer(ApiServer *server)
+        : m_server(server),
+        m_start(server->m_clock.nsecsElapsed())
+    {
+    }
+
+    ~RequestTimer()
+    {
+        m_server->record(m_server->m_clock.nsecsElapsed() - m_start);
+    }
+
+private:
+    ApiServer *m_server;
+    qint64 m_start;
+};
+
+ApiServer::ApiServer(PlaybackModel *model, quint16 port, QObject *parent)
+    : QObject(parent),
+    m_model(model)
+{
+    m_requestTimes.resize(StatsWindow, -1);
+    m_latencies.resize(StatsWindow, 0);
+
+    m_context = new QObject;
+    m_context->moveToThread(&m_thread);
+    connect(&m_thread, &QThread::finished, m_context, &QObject::deleteLater);
+
+    m_thread.setObjectName("HttpApi");
+    m_thread.start();
+
+    QMetaObject::invokeMethod(m_context, [this, port]() {
+        setup(port);
+    }, Qt::BlockingQueuedConnection);
+}
+
+ApiServer::~ApiServer()
+{
+    m_thread.quit();
+    m_thread.wait();
+}
+
+// Everything is revalidated (no-cache), which costs a 304 without a body
+// while the page is unchanged and never leaves a stale page after an update.
+QHttpServerResponse ApiServer::serveAsset(const QString &name, const QHttpServerRequest &request) const
+{
+    const WebAssets::Asset *asset = m_assets->find(name);
+    if(!asset)
+        return QHttpServerResponse(QHttpServerResponse::StatusCode::NotFound);
+
+    if(WebAssets::matches(*asset, request.value("If-None-Match"))) {
+        QHttpServerResponse response(QHttpServerResponse::StatusCode::NotModified);
+        response.setHeader("ETag", asset->etag);
+        response.setHeader("Cache-Control", "no-cache");
+        return response;
+    }
+
+    const WebAssets::Selection selection = WebAssets::select(*asset, request.value("Accept-Encoding"));
+    QHttpServerResponse response(asset->contentType, *selection.body);
+    if(!selection.encoding.isEmpty())
+        response.setHeader("Content-Encoding", selection.encoding);
+    response.setHeader("Vary", "Accept-Encoding");
+    response.setHeader("ETag", asset->etag);
+    response.setHeader("Cache-Control", "no-cache");
+    return response;
+}
+
+// The bytes come from StateChannel::snapshot(), so a poll costs a lookup
+// until the state changes. ?since=<seq> with the current sequence, or the
+// last ETag, gets a 304; Accept: application/cbor gets CBOR.
+QHttpServerResponse ApiServer::serveState(const QHttpServerRequest &request) const
+{
+    const StateChannel::Snapshot &snapshot = m_stateChannel->snapshot();
+
+    bool ok = false;
+    const quint64 since = QUrlQuery(request.url()).queryItemValue("since").toULongLong(&ok);
+    if((ok && since == snapshot.sequence) || WebAssets::matches(snapshot.etag, request.value("If-None-Match"))) {
+        QHttpServerResponse response(QHttpServerResponse::StatusCode::NotModified);
+        response.setHeader("ETag", snapshot.etag);
+        response.setHeader("Cache-Control", "no-cache");
+        return response;
+    }
+
+    const bool cbor = request.value("Accept").contains("application/cbor");
+    QHttpServerResponse response(cbor ? QByteArray("application/cbor") : QByteArray("application/json"),
+                                 cbor ? snapshot.cbor : snapshot.json);
+    response.setHeader("Vary", "Accept");
+    response.setHeader("ETag", snapshot.etag);
+    response.setHeader("Cache-Control", "no-cache");
+    return response;
+}
+
+void ApiServer::setup(quint16 port)
+{
+    m_clock.start();
+    m_server = new QHttpServer(m_context);
+    m_assets = std::make_unique<WebAssets>(QStringList { "index.html", "app.js", "style.css" });
+
+    m_server->route("/", QHttpServerRequest::Method::Get, [this](const QHttpServerRequest &request) {
+        RequestTimer timer(this);
+        return serveAsset("index.html", request);
+    });
+
+    m_server->route("/assets/", QHttpServerRequest::Method::Get, [this](const QString &name, const QHttpServerRequest &request) {
+        RequestTimer timer(this);
+        return serveAsset(name, request);
+    });
+
+    m_server->route("/play/", QHttpServerRequest::Method::Get, [this](int position) {
+        RequestTimer timer(this);
+        if(!m_model->play(position, InputEvent::now()))
+            return QHttpServerResponse(QHttpServerResponse::StatusCode::NotFound);
+        return QHttpServerResponse(QHttpServerResponse::StatusCode::Accepted);
+    });
+
+    m_server->route("/seek/<arg>/<arg>", QHttpServerRequest::Method::Get, [this](int slot, int ms) {
+        RequestTimer timer(this);
+        if(!m_model->seek(slot, ms))
+            return QHttpServerResponse(QHttpServerResponse::StatusCode::NotFound);
+        return QHttpServerResponse(QHttpServerResponse::StatusCode::Accepted);
+    });
+
+    // The web page builds its buttons from this, see SoundBank::toJson().
+    m_server->route("/api/bank", QHttpServerRequest::Method::Get, [this]() {
+        RequestTimer timer(this);
+        return QHttpServerResponse(m_model->bank()->toJson(), QHttpServerResponse::StatusCode::Ok);
+    });
+
+    m_server->route("/volume", QHttpServerRequest::Method::Get, [this]() {
+        RequestTimer timer(this);
+        return QHttpServerResponse(QString::number(m_model->volume()), QHttpServerResponse::StatusCode::Ok);
+    });
+
+    m_server->route("/volume/", QHttpServerRequest::Method::Get, [this](int volume) {
+        RequestTimer timer(this);
+        m_model->setVolume(volume, InputEvent::now());
+        return QHttpServerResponse(QHttpServerResponse::StatusCode::Accepted);
+    });
+
+    // {"commands": [{"play": 0}, {"volume": 80}, ...]}
+    m_server->route("/api/batch", QHttpServerRequest::Method::Post, [this](const QHttpServerRequest &request) {
+        RequestTimer timer(this);
+        const qint64 received = InputEvent::now();
+        QJsonParseError parseError;
+        const QJsonDocument document = QJsonDocument::fromJson(request.body(), &parseError);
+        const QJsonArray commands = document.object().value("commands").toArray();
+        if(parseError.error != QJsonParseError::NoError || commands.isEmpty()) {
+            return QHttpServerResponse(QJsonObject{{ "error", "expected {\"commands\": [...]}" }},
+                                       QHttpServerResponse::StatusCode::BadRequest);
+        }
+
+        QList<PlaybackModel::Request> requests;
+        for(const QJsonValue &value : commands) {
+            const QJsonObject command = value.toObject();
+            PlaybackModel::Request modelRequest;
+            modelRequest.timestamp = received;
+            if(command.contains("play")) {
+                modelRequest.type = PlaybackModel::Request::Play;
+                modelRequest.value = command.value("play").toInt(-1);
+            } else if(command.contains("volume")) {
+                modelRequest.type = PlaybackModel::Request::Volume;
+                modelRequest.value = command.value("volume").toInt(-1);
+            } else {
+                return QHttpServerResponse(QJsonObject{{ "error", "unknown command" }},
+                                           QHttpServerResponse::StatusCode::BadRequest);
+            }
+            requests.append(modelRequest);
+        }
+
+        QString errorString;
+        if(!m_model->apply(requests, &errorString)) {
+            return QHttpServerResponse(QJsonObject{{ "error", errorString }},
+                                       QHttpServerResponse::StatusCode::UnprocessableEntity);
+        }
+        return QHttpServerResponse(QJsonObject{{ "applied", qint64(requests.size()) }},
+                                   QHttpServerResponse::StatusCode::Ok);
+    });
+
+    m_server->route("/api/stats", QHttpServerRequest::Method::Get, [this]() {
+        return QHttpServerResponse(stats(), QHttpServerResponse::StatusCode::Ok);
+    });
+
+    m_server->route("/metrics", QHttpServerRequest::Method::Get, []() {
+        return QHttpServerResponse("text/plain; version=0.0.4", LatencyMetrics::instance().prometheus(),
+                                   QHttpServerResponse::StatusCode::Ok);
+    });
+
+    m_stateChannel = new StateChannel(m_server, m_context);
+
+    m_server->route("/api/state", QHttpServerRequest::Method::Get, [this](const QHttpServerRequest &request) {
+        RequestTimer timer(this);
+        return serveState(request);
+    });
+
+    // The live values, left out of /api/state so that polls of it stay 304
+    // while a track plays.
+    m_server->route("/api/live", QHttpServerRequest::Method::Get, [this]() {
+        RequestTimer timer(this);
+        QHttpServerResponse response(m_stateChannel->live());
+        response.setHeader("Cache-Control", "no-store");
+        return response;
+    });
+
+    m_port = m_server->listen(QHostAddress::Any, port);
+    if (!m_port) {
+        qDebug() << "Server failed to listen on a port." << port;
+    }
+}
+
+void ApiServer::record(qint64 latencyNs)
+{
+    const int index = int(m_requests % StatsWindow);
+    m_requestTimes[index] = m_clock.nsecsElapsed();
+    m_latencies[index] = latencyNs;
+    ++m_requests;
+}
+
+QJsonObject ApiServer::stats() const
+{
+    const qint64 now = m_clock.nsecsElapsed();
+    const qint64 window = 10 * 1000000000LL;
+    const int samples = int(qMin<quint64>(m_requests, StatsWindow));
+
+    int recent = 0;
+    std::vector<qint64> latencies(m_latencies.begin(), m_latencies.begin() + samples);
+    for(int i = 0; i < samples; ++i) {
+        if(now - m_requestTimes[i] <= window)
+            ++recent;
+    }
+    std::sort(latencies.begin(), latencies.end());
+
+    auto percentile = [&latencies](double p) -> double {
+        if(latencies.empty())
+            return 0.0;
+        const size_t index = qMin(latencies.size() - 1, size_t(p * latencies.size()));
+        return latencies[index] / 1000.0;
+    };
+
+    const AudioEngine *engine = m_model->engine();
+    QJsonArray outputs;
+    for(int index = 0; index < engine->outputCount(); ++index) {
+        const AudioEngine::OutputStats output = engine->outputStats(index);
+        const CommandBus &bus = engine->commandBus(index);
+        outputs.append(QJsonObject {
+            { "name", output.name },
+            { "underruns", qint64(output.underruns) },
+            { "bufferFrames", output.bufferFrames },
+            { "depthFrames", output.depthFrames },
+            { "periodFrames", output.periodFrames },
+            { "latencyMs", output.latencyMs() },
+            { "adaptive", output.adaptive },
+            { "streamUnderruns", qint64(output.streamUnderruns) },
+            { "commandBus", QJsonObject {
+                { "depth", qint64(bus.depth()) },
+                { "highWater", qint64(bus.highWater()) },
+                { "dropped", qint64(bus.dropped()) }
+            }}
+        });
+    }
+
+    return QJsonObject {
+        { "requests", qint64(m_requests) },
+        { "requestsPerSecond", recent / qMin(10.0, qMax(1e-9, now / 1e9)) },
+        { "latencyUs", QJsonObject {
+            { "p50", percentile(0.50) },
+            { "p99", percentile(0.99) },
+            { "p999", percentile(0.999) },
+            { "max", latencies.empty() ? 0.0 : latencies.back() / 1000.0 },
+            { "samples", samples }
+        }},
+        { "stateClients", m_stateChannel ? m_stateChannel->clientCount() : 0 },
+        { "outputs", outputs }
+    };
+}
@@ -0,0 +1,60 @@
+#ifndef APISERVER_H
+#define APISERVER_H
+
+#include <QObject>
+#include <QElapsedTimer>
+#include <QJsonObject>
+#include <QThread>
+
+#include <memory>
+#include <vector>
+
+class QHttpServer;
+class QHttpServerRequest;
+class QHttpServerResponse;
+class PlaybackModel;
+class StateChannel;
+class WebAssets;
+
+// Runs the HTTP API and the state WebSocket on their own thread. Handlers only
+// talk to the thread-safe PlaybackModel, never to widgets.
+class ApiServer : public QObject
+{
+    Q_OBJECT
+
+public:
+    // port 0 picks a free port, see port().
+    ApiServer(PlaybackModel *model, quint16 port, QObject *parent = nullptr);
+    ~ApiServer();
+
+    // Lives on the server thread; publish() may be called from any thread.
+    StateChannel *stateChannel() const { return m_stateChannel; }
+    bool isListening() const { return m_port != 0; }
+    quint16 port() const { return m_port; }
+
+private:
+    class RequestTimer;
+
+    void setup(quint16 port);
+    QHttpServerResponse serveAsset(const QString &name, const QHttpServerRequest &request) const;
+    QHttpServerResponse serveState(const QHttpServerRequest &request) const;
+    void record(qint64 latencyNs);
+    QJsonObject stats() const;
+
+    PlaybackModel *m_model;
+    QThread m_thread;
+    QObject *m_context = nullptr;
+    QHttpServer *m_server = nullptr;
+    StateChannel *m_stateChannel = nullptr;
+    std::unique_ptr<WebAssets> m_assets;
+    quint16 m_port = 0;
+
+    // Only touched on the server thread.
+    static constexpr int StatsWindow = 4096;
+    QElapsedTimer m_clock;
+    std::vector<qint64> m_requestTimes;
+    std::vector<qint64> m_latencies;
+    quint64 m_requests = 0;
+};
+
+#endif // APISERVER_H
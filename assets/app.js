@@ -0,0 +1,90 @@
+"use strict";
+
+(function() {
+    var bank = document.getElementById("bank");
+    var slider = document.getElementById("volume-slider");
+    var serialState = document.getElementById("serial-state");
+
+    fetch("/api/bank").then(function(response) {
+        return response.json();
+    }).then(function(slots) {
+        slots.forEach(function(slot) {
+            var button = document.createElement("a");
+            button.id = "btn_" + slot.slot;
+            button.className = "button";
+            button.href = "#";
+            button.title = slot.file;
+            button.textContent = slot.label;
+            button.addEventListener("click", function(event) {
+                event.preventDefault();
+                fetch("/play/" + slot.slot);
+            });
+            bank.appendChild(button);
+        });
+    });
+
+    // At most one volume request is in flight; values dragged past in the
+    // meantime collapse into the latest one.
+    var volumePending = null;
+    var volumeBusy = false;
+    var volumeDragging = false;
+    function flushVolume() {
+        if(volumePending === null) {
+            volumeBusy = false;
+            return;
+        }
+        var value = volumePending;
+        volumePending = null;
+        volumeBusy = true;
+        fetch("/volume/" + value).then(flushVolume, flushVolume);
+    }
+    slider.addEventListener("input", function() {
+        volumePending = slider.value;
+        if(!volumeBusy)
+            flushVolume();
+    });
+    slider.addEventListener("pointerdown", function() {
+        volumeDragging = true;
+    });
+    ["pointerup", "pointercancel"].forEach(function(type) {
+        slider.addEventListener(type, function() {
+            volumeDragging = false;
+        });
+    });
+
+    function applyState(state) {
+        // Our own changes come back as state too; ignore them while dragging.
+        if(state.volume !== undefined && !volumeDragging && !volumeBusy)
+            slider.value = state.volume;
+        if(state.playing !== undefined) {
+            bank.querySelectorAll(".button.active").forEach(function(button) {
+                button.classList.remove("active");
+            });
+            state.playing.forEach(function(slot) {
+                var button = document.getElementById("btn_" + slot);
+                if(button)
+                    button.classList.add("active");
+            });
+        }
+        if(state.serial !== undefined)
+            serialState.textContent = state.serial;
+    }
+
+    var lastSeq = null;
+    function connectState() {
+        var scheme = location.protocol === "https:" ? "wss://" : "ws://";
+        var url = scheme + location.host + "/state" + (lastSeq !== null ? "?since=" + lastSeq : "");
+        var socket = new WebSocket(url);
+        socket.onmessage = function(event) {
+            var state = JSON.parse(event.data);
+            // Live values such as the position come without a sequence number.
+            if(state.seq !== undefined)
+                lastSeq = state.seq;
+            applyState(state);
+        };
+        socket.onclose = function() {
+            setTimeout(connectState, 1000);
+        };
+    }
+    connectState();
+})();
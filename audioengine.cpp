@@ -0,0 +1,471 @@
+#include "audioengine.h"
+#include "latencymetrics.h"
+#include "mixer.h"
+#include "mixkernels.h"
+
+#include <QAudioSink>
+#include <QMediaDevices>
+#include <QElapsedTimer>
+#include <QSettings>
+#include <QTimer>
+#include <QDebug>
+
+#include <functional>
+
+AudioEngine::Config AudioEngine::readConfig(QSettings &settings)
+{
+    Config config;
+    settings.beginGroup("Audio");
+    config.voices = settings.value("voices", config.voices).toInt();
+    config.periodFrames = settings.value("periodFrames", config.periodFrames).toInt();
+    config.bufferFrames = settings.value("bufferFrames", config.bufferFrames).toInt();
+    config.adaptiveBuffer = settings.value("adaptiveBuffer", config.adaptiveBuffer).toBool();
+    config.minBufferFrames = settings.value("minBufferFrames", config.minBufferFrames).toInt();
+    config.maxBufferFrames = settings.value("maxBufferFrames", config.maxBufferFrames).toInt();
+    config.bufferStableSeconds = settings.value("bufferStableSeconds", config.bufferStableSeconds).toInt();
+    config.maxCommandsPerPeriod = settings.value("maxCommandsPerPeriod", config.maxCommandsPerPeriod).toInt();
+    config.streams = settings.value("streams", config.streams).toInt();
+    config.streamBufferMs = settings.value("streamBufferMs", config.streamBufferMs).toInt();
+    config.nullSink = settings.value("nullSink", config.nullSink).toBool();
+    settings.endGroup();
+    settings.beginGroup("Dsp");
+    DspConfig &dsp = config.dsp;
+    dsp.fadeInMs = settings.value("fadeInMs", dsp.fadeInMs).toFloat();
+    dsp.fadeOutMs = settings.value("fadeOutMs", dsp.fadeOutMs).toFloat();
+    dsp.duckDb = settings.value("duckDb", dsp.duckDb).toFloat();
+    dsp.duckHoldMs = settings.value("duckHoldMs", dsp.duckHoldMs).toInt();
+    dsp.duckReleaseMs = settings.value("duckReleaseMs", dsp.duckReleaseMs).toInt();
+    dsp.limiter = settings.value("limiter", dsp.limiter).toBool();
+    dsp.limiterCeilingDb = settings.value("limiterCeilingDb", dsp.limiterCeilingDb).toFloat();
+    dsp.limiterLookaheadMs = settings.value("limiterLookaheadMs", dsp.limiterLookaheadMs).toFloat();
+    dsp.limiterReleaseMs = settings.value("limiterReleaseMs", dsp.limiterReleaseMs).toInt();
+    settings.endGroup();
+    const int outputs = settings.beginReadArray("outputs");
+    for(int i = 0; i < outputs; ++i) {
+        settings.setArrayIndex(i);
+        OutputConfig output;
+        output.device = settings.value("device").toString();
+        output.name = settings.value("name", output.device).toString();
+        const QStringList routed = settings.value("slots").toString().split(',', Qt::SkipEmptyParts);
+        for(const QString &slot : routed)
+            output.routedSlots.append(slot.trimmed().toInt() - 1);
+        config.outputs.append(output);
+    }
+    settings.endArray();
+    settings.beginGroup("serial");
+    config.inputQueueCapacity = settings.value("queueCapacity", config.inputQueueCapacity).toInt();
+    if(settings.value("overflowPolicy").toString() == "block")
+        config.inputOverflowPolicy = SpscQueue<InputEvent>::OverflowPolicy::Block;
+    settings.endGroup();
+    return config;
+}
+
+AudioEngine::AudioEngine(const QAudioDevice &device, const Config &config, QObject *parent)
+    : QObject(parent),
+    m_config(config)
+{
+    m_mixFormat = device.preferredFormat();
+    if(m_mixFormat.sampleRate() <= 0)
+        m_mixFormat.setSampleRate(48000);
+    m_mixFormat.setChannelCount(2);
+    m_mixFormat.setSampleFormat(QAudioFormat::Float);
+
+    m_slotOutput.fill(0);
+    addOutput("main", m_config.nullSink ? QAudioDevice() : device);
+    for(const OutputConfig &outputConfig : std::as_const(m_config.outputs)) {
+        QAudioDevice outputDevice = device;
+        if(outputConfig.device == "null") {
+            outputDevice = QAudioDevice();
+        } else if(!outputConfig.device.isEmpty()) {
+            outputDevice = findDevice(outputConfig.device);
+            // Silence is safer than playing monitor cues on the PA.
+            if(outputDevice.isNull())
+                qWarning() << "audio output" << outputConfig.device << "not found, rendering it without a device";
+        }
+        const QString name = outputConfig.name.isEmpty() ? QString("output%1").arg(outputCount()) : outputConfig.name;
+        const int output = addOutput(name, m_config.nullSink ? QAudioDevice() : outputDevice);
+        for(const int slot : outputConfig.routedSlots) {
+            if(slot >= 0 && slot < int(m_slotOutput.size()))
+                m_slotOutput[size_t(slot)] = qint8(output);
+        }
+    }
+    for(int slot = 0; slot < int(m_slotOutput.size()); ++slot)
+        m_outputs[size_t(m_slotOutput[size_t(slot)])]->slotMask |= quint64(1) << slot;
+
+    LatencyMetrics::instance().addCollector(this, [this](QByteArray *out) {
+        appendMetrics(out);
+    });
+}
+
+QAudioDevice AudioEngine::findDevice(const QString &device)
+{
+    const QList<QAudioDevice> devices = QMediaDevices::audioOutputs();
+    for(const QAudioDevice &candidate : devices) {
+        if(candidate.id() == device.toUtf8() || candidate.description() == device)
+            return candidate;
+    }
+    return QAudioDevice();
+}
+
+int AudioEngine::addOutput(const QString &name, const QAudioDevice &device)
+{
+    const int index = outputCount();
+    m_outputs.push_back(std::make_unique<Output>());
+    Output *output = m_outputs.back().get();
+    output->name = name;
+    output->device = device;
+
+    // Separate queues keep a board that floods its queue from delaying the others.
+    QVector<SpscQueue<InputEvent> *> inputQueues;
+    for(int i = 0; i < qBound(1, m_config.inputQueues, MaxInputQueues); ++i) {
+        output->inputQueues.push_back(std::make_unique<SpscQueue<InputEvent>>(m_config.inputQueueCapacity,
+                                                                              m_config.inputOverflowPolicy));
+        inputQueues.append(output->inputQueues.back().get());
+    }
+
+    // Samples are decoded once at the mix rate; there is no resampling per device.
+    output->format = m_mixFormat;
+    if(!device.isNull() && !device.isFormatSupported(output->format)) {
+        output->format.setSampleFormat(QAudioFormat::Int16);
+        if(!device.isFormatSupported(output->format))
+            qWarning() << "audio output" << name << "may not support" << m_mixFormat.sampleRate() << "Hz";
+    }
+
+    Mixer *mixer = new Mixer(m_mixFormat, output->format.sampleFormat(), m_config.voices, m_config.periodFrames, inputQueues);
+    output->mixer = mixer;
+    mixer->setMaxCommandsPerPeriod(m_config.maxCommandsPerPeriod);
+    mixer->setDsp(m_config.dsp);
+    mixer->setStreaming(qMax(0, m_config.streams), qint64(m_config.streamBufferMs) * m_mixFormat.sampleRate() / 1000);
+    mixer->moveToThread(&output->renderThread);
+    connect(mixer, &Mixer::playingSlotsChanged, this, [this]() {
+        const quint64 playing = playingSlots();
+        if(playing == m_reportedPlaying)
+            return;
+        m_reportedPlaying = playing;
+        emit playingSlotsChanged(playing);
+    }, Qt::QueuedConnection);
+    // Every output applies the same gain; the first one reports it.
+    if(index == 0)
+        connect(mixer, &Mixer::masterGainChanged, this, &AudioEngine::masterGainChanged, Qt::QueuedConnection);
+    connect(mixer, &Mixer::triggerMissed, this, &AudioEngine::triggerMissed, Qt::QueuedConnection);
+    connect(&output->renderThread, &QThread::finished, mixer, &QObject::deleteLater);
+
+    output->renderThread.setObjectName(index == 0 ? QString("AudioRender") : QString("AudioRender%1").arg(index));
+    output->renderThread.start(QThread::TimeCriticalPriority);
+
+    if(device.isNull()) {
+        QMetaObject::invokeMethod(mixer, [this, output]() {
+            startNullSink(output);
+        }, Qt::QueuedConnection);
+        return index;
+    }
+
+    const int periodFrames = mixer->periodFrames();
+    const int bufferFrames = m_config.bufferFrames > 0 ? m_config.bufferFrames : 2 * periodFrames;
+    if(m_config.adaptiveBuffer) {
+        BufferController::Config controllerConfig;
+        controllerConfig.minFrames = m_config.minBufferFrames > 0 ? m_config.minBufferFrames : periodFrames;
+        controllerConfig.maxFrames = m_config.maxBufferFrames;
+        controllerConfig.stepFrames = periodFrames;
+        controllerConfig.stableMs = m_config.bufferStableSeconds * 1000LL;
+        output->bufferController = std::make_unique<BufferController>(controllerConfig, bufferFrames);
+    }
+
+    // Queued, so the sink is never restarted from inside its own read.
+    connect(mixer, &Mixer::underrun, mixer, [this, output]() {
+        handleUnderrun(output);
+    }, Qt::QueuedConnection);
+
+    QMetaObject::invokeMethod(mixer, [this, output, bufferFrames]() {
+        output->mixer->open(QIODevice::ReadOnly);
+        startSink(output, output->bufferController ? output->bufferController->bufferFrames() : bufferFrames);
+        qDebug() << "audio output" << output->name << "started on" << output->device.description()
+                 << output->format << "period" << output->mixer->periodFrames()
+                 << "buffer" << output->mixer->bufferFrames() << "frames" << (output->bufferController ? "(adaptive)" : "")
+                 << "kernels" << MixKernels::implementation();
+
+        if(output->bufferController) {
+            QTimer *shrinkTimer = new QTimer(output->mixer);
+            connect(shrinkTimer, &QTimer::timeout, output->mixer, [this, output]() {
+                shrinkBuffer(output);
+            });
+            shrinkTimer->start(1000);
+        }
+    }, Qt::QueuedConnection);
+    return index;
+}
+
+// (Re)starts the sink with a buffer of the given size. Restarting drops what
+// is still queued in the device, so it is only done after an underrun, when
+// that audio is already broken, or while nothing plays. Runs on the output's
+// render thread.
+void AudioEngine::startSink(Output *output, int bufferFrames)
+{
+    if(output->sink)
+        output->sink->stop();
+    else
+        output->sink = new QAudioSink(output->device, output->format, output->mixer);
+    const int bytesPerFrame = output->format.bytesPerFrame();
+    output->sink->setBufferSize(qsizetype(bufferFrames) * bytesPerFrame);
+    output->sink->start(output->mixer);
+    // The backend may round the size; what it settled on is what plays.
+    output->mixer->setBufferFrames(int(output->sink->bufferSize() / bytesPerFrame));
+}
+
+void AudioEngine::handleUnderrun(Output *output)
+{
+    if(!output->bufferController || !output->bufferController->underrun(InputEvent::now() / 1000000))
+        return;
+    startSink(output, output->bufferController->bufferFrames());
+    qWarning() << "audio output" << output->name << "underrun, buffer grown to" << output->mixer->bufferFrames() << "frames";
+}
+
+void AudioEngine::shrinkBuffer(Output *output)
+{
+    if(output->mixer->playingSlots() || !output->bufferController->shrinkIfStable(InputEvent::now() / 1000000))
+        return;
+    startSink(output, output->bufferController->bufferFrames());
+    qDebug() << "no underruns on audio output" << output->name << "recently, buffer shrunk to"
+             << output->mixer->bufferFrames() << "frames";
+}
+
+// Pulls the mixer in real time without an audio device, for benchmarks,
+// tests and machines without sound output. Runs on the output's render thread.
+void AudioEngine::startNullSink(Output *output)
+{
+    Mixer *mixer = output->mixer;
+    mixer->open(QIODevice::ReadOnly);
+
+    const int periodFrames = mixer->periodFrames();
+    const int bytesPerFrame = output->format.bytesPerFrame();
+    const qint64 sampleRate = output->format.sampleRate();
+    auto buffer = QSharedPointer<QByteArray>::create(periodFrames * bytesPerFrame, Qt::Uninitialized);
+    auto clock = QSharedPointer<QElapsedTimer>::create();
+    auto rendered = QSharedPointer<qint64>::create(0);
+    clock->start();
+    // There is no device buffer, but a tick later than this still means the
+    // renderer fell behind, so underruns are counted all the same.
+    mixer->setBufferFrames(m_config.bufferFrames > 0 ? m_config.bufferFrames : 2 * periodFrames);
+
+    QTimer *timer = new QTimer(mixer);
+    timer->setTimerType(Qt::PreciseTimer);
+    connect(timer, &QTimer::timeout, mixer, [mixer, buffer, clock, rendered, periodFrames, sampleRate]() {
+        const qint64 due = clock->nsecsElapsed() * sampleRate / 1000000000LL;
+        while(*rendered + periodFrames <= due) {
+            mixer->read(buffer->data(), buffer->size());
+            *rendered += periodFrames;
+        }
+    });
+    timer->start(qMax<qint64>(1, periodFrames * 1000 / sampleRate));
+    qDebug() << "audio output" << output->name << "started on null sink, period" << periodFrames
+             << "kernels" << MixKernels::implementation();
+}
+
+AudioEngine::~AudioEngine()
+{
+    LatencyMetrics::instance().removeCollector(this);
+    for(const std::unique_ptr<Output> &output : m_outputs) {
+        QMetaObject::invokeMethod(output->mixer, [&output]() {
+            if(output->sink)
+                output->sink->stop();
+        }, Qt::BlockingQueuedConnection);
+        output->renderThread.quit();
+        output->renderThread.wait();
+    }
+}
+
+QVector<InputRoute> AudioEngine::inputRoutes(int index) const
+{
+    QVector<InputRoute> routes;
+    for(const std::unique_ptr<Output> &output : m_outputs) {
+        if(index >= 0 && index < int(output->inputQueues.size()))
+            routes.append(InputRoute { output->inputQueues[size_t(index)].get(), &output->mixer->commandBus(),
+                                       output->slotMask });
+    }
+    return routes;
+}
+
+int AudioEngine::outputForSlot(int slot) const
+{
+    return slot >= 0 && slot < int(m_slotOutput.size()) ? m_slotOutput[size_t(slot)] : 0;
+}
+
+void AudioEngine::arm(int slot, const SamplePtr &sample, float gain)
+{
+    mixerFor(slot)->arm(slot, sample, gain);
+}
+
+void AudioEngine::trigger(int slot, float gain, InputSource source, qint64 received)
+{
+    mixerFor(slot)->trigger(slot, gain, source, received);
+}
+
+void AudioEngine::play(int slot, const SamplePtr &sample, float gain, InputSource source, qint64 received)
+{
+    mixerFor(slot)->play(slot, sample, gain, source, received);
+}
+
+void AudioEngine::stop(int slot)
+{
+    mixerFor(slot)->stop(slot);
+}
+
+void AudioEngine::stopAll()
+{
+    for(const std::unique_ptr<Output> &output : m_outputs)
+        output->mixer->stopAll();
+}
+
+void AudioEngine::seek(int slot, qint64 ms)
+{
+    mixerFor(slot)->seek(slot, ms * m_mixFormat.sampleRate() / 1000);
+}
+
+void AudioEngine::submit(const QList<PlaybackCommand> &commands)
+{
+    if(m_outputs.size() == 1) {
+        m_outputs.front()->mixer->submit(commands);
+        return;
+    }
+    // Outputs run on their own clocks, so each gets its share as one batch.
+    std::vector<QList<PlaybackCommand>> routed(m_outputs.size());
+    for(const PlaybackCommand &command : commands) {
+        if(command.type == PlaybackCommand::Trigger || command.type == PlaybackCommand::Stop) {
+            routed[size_t(outputForSlot(command.slot))].append(command);
+        } else {
+            for(QList<PlaybackCommand> &batch : routed)
+                batch.append(command);
+        }
+    }
+    for(size_t output = 0; output < routed.size(); ++output) {
+        if(!routed[output].isEmpty())
+            m_outputs[output]->mixer->submit(routed[output]);
+    }
+}
+
+void AudioEngine::setMasterGain(float gain, InputSource source)
+{
+    gain = qBound(0.0f, gain, 1.0f);
+    if(qFuzzyCompare(gain, masterGain()))
+        return;
+    for(const std::unique_ptr<Output> &output : m_outputs)
+        output->mixer->setMasterGain(gain, source);
+}
+
+float AudioEngine::masterGain() const
+{
+    return m_outputs.front()->mixer->masterGain();
+}
+
+quint64 AudioEngine::playingSlots() const
+{
+    quint64 playing = 0;
+    for(const std::unique_ptr<Output> &output : m_outputs)
+        playing |= output->mixer->playingSlots();
+    return playing;
+}
+
+// The most recently started voice on any output.
+qint64 AudioEngine::position(int *slot) const
+{
+    const Mixer *newest = nullptr;
+    int newestSlot = -1;
+    qint64 newestStarted = 0;
+    for(const std::unique_ptr<Output> &output : m_outputs) {
+        const Mixer *mixer = output->mixer;
+        const int current = mixer->currentSlot();
+        if(current < 0)
+            continue;
+        const qint64 started = mixer->currentStarted();
+        if(!newest || started > newestStarted) {
+            newest = mixer;
+            newestSlot = current;
+            newestStarted = started;
+        }
+    }
+    if(slot)
+        *slot = newestSlot;
+    return newest ? newest->currentPosition() * 1000 / m_mixFormat.sampleRate() : 0;
+}
+
+AudioEngine::OutputStats AudioEngine::outputStats(int output) const
+{
+    OutputStats stats;
+    if(output < 0 || output >= outputCount())
+        return stats;
+    const Output *state = m_outputs[size_t(output)].get();
+    stats.name = state->name;
+    stats.underruns = state->mixer->underruns();
+    stats.bufferFrames = state->mixer->bufferFrames();
+    stats.depthFrames = state->mixer->depthFrames();
+    stats.periodFrames = state->mixer->periodFrames();
+    stats.dspFrames = state->mixer->dspLatencyFrames();
+    stats.sampleRate = m_mixFormat.sampleRate();
+    stats.adaptive = bool(state->bufferController);
+    stats.streamUnderruns = state->mixer->streamUnderruns();
+    return stats;
+}
+
+const CommandBus &AudioEngine::commandBus(int output) const
+{
+    return m_outputs[size_t(qBound(0, output, outputCount() - 1))]->mixer->commandBus();
+}
+
+void AudioEngine::appendMetrics(QByteArray *out) const
+{
+    auto label = [this](int output) {
+        return QByteArray("output=\"") + m_outputs[size_t(output)]->name.toUtf8() + '"';
+    };
+
+    struct Series {
+        const char *name;
+        const char *type;
+        const char *help;
+        std::function<QByteArray(const OutputStats &)> value;
+    };
+    static const Series series[] = {
+        { "nb_audio_underruns_total", "counter", "Times the audio output ran out of data.",
+          [](const OutputStats &stats) { return QByteArray::number(stats.underruns); } },
+        { "nb_audio_buffer_frames", "gauge", "Size of the audio output buffer.",
+          [](const OutputStats &stats) { return QByteArray::number(stats.bufferFrames); } },
+        { "nb_audio_buffer_depth_frames", "gauge", "Frames still queued when the output last asked for more.",
+          [](const OutputStats &stats) { return QByteArray::number(stats.depthFrames); } },
+        { "nb_audio_output_latency_seconds", "gauge", "Time from mixing a period until it is heard.",
+          [](const OutputStats &stats) { return QByteArray::number(stats.latencyMs() / 1000.0); } },
+        { "nb_audio_stream_underruns_total", "counter", "Periods in which a streamed track had nothing decoded to play.",
+          [](const OutputStats &stats) { return QByteArray::number(stats.streamUnderruns); } },
+    };
+
+    QList<OutputStats> stats;
+    for(int output = 0; output < outputCount(); ++output)
+        stats.append(outputStats(output));
+    for(const Series &metric : series) {
+        *out += QByteArray("# HELP ") + metric.name + ' ' + metric.help + '\n';
+        *out += QByteArray("# TYPE ") + metric.name + ' ' + metric.type + '\n';
+        for(int output = 0; output < outputCount(); ++output)
+            *out += QByteArray(metric.name) + '{' + label(output) + "} " + metric.value(stats.at(output)) + '\n';
+    }
+
+    *out += "# HELP nb_command_bus_posted_total Commands accepted by the playback engine per input source.\n"
+            "# TYPE nb_command_bus_posted_total counter\n";
+    for(int output = 0; output < outputCount(); ++output) {
+        const CommandBus &bus = commandBus(output);
+        for(int source = 0; source < InputSourceCount; ++source) {
+            *out += QByteArray("nb_command_bus_posted_total{") + label(output) + ",source=\""
+                    + inputSourceName(InputSource(source)) + "\"} "
+                    + QByteArray::number(bus.posted(InputSource(source))) + '\n';
+        }
+    }
+    *out += "# HELP nb_command_bus_dropped_total Commands dropped because the bus was full.\n"
+            "# TYPE nb_command_bus_dropped_total counter\n";
+    for(int output = 0; output < outputCount(); ++output)
+        *out += "nb_command_bus_dropped_total{" + label(output) + "} " + QByteArray::number(commandBus(output).dropped()) + '\n';
+    *out += "# HELP nb_command_bus_depth Commands waiting for the render thread.\n"
+            "# TYPE nb_command_bus_depth gauge\n";
+    for(int output = 0; output < outputCount(); ++output)
+        *out += "nb_command_bus_depth{" + label(output) + "} " + QByteArray::number(commandBus(output).depth()) + '\n';
+    *out += "# HELP nb_command_bus_high_water Most commands that have been waiting at once.\n"
+            "# TYPE nb_command_bus_high_water gauge\n";
+    for(int output = 0; output < outputCount(); ++output)
+        *out += "nb_command_bus_high_water{" + label(output) + "} " + QByteArray::number(commandBus(output).highWater()) + '\n';
+}
@@ -0,0 +1,191 @@
+#ifndef AUDIOENGINE_H
+#define AUDIOENGINE_H
+
+#include <QObject>
+#include <QAudioDevice>
+#include <QAudioFormat>
+#include <QThread>
+#include <QVector>
+
+#include <array>
+#include <memory>
+#include <vector>
+
+#include "buffercontroller.h"
+#include "commandbus.h"
+#include "dspconfig.h"
+#include "inputevent.h"
+#include "playbackcommand.h"
+#include "samplecache.h"
+#include "spscqueue.h"
+
+class QAudioSink;
+class QSettings;
+class Mixer;
+
+// Polyphonic playback engine. Every output device has its own mixer and
+// QAudioSink on a dedicated render thread, so a slow or stalled device does
+// not hold up the others; each slot plays on exactly one of them. Samples are
+// shared, not copied, between the mixers. All public functions may be called
+// from any thread.
+class AudioEngine : public QObject
+{
+    Q_OBJECT
+
+public:
+    // A device next to the engine's own one, e.g. a monitor speaker.
+    struct OutputConfig {
+        QString name;
+        // QAudioDevice id or description; empty for the engine's device,
+        // "null" to render in real time without a device.
+        QString device;
+        // Slots that play here instead of on the first output.
+        QList<int> routedSlots;
+    };
+
+    struct Config {
+        int voices = 16;
+        int periodFrames = 256;
+        // Sink buffer, 0 for two periods. With adaptiveBuffer it is only the
+        // starting size and moves between minBufferFrames and maxBufferFrames.
+        int bufferFrames = 0;
+        bool adaptiveBuffer = false;
+        int minBufferFrames = 0;
+        int maxBufferFrames = 8192;
+        int bufferStableSeconds = 30;
+        // Commands and input events applied per period, 0 for no limit.
+        int maxCommandsPerPeriod = 0;
+        // Long tracks playing at once per output, and the PCM each one
+        // decodes ahead, see PcmStream.
+        int streams = 4;
+        int streamBufferMs = 4000;
+        DspConfig dsp;
+        // Render in real time without an output device, on every output.
+        bool nullSink = false;
+        QList<OutputConfig> outputs;
+        // One input queue per serial board and output, see SerialBoards.
+        int inputQueues = 1;
+        int inputQueueCapacity = 256;
+        SpscQueue<InputEvent>::OverflowPolicy inputOverflowPolicy = SpscQueue<InputEvent>::OverflowPolicy::DropNewest;
+    };
+
+    // What an output buffer looks like right now; safe from any thread.
+    struct OutputStats {
+        QString name;
+        quint64 underruns = 0;
+        int bufferFrames = 0;
+        int depthFrames = 0;
+        int periodFrames = 0;
+        // Limiter lookahead.
+        int dspFrames = 0;
+        int sampleRate = 0;
+        bool adaptive = false;
+        quint64 streamUnderruns = 0;
+        // A voice started now is heard after the mixed period, the limiter's
+        // lookahead and a full buffer.
+        double latencyMs() const
+        {
+            return sampleRate > 0 ? (bufferFrames + periodFrames + dspFrames) * 1000.0 / sampleRate : 0.0;
+        }
+    };
+
+    // Audio/voices, Audio/periodFrames, Audio/bufferFrames, Audio/adaptiveBuffer,
+    // Audio/minBufferFrames, Audio/maxBufferFrames, Audio/bufferStableSeconds,
+    // Audio/maxCommandsPerPeriod, Audio/streams, Audio/streamBufferMs, the Dsp
+    // group with one key per DspConfig field (Dsp/fadeInMs, Dsp/limiter, ...),
+    // the outputs array (name, device, slots), serial/queueCapacity,
+    // serial/overflowPolicy.
+    static Config readConfig(QSettings &settings);
+
+    // device is the first output, where every slot not routed elsewhere plays.
+    explicit AudioEngine(const QAudioDevice &device, const Config &config, QObject *parent = nullptr);
+    ~AudioEngine();
+
+    // Format of the PCM the mixers expect in a Sample; all outputs run at its rate.
+    QAudioFormat format() const { return m_mixFormat; }
+    Config config() const { return m_config; }
+
+    static constexpr int MaxInputQueues = 8;
+
+    // Events pushed here by a serial thread are applied by the output's render
+    // thread. Each queue has exactly one producer; nullptr when out of range.
+    SpscQueue<InputEvent> *inputQueue(int index = 0, int output = 0)
+    {
+        if(output < 0 || output >= outputCount())
+            return nullptr;
+        const auto &queues = m_outputs[size_t(output)]->inputQueues;
+        return index >= 0 && index < int(queues.size()) ? queues[size_t(index)].get() : nullptr;
+    }
+    int inputQueueCount() const { return int(m_outputs.front()->inputQueues.size()); }
+    // The queues of one board on every output, with the slots routed there.
+    QVector<InputRoute> inputRoutes(int index) const;
+
+    int outputCount() const { return int(m_outputs.size()); }
+    int outputForSlot(int slot) const;
+
+    // Armed samples can be started by slot number without a cache lookup.
+    void arm(int slot, const SamplePtr &sample, float gain = 1.0f);
+    // received is the InputEvent::now() timestamp of the originating input, 0 for now.
+    void trigger(int slot, float gain = 1.0f, InputSource source = InputSource::Gui, qint64 received = 0);
+    void play(int slot, const SamplePtr &sample, float gain = 1.0f, InputSource source = InputSource::Gui, qint64 received = 0);
+    void stop(int slot);
+    void stopAll();
+    void seek(int slot, qint64 ms);
+    // Applies all commands in order within the same audio period of each output.
+    void submit(const QList<PlaybackCommand> &commands);
+
+    // Updates from all sources are coalesced to one value per audio period and
+    // reported once through masterGainChanged() with the source that set it.
+    // The gain is the same on every output.
+    void setMasterGain(float gain, InputSource source = InputSource::Gui);
+    float masterGain() const;
+    quint64 playingSlots() const;
+    bool isPlaying(int slot) const { return playingSlots() & (quint64(1) << slot); }
+    // Position in milliseconds of the most recently started voice on any output;
+    // slot is -1 when idle.
+    qint64 position(int *slot = nullptr) const;
+    OutputStats outputStats(int output = 0) const;
+    // Every command for the output from any thread goes through here; safe
+    // to read from any thread.
+    const CommandBus &commandBus(int output = 0) const;
+
+signals:
+    void masterGainChanged(float gain, InputSource source);
+    void playingSlotsChanged(quint64 playing);
+    // A trigger found its slot unarmed; source is where it came from.
+    void triggerMissed(int slot, InputSource source);
+
+private:
+    struct Output {
+        QString name;
+        // Null for a null sink.
+        QAudioDevice device;
+        QAudioFormat format;
+        quint64 slotMask = 0;
+        std::vector<std::unique_ptr<SpscQueue<InputEvent>>> inputQueues;
+        QThread renderThread;
+        Mixer *mixer = nullptr;
+        QAudioSink *sink = nullptr;
+        // Only used on the render thread, and only with Config::adaptiveBuffer.
+        std::unique_ptr<BufferController> bufferController;
+    };
+
+    static QAudioDevice findDevice(const QString &device);
+    int addOutput(const QString &name, const QAudioDevice &device);
+    void startSink(Output *output, int bufferFrames);
+    void startNullSink(Output *output);
+    void handleUnderrun(Output *output);
+    void shrinkBuffer(Output *output);
+    Mixer *mixerFor(int slot) const { return m_outputs[size_t(outputForSlot(slot))]->mixer; }
+    void appendMetrics(QByteArray *out) const;
+
+    Config m_config;
+    QAudioFormat m_mixFormat;
+    std::vector<std::unique_ptr<Output>> m_outputs;
+    // Output index per slot.
+    std::array<qint8, 64> m_slotOutput;
+    // Main thread only: last union of the outputs' playing slots reported.
+    quint64 m_reportedPlaying = 0;
+};
+
+#endif // AUDIOENGINE_H
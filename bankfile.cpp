@@ -0,0 +1,189 @@
+#include "bankfile.h"
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QPointer>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QThreadPool>
+#include <QDebug>
+
+// Shared with the pool tasks so a write finishing after the BankFile is gone is harmless.
+struct BankFile::WriteState
+{
+    QMutex mutex;
+    quint64 generation = 0;
+    quint64 written = 0;
+};
+
+BankFile::BankFile(const QString &path, QObject *parent)
+    : QObject(parent),
+    m_path(path),
+    m_state(std::make_shared<WriteState>())
+{
+    m_timer.setSingleShot(true);
+    m_timer.setInterval(DebounceMs);
+    connect(&m_timer, &QTimer::timeout, this, &BankFile::startWrite);
+}
+
+BankFile::~BankFile()
+{
+    flush();
+}
+
+QString BankFile::defaultPath()
+{
+    return QStandardPaths::writableLocation(QStandardPaths::AppDataLocation) + "/bank.json";
+}
+
+bool BankFile::read(const QString &path, Contents *contents, QString *errorString)
+{
+    QFile file(path);
+    if(!file.open(QIODevice::ReadOnly)) {
+        if(errorString)
+            *errorString = file.errorString();
+        return false;
+    }
+
+    QJsonParseError parseError;
+    const QJsonObject root = QJsonDocument::fromJson(file.readAll(), &parseError).object();
+    if(parseError.error != QJsonParseError::NoError) {
+        if(errorString)
+            *errorString = parseError.errorString();
+        return false;
+    }
+    if(root.value("format").toString() != "nippelboard-bank" || root.value("version").toInt() > Version) {
+        if(errorString)
+            *errorString = "not a supported bank file";
+        return false;
+    }
+
+    // Relative paths are resolved against the bank file, which keeps a bank
+    // and its sounds movable as one directory.
+    const QDir base = QFileInfo(path).absoluteDir();
+    Contents result;
+    const QJsonArray array = root.value("slots").toArray();
+    for(qsizetype i = 0; i < qMin<qsizetype>(array.size(), SoundBank::MaxSlots); ++i) {
+        const QJsonObject object = array.at(i).toObject();
+        SoundBank::Slot slot;
+        slot.label = object.value("label").toString();
+        const QString file = object.value("file").toString();
+        slot.path = file.isEmpty() ? QString() : QDir::cleanPath(base.absoluteFilePath(file));
+        slot.hash = object.value("sha1").toString().toLatin1();
+        slot.gain = float(object.value("gain").toDouble(1.0));
+        result.entries.append(slot);
+    }
+
+    const QJsonObject serial = root.value("serial").toObject();
+    result.serial.port = serial.value("port").toString();
+    result.serial.baudRate = serial.value("baudRate").toInt();
+
+    *contents = result;
+    return true;
+}
+
+bool BankFile::write(const QString &path, const Contents &contents, QString *errorString)
+{
+    // Stored relative to the bank file, see read().
+    const QDir base = QFileInfo(path).absoluteDir();
+    QJsonArray array;
+    for(int i = 0; i < contents.entries.size(); ++i) {
+        const SoundBank::Slot &slot = contents.entries.at(i);
+        QJsonObject object {
+            { "label", slot.label },
+            { "file", slot.path.isEmpty() ? QString() : base.relativeFilePath(slot.path) },
+            { "gain", double(slot.gain) }
+        };
+        if(!slot.hash.isEmpty())
+            object.insert("sha1", QString::fromLatin1(slot.hash));
+        array.append(object);
+    }
+
+    const QJsonObject root {
+        { "format", "nippelboard-bank" },
+        { "version", Version },
+        { "slots", array },
+        { "serial", QJsonObject { { "port", contents.serial.port }, { "baudRate", contents.serial.baudRate } } }
+    };
+
+    QDir().mkpath(QFileInfo(path).absolutePath());
+    QSaveFile file(path);
+    if(!file.open(QIODevice::WriteOnly)
+        || file.write(QJsonDocument(root).toJson(QJsonDocument::Indented)) < 0
+        || !file.commit()) {
+        if(errorString)
+            *errorString = file.errorString();
+        return false;
+    }
+    return true;
+}
+
+void BankFile::scheduleSave(const Contents &contents)
+{
+    m_pending = contents;
+    m_hasPending = true;
+    m_timer.start();
+}
+
+void BankFile::flush()
+{
+    m_timer.stop();
+    if(!m_hasPending)
+        return;
+    m_hasPending = false;
+
+    QMutexLocker locker(&m_state->mutex);
+    const quint64 generation = ++m_state->generation;
+    QString errorString;
+    if(write(m_path, m_pending, &errorString))
+        m_state->written = generation;
+    else
+        qDebug() << "failed to save bank" << m_path << errorString;
+}
+
+void BankFile::startWrite()
+{
+    if(!m_hasPending)
+        return;
+    m_hasPending = false;
+
+    const QString path = m_path;
+    const Contents contents = m_pending;
+    const std::shared_ptr<WriteState> state = m_state;
+    quint64 generation;
+    {
+        QMutexLocker locker(&state->mutex);
+        generation = ++state->generation;
+    }
+
+    QPointer<BankFile> self(this);
+    QThreadPool::globalInstance()->start([self, path, contents, state, generation]() {
+        QString errorString;
+        bool ok;
+        {
+            QMutexLocker locker(&state->mutex);
+            // A newer save already reached the disk.
+            if(generation < state->written)
+                return;
+            ok = write(path, contents, &errorString);
+            if(ok)
+                state->written = generation;
+        }
+        if(!self)
+            return;
+        QMetaObject::invokeMethod(self, [self, path, ok, errorString]() {
+            if(ok) {
+                emit self->saved(path);
+            } else {
+                qDebug() << "failed to save bank" << path << errorString;
+                emit self->saveFailed(path, errorString);
+            }
+        }, Qt::QueuedConnection);
+    });
+}
@@ -0,0 +1,72 @@
+#ifndef BANKFILE_H
+#define BANKFILE_H
+
+#include <QObject>
+#include <QList>
+#include <QString>
+#include <QTimer>
+
+#include <memory>
+
+#include "soundbank.h"
+
+// One versioned JSON file holding a whole board setup, so it can be copied to
+// another machine:
+//
+// {"format": "nippelboard-bank", "version": 1,
+//  "slots": [{"label": "Button 1", "file": "sounds/horn.mp3", "sha1": "...", "gain": 1.0}, ...],
+//  "serial": {"port": "ttyACM0", "baudRate": 115200}}
+//
+// Files are stored relative to the bank file.
+//
+// Saves are debounced and written atomically (temporary file, then rename)
+// on the thread pool, so the GUI thread never waits for the disk.
+class BankFile : public QObject
+{
+    Q_OBJECT
+
+public:
+    struct Serial {
+        QString port;
+        qint32 baudRate = 0;
+    };
+
+    struct Contents {
+        QList<SoundBank::Slot> entries;
+        Serial serial;
+    };
+
+    static constexpr int Version = 1;
+    static constexpr int DebounceMs = 500;
+
+    explicit BankFile(const QString &path, QObject *parent = nullptr);
+    ~BankFile();
+
+    static QString defaultPath();
+    QString path() const { return m_path; }
+
+    static bool read(const QString &path, Contents *contents, QString *errorString = nullptr);
+    static bool write(const QString &path, const Contents &contents, QString *errorString = nullptr);
+
+    // Only the latest contents are written, DebounceMs after the last call.
+    void scheduleSave(const Contents &contents);
+    // Writes pending contents right away and waits for it, e.g. on shutdown.
+    void flush();
+
+signals:
+    void saved(const QString &path);
+    void saveFailed(const QString &path, const QString &errorString);
+
+private:
+    struct WriteState;
+
+    void startWrite();
+
+    QString m_path;
+    QTimer m_timer;
+    Contents m_pending;
+    bool m_hasPending = false;
+    std::shared_ptr<WriteState> m_state;
+};
+
+#endif // BANKFILE_H
@@ -0,0 +1,605 @@
+// Load generator for the serial, playback and HTTP core.
+//
+// A pseudo-terminal pair stands in for the Arduino: the master side streams
+// "id;value\r\n" frames (optionally split and mixed with garbage) while a
+// ReceiverThread reads the slave side exactly like a real board. At the same
+// time several clients hammer /play/ and /volume/ over keep-alive HTTP. The
+// audio engine renders into a null sink so the full trigger path is measured.
+// The mixer is also timed on its own, per period, with and without the DSP
+// stage. Results are printed as one JSON document for comparing builds.
+
+#include "apiserver.h"
+#include "audioengine.h"
+#include "frameparser.h"
+#include "latencymetrics.h"
+#include "mixer.h"
+#include "mixkernels.h"
+#include "pcmstore.h"
+#include "playbackmodel.h"
+#include "receiverthread.h"
+#include "samplecache.h"
+#include "soundbank.h"
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QTemporaryDir>
+#include <QtMath>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <termios.h>
+#include <unistd.h>
+
+namespace {
+
+struct Options {
+    int seconds = 5;
+    double frameRate = 2000.0;
+    double splitRatio = 0.2;
+    int garbageEvery = 50;
+    int clients = 8;
+    int periodFrames = 256;
+};
+
+QJsonObject percentiles(std::vector<qint64> values)
+{
+    std::sort(values.begin(), values.end());
+    auto at = [&values](double q) -> double {
+        if(values.empty())
+            return 0.0;
+        return values[qMin(values.size() - 1, size_t(q * values.size()))] / 1000.0;
+    };
+    return QJsonObject {
+        { "p50", at(0.50) },
+        { "p99", at(0.99) },
+        { "p999", at(0.999) },
+        { "max", values.empty() ? 0.0 : values.back() / 1000.0 }
+    };
+}
+
+QJsonObject histogramJson(const LatencyHistogram &histogram)
+{
+    return QJsonObject {
+        { "count", qint64(histogram.count()) },
+        { "p50", histogram.quantile(0.50) / 1000.0 },
+        { "p99", histogram.quantile(0.99) / 1000.0 },
+        { "max", histogram.max() / 1000.0 }
+    };
+}
+
+std::string makeFrame(int index)
+{
+    static const int ids[] = { 0, 1, 2, 4, 8, 16, 5 };
+    char frame[32];
+    const int length = std::snprintf(frame, sizeof(frame), "%d;%d\r\n", ids[index % 7], (index * 7) % 256);
+    return std::string(frame, size_t(length));
+}
+
+// Raw parser throughput on an in-memory stream, read in 64 byte chunks.
+QJsonObject benchParser()
+{
+    std::string stream;
+    const int frameCount = 1000000;
+    for(int i = 0; i < frameCount; ++i) {
+        stream += makeFrame(i);
+        if(i % 100 == 0)
+            stream += "x#\x01garbage\r\n";
+    }
+
+    FrameParser parser;
+    quint64 checksum = 0;
+    QElapsedTimer timer;
+    timer.start();
+    for(size_t offset = 0; offset < stream.size(); offset += 64) {
+        const qsizetype size = qsizetype(qMin<size_t>(64, stream.size() - offset));
+        parser.feed(stream.data() + offset, size, [&checksum](const FrameParser::Frame &frame) {
+            checksum += quint64(frame.id + frame.value);
+        });
+    }
+    const double seconds = timer.nsecsElapsed() / 1e9;
+
+    const FrameParser::Counters counters = parser.counters();
+    return QJsonObject {
+        { "bytes", qint64(counters.bytes) },
+        { "frames", qint64(counters.frames) },
+        { "malformed", qint64(counters.malformed) },
+        { "framesPerSecond", counters.frames / seconds },
+        { "megabytesPerSecond", counters.bytes / seconds / 1e6 },
+        { "checksum", qint64(checksum) }
+    };
+}
+
+class FakeBoard
+{
+public:
+    ~FakeBoard()
+    {
+        if(m_master >= 0)
+            ::close(m_master);
+    }
+
+    bool open()
+    {
+        m_master = ::posix_openpt(O_RDWR | O_NOCTTY);
+        if(m_master < 0 || ::grantpt(m_master) != 0 || ::unlockpt(m_master) != 0)
+            return false;
+        termios attributes;
+        if(::tcgetattr(m_master, &attributes) == 0) {
+            ::cfmakeraw(&attributes);
+            ::tcsetattr(m_master, TCSANOW, &attributes);
+        }
+        m_slavePath = QString::fromLocal8Bit(::ptsname(m_master));
+        return true;
+    }
+
+    QString slavePath() const { return m_slavePath; }
+
+    // Streams frames at the given rate until the deadline.
+    void run(const Options &options, const std::atomic<bool> &stop)
+    {
+        std::mt19937 random(42);
+        std::uniform_real_distribution<double> chance(0.0, 1.0);
+        const qint64 intervalNs = qint64(1e9 / options.frameRate);
+
+        QElapsedTimer clock;
+        clock.start();
+        int index = 0;
+        while(!stop.load(std::memory_order_relaxed)) {
+            const qint64 due = qint64(index) * intervalNs;
+            const qint64 now = clock.nsecsElapsed();
+            if(due > now)
+                std::this_thread::sleep_for(std::chrono::nanoseconds(due - now));
+
+            std::string frame = makeFrame(index);
+            if(options.garbageEvery > 0 && index % options.garbageEvery == 0) {
+                write("\xff\x13;;zz");
+                write("\r\n");
+                ++garbage;
+            }
+            if(chance(random) < options.splitRatio) {
+                const size_t cut = 1 + size_t(index) % (frame.size() - 1);
+                write(frame.substr(0, cut));
+                std::this_thread::sleep_for(std::chrono::microseconds(200));
+                write(frame.substr(cut));
+                ++split;
+            } else {
+                write(frame);
+            }
+            ++frames;
+            ++index;
+        }
+    }
+
+    quint64 frames = 0;
+    quint64 split = 0;
+    quint64 garbage = 0;
+
+private:
+    void write(const std::string &bytes)
+    {
+        size_t done = 0;
+        while(done < bytes.size()) {
+            const ssize_t count = ::write(m_master, bytes.data() + done, bytes.size() - done);
+            if(count <= 0)
+                return;
+            done += size_t(count);
+        }
+    }
+
+    int m_master = -1;
+    QString m_slavePath;
+};
+
+class HttpClient
+{
+public:
+    explicit HttpClient(quint16 port)
+    {
+        m_socket = ::socket(AF_INET, SOCK_STREAM, 0);
+        int one = 1;
+        ::setsockopt(m_socket, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        sockaddr_in address {};
+        address.sin_family = AF_INET;
+        address.sin_port = htons(port);
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        m_connected = ::connect(m_socket, reinterpret_cast<sockaddr *>(&address), sizeof(address)) == 0;
+    }
+
+    ~HttpClient()
+    {
+        if(m_socket >= 0)
+            ::close(m_socket);
+    }
+
+    bool isConnected() const { return m_connected; }
+
+    // Returns the status code, 0 on connection failure.
+    int get(const char *path)
+    {
+        char request[256];
+        const int length = std::snprintf(request, sizeof(request),
+                                         "GET %s HTTP/1.1\r\nHost: localhost\r\nConnection: keep-alive\r\n\r\n", path);
+        if(::send(m_socket, request, size_t(length), MSG_NOSIGNAL) != length)
+            return 0;
+
+        m_buffer.clear();
+        size_t headerEnd = std::string::npos;
+        while(headerEnd == std::string::npos) {
+            if(!receive())
+                return 0;
+            headerEnd = m_buffer.find("\r\n\r\n");
+        }
+
+        size_t contentLength = 0;
+        const size_t header = m_buffer.find("Content-Length:");
+        const size_t headerLower = m_buffer.find("content-length:");
+        const size_t position = header != std::string::npos ? header : headerLower;
+        if(position != std::string::npos && position < headerEnd)
+            contentLength = size_t(std::strtoul(m_buffer.c_str() + position + 15, nullptr, 10));
+        while(m_buffer.size() < headerEnd + 4 + contentLength) {
+            if(!receive())
+                return 0;
+        }
+
+        return std::atoi(m_buffer.c_str() + 9);
+    }
+
+private:
+    bool receive()
+    {
+        char chunk[4096];
+        const ssize_t count = ::recv(m_socket, chunk, sizeof(chunk), 0);
+        if(count <= 0)
+            return false;
+        m_buffer.append(chunk, size_t(count));
+        return true;
+    }
+
+    int m_socket = -1;
+    bool m_connected = false;
+    std::string m_buffer;
+};
+
+QJsonObject benchHttp(quint16 port, const Options &options)
+{
+    std::atomic<quint64> requests { 0 };
+    std::atomic<quint64> errors { 0 };
+    std::vector<std::vector<qint64>> latencies(size_t(options.clients));
+    std::vector<std::thread> clients;
+
+    QElapsedTimer wall;
+    wall.start();
+    const qint64 deadline = qint64(options.seconds) * 1000000000LL;
+    for(int c = 0; c < options.clients; ++c) {
+        clients.emplace_back([&, c]() {
+            HttpClient client(port);
+            if(!client.isConnected()) {
+                errors.fetch_add(1);
+                return;
+            }
+            QElapsedTimer timer;
+            char path[64];
+            for(int i = 0; wall.nsecsElapsed() < deadline; ++i) {
+                if(i % 4 == 3)
+                    std::snprintf(path, sizeof(path), "/volume/%d", (i * 13) % 101);
+                else
+                    std::snprintf(path, sizeof(path), "/play/%d", i % 5);
+                timer.start();
+                const int status = client.get(path);
+                latencies[size_t(c)].push_back(timer.nsecsElapsed());
+                requests.fetch_add(1, std::memory_order_relaxed);
+                if(status < 200 || status >= 300) {
+                    errors.fetch_add(1, std::memory_order_relaxed);
+                    if(status == 0)
+                        return;
+                }
+            }
+        });
+    }
+    for(std::thread &client : clients)
+        client.join();
+    const double seconds = wall.nsecsElapsed() / 1e9;
+
+    std::vector<qint64> all;
+    for(const auto &clientLatencies : latencies)
+        all.insert(all.end(), clientLatencies.begin(), clientLatencies.end());
+
+    return QJsonObject {
+        { "clients", options.clients },
+        { "requests", qint64(requests.load()) },
+        { "errors", qint64(errors.load()) },
+        { "requestsPerSecond", requests.load() / seconds },
+        { "latencyUs", percentiles(all) }
+    };
+}
+
+SamplePtr makeTone(const QAudioFormat &format, int slot)
+{
+    auto sample = QSharedPointer<Sample>::create();
+    sample->path = QString("bench-%1").arg(slot);
+    sample->format = format;
+    const int frames = format.sampleRate() / 4;
+    const int channels = format.channelCount();
+    sample->pcm.resize(qsizetype(frames) * channels * qsizetype(sizeof(float)));
+    float *out = reinterpret_cast<float *>(sample->pcm.data());
+    for(int i = 0; i < frames; ++i) {
+        const float value = 0.1f * float(qSin(2.0 * M_PI * (220.0 * (slot + 1)) * i / format.sampleRate()));
+        for(int c = 0; c < channels; ++c)
+            *out++ = value;
+    }
+    return sample;
+}
+
+// Renders two seconds of audio flat out per configuration while all 16 voices
+// keep being retriggered, so fades, ducking, voice stealing and the limiter
+// all stay busy. margin is how many times the p99 period fits into the
+// period's own duration.
+QJsonObject benchDsp()
+{
+    QAudioFormat format;
+    format.setSampleRate(48000);
+    format.setChannelCount(2);
+    format.setSampleFormat(QAudioFormat::Float);
+    std::vector<SamplePtr> samples;
+    for(int slot = 0; slot < 16; ++slot) {
+        auto sample = makeTone(format, slot).constCast<Sample>();
+        // Loud enough that the sum goes well over full scale.
+        float *pcm = reinterpret_cast<float *>(sample->pcm.data());
+        for(qsizetype i = 0; i < sample->pcm.size() / qsizetype(sizeof(float)); ++i)
+            pcm[i] *= 5.0f;
+        samples.push_back(sample);
+    }
+
+    QJsonObject result;
+    for(int periodFrames : { 32, 64, 128, 256 }) {
+        QJsonObject perPeriod;
+        for(bool dsp : { false, true }) {
+            DspConfig config;
+            if(!dsp) {
+                config.fadeInMs = 0.0f;
+                config.fadeOutMs = 0.0f;
+                config.duckDb = 0.0f;
+                config.limiter = false;
+            }
+            Mixer mixer(format, QAudioFormat::Float, 16, periodFrames, {});
+            mixer.setDsp(config);
+            mixer.open(QIODevice::ReadOnly | QIODevice::Unbuffered);
+            for(int slot = 0; slot < 16; ++slot)
+                mixer.arm(slot, samples[size_t(slot)]);
+
+            std::vector<float> buffer(size_t(periodFrames) * 2);
+            const int periods = 2 * format.sampleRate() / periodFrames;
+            std::vector<qint64> times;
+            times.reserve(size_t(periods));
+            for(int period = 0; period < periods; ++period) {
+                if(period % 8 == 0)
+                    mixer.trigger((period / 8) % 16, 1.0f, InputSource::Gui, 0);
+                const qint64 start = InputEvent::now();
+                mixer.read(reinterpret_cast<char *>(buffer.data()), qint64(buffer.size() * sizeof(float)));
+                times.push_back(InputEvent::now() - start);
+            }
+
+            QJsonObject timing = percentiles(times);
+            const double periodUs = periodFrames * 1e6 / format.sampleRate();
+            timing.insert("periodUs", periodUs);
+            timing.insert("margin", periodUs / qMax(1e-3, timing.value("p99").toDouble()));
+            perPeriod.insert(dsp ? "dsp" : "plain", timing);
+        }
+        result.insert(QString::number(periodFrames), perPeriod);
+    }
+    result.insert("kernels", MixKernels::implementation());
+    return result;
+}
+
+// Time to render the period a trigger starts in, for a sample mapped from a
+// PcmStore. cold: the pages were dropped from the page cache. cached: they are
+// in memory but the mapping is new, so the period takes minor faults.
+// warmed: dropped as well, then warmed by SampleCache::warm() before the
+// trigger, as for every slot of the current bank. The store lives next to the
+// real one, a tmpfs directory would never be cold.
+QJsonObject benchWarming(int periodFrames)
+{
+    QAudioFormat format;
+    format.setSampleRate(48000);
+    format.setChannelCount(2);
+    format.setSampleFormat(QAudioFormat::Float);
+
+    QDir().mkpath(PcmStore::defaultDirectory());
+    QTemporaryDir directory(PcmStore::defaultDirectory() + "/bench-XXXXXX");
+    if(!directory.isValid())
+        return QJsonObject { { "error", "failed to create a store directory" } };
+    PcmStore store(directory.path());
+    const QByteArray hash = "benchwarming";
+    QString fileName;
+    {
+        auto tone = makeTone(format, 0).constCast<Sample>();
+        const SamplePtr stored = store.save(hash, tone);
+        if(!stored->mapping)
+            return QJsonObject { { "error", "failed to write the store entry" } };
+        fileName = stored->mapping->fileName();
+    }
+
+    auto dropPageCache = [&fileName]() {
+        const int fd = ::open(QFile::encodeName(fileName).constData(), O_RDONLY);
+        if(fd < 0)
+            return;
+        ::posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        ::close(fd);
+    };
+
+    enum Mode { Cold, Cached, Warmed };
+    static const char *modes[] = { "cold", "cached", "warmed" };
+    std::vector<qint64> times[3];
+    std::vector<float> buffer(size_t(periodFrames) * 2);
+    const qint64 bufferBytes = qint64(buffer.size() * sizeof(float));
+    for(int round = 0; round < 50; ++round) {
+        for(Mode mode : { Cold, Cached, Warmed }) {
+            if(mode != Cached)
+                dropPageCache();
+            const SamplePtr sample = store.load(hash, "bench-warming", format);
+            if(mode == Warmed)
+                SampleCache::warm(sample, qsizetype(format.bytesPerFrame()) * format.sampleRate());
+            Mixer mixer(format, QAudioFormat::Float, 16, periodFrames, {});
+            mixer.open(QIODevice::ReadOnly | QIODevice::Unbuffered);
+            mixer.arm(0, sample);
+            mixer.read(reinterpret_cast<char *>(buffer.data()), bufferBytes);
+            mixer.trigger(0, 1.0f, InputSource::Serial, 0);
+            const qint64 start = InputEvent::now();
+            mixer.read(reinterpret_cast<char *>(buffer.data()), bufferBytes);
+            times[mode].push_back(InputEvent::now() - start);
+        }
+    }
+
+    QJsonObject result;
+    for(Mode mode : { Cold, Cached, Warmed })
+        result.insert(modes[mode], percentiles(times[mode]));
+    result.insert("coldMinusWarmedP50", result.value("cold").toObject().value("p50").toDouble()
+                                        - result.value("warmed").toObject().value("p50").toDouble());
+    return result;
+}
+
+QJsonObject run(const Options &options)
+{
+    QJsonObject result;
+    result.insert("parser", benchParser());
+    result.insert("dspPeriodUs", benchDsp());
+    result.insert("triggerPeriodUs", benchWarming(options.periodFrames));
+
+    AudioEngine::Config config;
+    config.nullSink = true;
+    config.periodFrames = options.periodFrames;
+    config.inputQueueCapacity = 1024;
+    config.inputOverflowPolicy = SpscQueue<InputEvent>::OverflowPolicy::Block;
+    AudioEngine engine(QAudioDevice(), config);
+
+    SoundBank bank;
+    PlaybackModel model(&engine, &bank);
+    for(int slot = 0; slot < bank.slotCount(); ++slot) {
+        bank.setPath(slot, QString("bench-%1").arg(slot));
+        engine.arm(slot, makeTone(engine.format(), slot));
+    }
+
+    ApiServer server(&model, 0);
+    if(!server.isListening()) {
+        result.insert("error", "HTTP server failed to listen");
+        return result;
+    }
+
+    FakeBoard board;
+    if(!board.open()) {
+        result.insert("error", "failed to open a pseudo-terminal");
+        return result;
+    }
+
+    ReceiverThread receiver(engine.inputQueue());
+    receiver.setSlotMask(bank.slotMask());
+    receiver.startReceiver(board.slavePath(), 115200);
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+    std::atomic<bool> stop { false };
+    std::thread writer([&]() {
+        board.run(options, stop);
+    });
+    const QJsonObject http = benchHttp(server.port(), options);
+    stop.store(true);
+    writer.join();
+
+    // Let the receiver and the render thread drain what is still in flight.
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+    receiver.stopReceiver();
+
+    const FrameParser::Counters counters = receiver.parserCounters();
+    const SpscQueue<InputEvent>::Counters queue = engine.inputQueue()->counters();
+    result.insert("serial", QJsonObject {
+        { "framesSent", qint64(board.frames) },
+        { "framesSplit", qint64(board.split) },
+        { "garbageLines", qint64(board.garbage) },
+        { "framesParsed", qint64(counters.frames) },
+        { "framesLost", qint64(board.frames) - qint64(counters.frames) },
+        { "malformed", qint64(counters.malformed) },
+        { "dropped", qint64(counters.dropped) },
+        { "resyncs", qint64(counters.resyncs) },
+        { "queueOverflows", qint64(queue.overflows) },
+        { "queueDropped", qint64(queue.dropped) },
+        { "queueHighWater", qint64(queue.highWater) }
+    });
+    result.insert("http", http);
+
+    QJsonObject trigger;
+    LatencyMetrics &metrics = LatencyMetrics::instance();
+    static const char *stages[] = { "dispatch", "start", "buffer", "total" };
+    for(InputSource source : { InputSource::Serial, InputSource::Http }) {
+        QJsonObject perStage;
+        for(int stage = 0; stage < LatencyMetrics::StageCount; ++stage)
+            perStage.insert(stages[stage], histogramJson(metrics.histogram(LatencyMetrics::Stage(stage), source)));
+        trigger.insert(inputSourceName(source), perStage);
+    }
+    result.insert("triggerLatencyUs", trigger);
+    return result;
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("nb_bench");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Serial, HTTP and trigger latency benchmark for the Nippelboard core.");
+    parser.addHelpOption();
+    parser.addOption({ "duration", "Seconds to run the load phase.", "seconds", "5" });
+    parser.addOption({ "rate", "Serial frames per second.", "frames", "2000" });
+    parser.addOption({ "split", "Fraction of frames split across two writes.", "ratio", "0.2" });
+    parser.addOption({ "garbage", "Insert a garbage line every N frames, 0 disables.", "n", "50" });
+    parser.addOption({ "clients", "Concurrent HTTP clients.", "n", "8" });
+    parser.addOption({ "period", "Audio period in frames.", "frames", "256" });
+    parser.process(app);
+
+    Options options;
+    options.seconds = qMax(1, parser.value("duration").toInt());
+    options.frameRate = qMax(1.0, parser.value("rate").toDouble());
+    options.splitRatio = qBound(0.0, parser.value("split").toDouble(), 1.0);
+    options.garbageEvery = qMax(0, parser.value("garbage").toInt());
+    options.clients = qMax(1, parser.value("clients").toInt());
+    options.periodFrames = qMax(16, parser.value("period").toInt());
+
+    QJsonObject result;
+    std::thread bench([&]() {
+        result = run(options);
+        QMetaObject::invokeMethod(&app, &QCoreApplication::quit, Qt::QueuedConnection);
+    });
+    app.exec();
+    bench.join();
+
+    QJsonObject config {
+        { "duration", options.seconds },
+        { "rate", options.frameRate },
+        { "split", options.splitRatio },
+        { "garbage", options.garbageEvery },
+        { "clients", options.clients },
+        { "period", options.periodFrames }
+    };
+    result.insert("config", config);
+    std::fputs(QJsonDocument(result).toJson(QJsonDocument::Indented).constData(), stdout);
+    return result.contains("error") ? 1 : 0;
+}
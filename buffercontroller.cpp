@@ -0,0 +1,35 @@
+#include "buffercontroller.h"
+
+BufferController::BufferController(const Config &config, int initialFrames)
+    : m_config(config)
+{
+    m_config.minFrames = qMax(16, m_config.minFrames);
+    m_config.maxFrames = qMax(m_config.minFrames, m_config.maxFrames);
+    m_config.stepFrames = qMax(1, m_config.stepFrames);
+    m_frames = qBound(m_config.minFrames, initialFrames, m_config.maxFrames);
+}
+
+bool BufferController::underrun(qint64 nowMs)
+{
+    m_stableSince = nowMs;
+    const int frames = qMin(m_frames * 2, m_config.maxFrames);
+    if(frames == m_frames)
+        return false;
+    m_frames = frames;
+    return true;
+}
+
+bool BufferController::shrinkIfStable(qint64 nowMs)
+{
+    if(m_stableSince < 0)
+        m_stableSince = nowMs;
+    if(nowMs - m_stableSince < m_config.stableMs)
+        return false;
+    // Every step has to prove itself for another stableMs.
+    m_stableSince = nowMs;
+    const int frames = qMax(m_frames - m_config.stepFrames, m_config.minFrames);
+    if(frames == m_frames)
+        return false;
+    m_frames = frames;
+    return true;
+}
@@ -0,0 +1,35 @@
+#ifndef BUFFERCONTROLLER_H
+#define BUFFERCONTROLLER_H
+
+#include <QtGlobal>
+
+// Chooses the output buffer size. After an underrun the buffer grows at once,
+// doubling up to maxFrames; after stableMs without one it shrinks by one
+// period at a time down to minFrames. Not thread-safe, the audio engine only
+// uses it on the render thread.
+class BufferController
+{
+public:
+    struct Config {
+        int minFrames = 256;
+        int maxFrames = 8192;
+        int stepFrames = 256;
+        qint64 stableMs = 30000;
+    };
+
+    BufferController(const Config &config, int initialFrames);
+
+    int bufferFrames() const { return m_frames; }
+
+    // Both return true when bufferFrames() changed and the sink has to be
+    // restarted with the new size.
+    bool underrun(qint64 nowMs);
+    bool shrinkIfStable(qint64 nowMs);
+
+private:
+    Config m_config;
+    int m_frames;
+    qint64 m_stableSince = -1;
+};
+
+#endif // BUFFERCONTROLLER_H
@@ -0,0 +1,6 @@
+# cmake -DINPUT=<file> -DOUTPUT=<file.gz> -P gzip.cmake
+# Writes a plain gzip stream, so the build needs no gzip tool.
+if(NOT INPUT OR NOT OUTPUT)
+    message(FATAL_ERROR "usage: cmake -DINPUT=<file> -DOUTPUT=<file.gz> -P gzip.cmake")
+endif()
+file(ARCHIVE_CREATE OUTPUT "${OUTPUT}" PATHS "${INPUT}" FORMAT raw COMPRESSION GZip COMPRESSION_LEVEL 9)
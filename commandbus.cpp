@@ -0,0 +1,45 @@
+#include "commandbus.h"
+
+CommandBus::CommandBus(qsizetype capacity)
+    : m_queue(capacity)
+{
+}
+
+bool CommandBus::post(Command &&command)
+{
+    command.dispatched = InputEvent::now();
+    if(!command.received)
+        command.received = command.dispatched;
+    // Numbered by the place the CAS won, so the bus is in sequence order
+    // however producers interleave; an event stamped with claimed() before
+    // that sorts ahead of it.
+    const bool pushed = m_queue.push(command, [](Command &queued, quint64 position) {
+        queued.sequence = position + 1;
+    });
+    if(!pushed)
+        return false;
+    m_posted[int(command.source)].fetch_add(1, std::memory_order_relaxed);
+
+    const quint64 depth = m_accepted.fetch_add(1, std::memory_order_relaxed) + 1
+                          - m_taken.load(std::memory_order_relaxed);
+    quint64 highWater = m_highWater.load(std::memory_order_relaxed);
+    while(qint64(depth) > qint64(highWater)
+          && !m_highWater.compare_exchange_weak(highWater, depth, std::memory_order_relaxed)) {
+    }
+    return true;
+}
+
+bool CommandBus::tryPop(Command *command)
+{
+    if(!m_queue.tryPop(command))
+        return false;
+    m_taken.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+quint64 CommandBus::depth() const
+{
+    const quint64 taken = m_taken.load(std::memory_order_relaxed);
+    const quint64 accepted = m_accepted.load(std::memory_order_relaxed);
+    return accepted > taken ? accepted - taken : 0;
+}
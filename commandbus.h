@@ -0,0 +1,68 @@
+#ifndef COMMANDBUS_H
+#define COMMANDBUS_H
+
+#include <QList>
+#include <QtGlobal>
+
+#include <array>
+#include <atomic>
+
+#include "inputevent.h"
+#include "mpscqueue.h"
+#include "playbackcommand.h"
+#include "samplecache.h"
+
+// The one way into the playback engine. The GUI, the HTTP thread and the
+// replay post typed commands here from any thread; the render thread is the
+// only consumer. A command's sequence is the place it won on the bus, and a
+// serial InputEvent carries the bus's claimed() at the time it was queued, so
+// the mixer can apply the bus and the serial queues as one stream in the order
+// things were posted.
+class CommandBus
+{
+public:
+    struct Command {
+        enum Type { Arm, Trigger, Play, Stop, StopAll, MasterGain, Seek, Batch };
+        Type type = Play;
+        int slot = -1;
+        float gain = 1.0f;
+        // Seek only: target frame.
+        qint64 position = 0;
+        SamplePtr sample;
+        InputSource source = InputSource::Gui;
+        qint64 received = 0;
+        qint64 dispatched = 0;
+        quint64 sequence = 0;
+        // Batch only: applied back to back within one period.
+        QList<PlaybackCommand> batch;
+    };
+
+    explicit CommandBus(qsizetype capacity = 1024);
+
+    // Any thread, lock-free. Stamps sequence and dispatched; false when the
+    // bus is full.
+    bool post(Command &&command);
+    // Render thread only.
+    const Command *front() const { return m_queue.front(); }
+    bool tryPop(Command *command);
+
+    // The sequence for an InputEvent queued now: it goes before every command
+    // that gets its place on the bus from here on.
+    quint64 claimed() const { return m_queue.claimed(); }
+
+    // Commands that made it onto the bus; the rest are dropped().
+    quint64 posted(InputSource source) const { return m_posted[int(source)].load(std::memory_order_relaxed); }
+    quint64 dropped() const { return m_queue.dropped(); }
+    // Commands posted but not yet taken off; approximate while producers run.
+    quint64 depth() const;
+    quint64 highWater() const { return m_highWater.load(std::memory_order_relaxed); }
+
+private:
+    MpscQueue<Command> m_queue;
+    std::array<std::atomic<quint64>, InputSourceCount> m_posted {};
+    std::atomic<quint64> m_accepted { 0 };
+    std::atomic<quint64> m_taken { 0 };
+    std::atomic<quint64> m_highWater { 0 };
+};
+
+#endif // COMMANDBUS_H
@@ -0,0 +1,244 @@
+#include "core.h"
+#include "apiserver.h"
+#include "latencymetrics.h"
+#include "loudnessanalyzer.h"
+#include "playbackmodel.h"
+#include "samplecache.h"
+#include "statechannel.h"
+
+#include <QJsonArray>
+#include <QMediaDevices>
+#include <QTimer>
+#include <QtAlgorithms>
+#include <QDebug>
+
+Core::Core(const AudioEngine::Config &audioConfig, const QList<SerialBoards::Board> &boards, quint16 httpPort,
+           QObject *parent)
+    : QObject(parent),
+    m_boardConfigs(boards)
+{
+    m_startupTimer.start();
+
+    AudioEngine::Config config = audioConfig;
+    config.inputQueues = boards.size();
+    m_audioEngine = new AudioEngine(QMediaDevices::defaultAudioOutput(), config, this);
+    m_sampleCache = new SampleCache(m_audioEngine->format(), this);
+    m_loudness = new LoudnessAnalyzer(LoudnessAnalyzer::defaultCacheFile(), this);
+    m_boards = new SerialBoards(m_audioEngine, this);
+
+    m_playbackModel = new PlaybackModel(m_audioEngine, &m_bank, this);
+    m_apiServer = new ApiServer(m_playbackModel, httpPort, this);
+    m_stateChannel = m_apiServer->stateChannel();
+
+    connect(m_audioEngine, &AudioEngine::masterGainChanged, this, [this](float gain) {
+        m_stateChannel->publish("volume", qRound(gain * 100));
+    });
+    connect(m_audioEngine, &AudioEngine::playingSlotsChanged, this, &Core::playingSlotsChanged);
+    connect(m_audioEngine, &AudioEngine::triggerMissed, this, &Core::triggerMissed);
+    connect(m_sampleCache, &SampleCache::sampleReady, this, &Core::sampleReady);
+    connect(m_sampleCache, &SampleCache::sampleFailed, this, [this](int slot, const QString &path, const QString &errorString) {
+        qWarning() << "slot" << slot << "failed to load" << path << errorString;
+        slotSettled(slot);
+    });
+    connect(m_sampleCache, &SampleCache::sampleEvicted, this, [this](int slot) {
+        m_audioEngine->arm(slot, SamplePtr());
+    });
+    connect(m_loudness, &LoudnessAnalyzer::analyzed, this, &Core::armSlot);
+
+    // Every trigger heats its slot, wherever it was issued; the serial and
+    // HTTP ones do not come through play().
+    connect(m_boards, &SerialBoards::triggered, this, [this](int board, quint64 slotBits) {
+        Q_UNUSED(board);
+        recordPlays(slotBits);
+    });
+    connect(m_playbackModel, &PlaybackModel::played, this, [this](int slot) {
+        recordPlays(quint64(1) << slot);
+    });
+    connect(m_boards, &SerialBoards::opened, this, [this](int board, const QString &portName, qint32 baudRate) {
+        qDebug() << "Arduino" << board + 1 << portName << baudRate << "connected";
+        m_stateChannel->publish("serial", m_boards->summary());
+    });
+    connect(m_boards, &SerialBoards::openFailed, this, [this](int board, const QString &portName, const QString &errorString) {
+        qWarning() << "failed to connect arduino" << board + 1 << portName << errorString;
+        m_stateChannel->publish("serial", m_boards->summary());
+    });
+    connect(m_boards, &SerialBoards::errorOccurred, this, [this](int board, QSerialPort::SerialPortError error) {
+        Q_UNUSED(board);
+        if(error == QSerialPort::ResourceError)
+            m_stateChannel->publish("serial", m_boards->summary());
+    });
+
+    m_positionTimer = new QTimer(this);
+    m_positionTimer->setInterval(250);
+    connect(m_positionTimer, &QTimer::timeout, this, &Core::publishPosition);
+}
+
+Core::~Core()
+{
+    m_boards->stop();
+    delete m_apiServer;
+}
+
+bool Core::isListening() const
+{
+    return m_apiServer->isListening();
+}
+
+bool Core::readBank(const QString &path, QSettings &settings, BankFile::Contents *contents)
+{
+    QString errorString;
+    if(BankFile::read(path, contents, &errorString)) {
+        m_bank.setSlots(contents->entries);
+        return true;
+    }
+    qDebug() << "no bank file" << path << errorString << "- taking over the buttons from the settings";
+    m_bank.readSettings(settings);
+    return false;
+}
+
+void Core::loadBank()
+{
+    m_boards->setSlotMask(m_bank.slotMask());
+    for(int slot = 0; slot < m_bank.slotCount(); ++slot) {
+        const QString path = m_bank.path(slot);
+        if(!path.isEmpty())
+            m_startupPending |= quint64(1) << slot;
+        loadSlot(slot, path);
+    }
+    if(!m_startupPending)
+        slotSettled(-1);
+}
+
+void Core::replaceBank(const QList<SoundBank::Slot> &entries)
+{
+    const int previousCount = m_bank.slotCount();
+    m_bank.setSlots(entries);
+    for(int slot = m_bank.slotCount(); slot < previousCount; ++slot) {
+        m_audioEngine->arm(slot, SamplePtr());
+        m_sampleCache->load(slot, QString());
+    }
+    m_boards->setSlotMask(m_bank.slotMask());
+
+    // Every slot is decoded by its own pool task, so the warm-up runs on all cores.
+    for(int slot = 0; slot < m_bank.slotCount(); ++slot)
+        loadSlot(slot, m_bank.path(slot));
+}
+
+void Core::loadSlot(int slot, const QString &path)
+{
+    m_audioEngine->arm(slot, SamplePtr());
+    m_bank.setPath(slot, path);
+    m_sampleCache->load(slot, path);
+}
+
+bool Core::play(int slot, InputSource source, qint64 received)
+{
+    recordPlays(quint64(1) << slot);
+    return start(slot, source, received);
+}
+
+bool Core::start(int slot, InputSource source, qint64 received)
+{
+    const SamplePtr sample = m_sampleCache->acquire(slot);
+    if(!sample) {
+        if(!m_sampleCache->path(slot).isEmpty()) {
+            m_pendingPlay |= quint64(1) << slot;
+            m_pendingSource[slot] = source;
+        }
+        return false;
+    }
+    m_audioEngine->play(slot, sample, gain(slot, sample), source, received);
+    return true;
+}
+
+void Core::startBoards()
+{
+    for(const SerialBoards::Board &board : std::as_const(m_boardConfigs))
+        qDebug() << "serial port" << board.port << board.baudRate;
+    m_boards->start(m_boardConfigs);
+}
+
+void Core::restartBoard(int board, const SerialBoards::Board &config)
+{
+    m_boardConfigs[board] = config;
+    m_boards->startBoard(board, config);
+}
+
+void Core::slotSettled(int slot)
+{
+    if(slot >= 0) {
+        if(!m_startupPending)
+            return;
+        m_startupPending &= ~(quint64(1) << slot);
+        if(m_startupPending)
+            return;
+    }
+
+    LatencyMetrics::instance().setStartupDuration(m_startupTimer.nsecsElapsed());
+    qDebug() << "startup to ready" << m_startupTimer.elapsed() << "ms," << m_sampleCache->storeLoads()
+             << "mapped from store," << m_sampleCache->decodes() << "decoded, RSS"
+             << LatencyMetrics::residentMemory() / 1024 << "KiB";
+    emit ready(m_startupTimer.elapsed());
+}
+
+void Core::sampleReady(int slot)
+{
+    armSlot(slot);
+    m_loudness->analyze(slot, m_sampleCache->sample(slot));
+    slotSettled(slot);
+
+    const quint64 bit = quint64(1) << slot;
+    if(m_pendingPlay & bit) {
+        m_pendingPlay &= ~bit;
+        start(slot, m_pendingSource[slot], InputEvent::now());
+    }
+}
+
+// The normalisation gain is part of the armed gain, so the slot is armed again
+// once the analysis is in.
+void Core::armSlot(int slot)
+{
+    const SamplePtr sample = m_sampleCache->sample(slot);
+    if(sample)
+        m_audioEngine->arm(slot, sample, gain(slot, sample));
+}
+
+float Core::gain(int slot, const SamplePtr &sample) const
+{
+    return m_bank.gain(slot) * m_loudness->normalizationGain(sample);
+}
+
+// The slot was not armed when the trigger reached the mixer, e.g. after an
+// eviction; start it from the cache or once it has been loaded again.
+void Core::triggerMissed(int slot, InputSource source)
+{
+    start(slot, source, InputEvent::now());
+}
+
+void Core::recordPlays(quint64 slotBits)
+{
+    for(; slotBits; slotBits &= slotBits - 1)
+        m_sampleCache->recordPlay(qCountTrailingZeroBits(slotBits));
+}
+
+void Core::playingSlotsChanged(quint64 playing)
+{
+    QJsonArray playingList;
+    for(quint64 remaining = playing; remaining; remaining &= remaining - 1)
+        playingList.append(qCountTrailingZeroBits(remaining));
+    m_stateChannel->publish("playing", playingList);
+
+    if(playing && !m_positionTimer->isActive())
+        m_positionTimer->start();
+    publishPosition();
+}
+
+void Core::publishPosition()
+{
+    int slot = -1;
+    const qint64 position = m_audioEngine->position(&slot);
+    m_stateChannel->publish("slot", slot);
+    m_stateChannel->publishLive("position", slot >= 0 ? position : 0);
+    if(slot < 0)
+        m_positionTimer->stop();
+}
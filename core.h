@@ -0,0 +1,98 @@
+#ifndef CORE_H
+#define CORE_H
+
+#include <QObject>
+#include <QElapsedTimer>
+#include <QString>
+
+#include <array>
+
+#include "audioengine.h"
+#include "bankfile.h"
+#include "serialboards.h"
+#include "soundbank.h"
+
+class ApiServer;
+class LoudnessAnalyzer;
+class PlaybackModel;
+class SampleCache;
+class StateChannel;
+class QSettings;
+class QTimer;
+
+// Everything MainWindow and Daemon have in common: the serial boards, the
+// sample cache, the audio engine and the HTTP API wired together, with the
+// playback state published to the state channel. The front ends add their
+// widgets or command line on top.
+class Core : public QObject
+{
+    Q_OBJECT
+
+public:
+    // The engine gets one input queue per board.
+    Core(const AudioEngine::Config &audioConfig, const QList<SerialBoards::Board> &boards, quint16 httpPort,
+         QObject *parent = nullptr);
+    ~Core();
+
+    bool isListening() const;
+
+    SoundBank &bank() { return m_bank; }
+    const SoundBank &bank() const { return m_bank; }
+    AudioEngine *audioEngine() const { return m_audioEngine; }
+    SampleCache *sampleCache() const { return m_sampleCache; }
+    LoudnessAnalyzer *loudness() const { return m_loudness; }
+    SerialBoards *boards() const { return m_boards; }
+    // What startBoards() opens; may be adjusted before.
+    QList<SerialBoards::Board> &boardConfigs() { return m_boardConfigs; }
+    PlaybackModel *playbackModel() const { return m_playbackModel; }
+    ApiServer *apiServer() const { return m_apiServer; }
+    StateChannel *stateChannel() const { return m_stateChannel; }
+
+    // Fills the bank from the bank file, or takes the slots over from the
+    // Buttons settings when there is none; false in that case.
+    bool readBank(const QString &path, QSettings &settings, BankFile::Contents *contents);
+    // Loads every slot of the bank; ready() follows once each has been
+    // decoded or has failed.
+    void loadBank();
+    // Swaps in another bank, e.g. an imported one, and reloads every slot.
+    void replaceBank(const QList<SoundBank::Slot> &entries);
+    // The slot is silent until the new file is loaded.
+    void loadSlot(int slot, const QString &path);
+    // False when the slot is not loaded yet; it then starts as soon as it is,
+    // unless it has no file. Counts towards the slot's eviction heat either way.
+    bool play(int slot, InputSource source, qint64 received);
+
+    void startBoards();
+    void restartBoard(int board, const SerialBoards::Board &config);
+
+signals:
+    void ready(qint64 elapsedMs);
+
+private:
+    void sampleReady(int slot);
+    void armSlot(int slot);
+    bool start(int slot, InputSource source, qint64 received);
+    void recordPlays(quint64 slotBits);
+    float gain(int slot, const SamplePtr &sample) const;
+    void slotSettled(int slot);
+    void triggerMissed(int slot, InputSource source);
+    void playingSlotsChanged(quint64 playing);
+    void publishPosition();
+
+    SoundBank m_bank;
+    AudioEngine *m_audioEngine = nullptr;
+    SampleCache *m_sampleCache = nullptr;
+    LoudnessAnalyzer *m_loudness = nullptr;
+    SerialBoards *m_boards = nullptr;
+    QList<SerialBoards::Board> m_boardConfigs;
+    PlaybackModel *m_playbackModel = nullptr;
+    ApiServer *m_apiServer = nullptr;
+    StateChannel *m_stateChannel = nullptr;
+    QTimer *m_positionTimer = nullptr;
+    QElapsedTimer m_startupTimer;
+    quint64 m_startupPending = 0;
+    quint64 m_pendingPlay = 0;
+    std::array<InputSource, SoundBank::MaxSlots> m_pendingSource {};
+};
+
+#endif // CORE_H
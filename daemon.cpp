@@ -0,0 +1,129 @@
+#include "daemon.h"
+#include "apiserver.h"
+#include "core.h"
+#include "eventjournal.h"
+#include "journalreplay.h"
+#include "loudnessanalyzer.h"
+#include "receiverthread.h"
+#include "samplecache.h"
+
+#include <QCoreApplication>
+#include <QFileInfo>
+#include <QScopedPointer>
+#include <QSettings>
+#include <QTimer>
+#include <QDebug>
+
+Daemon::Daemon(const Options &options, QObject *parent)
+    : QObject(parent),
+    m_options(options)
+{
+}
+
+Daemon::~Daemon()
+{
+    delete m_replay;
+    delete m_core;
+    EventJournal::instance().stop();
+}
+
+bool Daemon::start()
+{
+    if(!m_options.configFile.isEmpty() && !QFileInfo::exists(m_options.configFile)) {
+        qWarning() << "configuration file" << m_options.configFile << "does not exist";
+        return false;
+    }
+
+    QScopedPointer<QSettings> settings(m_options.configFile.isEmpty()
+                                       ? new QSettings("SV48Reichwalde", "Nippelboard")
+                                       : new QSettings(m_options.configFile, QSettings::IniFormat));
+    if(settings->status() != QSettings::NoError) {
+        qWarning() << "cannot read configuration" << settings->fileName();
+        return false;
+    }
+
+    QVector<EventJournal::Record> replay;
+    QString errorString;
+    if(!m_options.replayFile.isEmpty() && !EventJournal::read(m_options.replayFile, &replay, &errorString)) {
+        qWarning() << "cannot replay" << m_options.replayFile << errorString;
+        return false;
+    }
+    if(!m_options.recordFile.isEmpty()) {
+        if(!EventJournal::instance().start(m_options.recordFile, &errorString)) {
+            qWarning() << "cannot record to" << m_options.recordFile << errorString;
+            return false;
+        }
+    } else {
+        EventJournal::instance().readSettings(*settings);
+    }
+
+    AudioEngine::Config audioConfig = AudioEngine::readConfig(*settings);
+    audioConfig.nullSink |= m_options.nullSink;
+    const QList<SerialBoards::Board> boards = SerialBoards::readSettings(*settings);
+
+    settings->beginGroup("http");
+    const quint16 httpPort = m_options.httpPort ? m_options.httpPort : quint16(settings->value("port", 11948).toUInt());
+    settings->endGroup();
+
+    m_core = new Core(audioConfig, boards, httpPort, this);
+    if(!m_core->isListening())
+        return false;
+
+    const QString bankPath = m_options.bankFile.isEmpty()
+            ? settings->value("Bank/file", BankFile::defaultPath()).toString() : m_options.bankFile;
+    BankFile::Contents bank;
+    m_core->readBank(bankPath, *settings, &bank);
+
+    // Command line first, then the settings, then what the bank was saved with.
+    SerialBoards::Board &first = m_core->boardConfigs().first();
+    if(!m_options.serialPort.isEmpty()) {
+        first.port = m_options.serialPort;
+    } else if(first.port.isEmpty()) {
+        first.port = bank.serial.port;
+        if(bank.serial.baudRate > 0)
+            first.baudRate = bank.serial.baudRate;
+    }
+    if(m_options.baudRate)
+        first.baudRate = m_options.baudRate;
+
+    m_core->sampleCache()->readSettings(*settings);
+    m_core->loudness()->readSettings(*settings);
+
+    qDebug() << "HTTP API on port" << m_core->apiServer()->port();
+    if(!m_options.replayFile.isEmpty()) {
+        m_replay = new JournalReplay(replay, m_core->boards(), m_core->playbackModel(), m_options.replayMaxSpeed
+                                     ? JournalReplay::Speed::Max : JournalReplay::Speed::RealTime);
+        connect(m_replay, &JournalReplay::replayFinished, this, &Daemon::replayFinished);
+        connect(m_replay, &JournalReplay::guiPlay, m_core, [this](int slot, qint64 received) {
+            m_core->play(slot, InputSource::Gui, received);
+        });
+        connect(m_core, &Core::ready, this, &Daemon::startReplay);
+        qDebug() << "replaying" << replay.size() << "events from" << m_options.replayFile << "once all slots are ready";
+        m_core->loadBank();
+    } else {
+        m_core->loadBank();
+        m_core->startBoards();
+    }
+    return true;
+}
+
+void Daemon::startReplay()
+{
+    if(!m_replay->isRunning() && !m_replay->isFinished())
+        m_replay->start(QThread::HighPriority);
+}
+
+void Daemon::replayFinished(qint64 records, qint64 elapsedNs)
+{
+    const SerialBoards *boards = m_core->boards();
+    for(int board = 0; board < boards->count(); ++board) {
+        const ReceiverThread *receiver = boards->receiver(board);
+        const FrameParser::Counters counters = receiver->parserCounters();
+        const SpscQueue<InputEvent>::Counters queue = receiver->queueCounters();
+        qDebug() << "board" << board + 1 << counters.frames << "frames," << counters.malformed << "malformed,"
+                 << queue.dropped << "events dropped, queue high water" << queue.highWater;
+    }
+    qDebug() << "replay done:" << records << "events in" << elapsedNs / 1000000 << "ms";
+    // Give the mixer a moment to pick up what is still queued.
+    QTimer::singleShot(500, QCoreApplication::instance(), &QCoreApplication::quit);
+}
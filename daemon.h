@@ -0,0 +1,49 @@
+#ifndef DAEMON_H
+#define DAEMON_H
+
+#include <QObject>
+#include <QString>
+
+class Core;
+class JournalReplay;
+
+// Headless counterpart of MainWindow: runs the Core with its configuration
+// taken from the settings and the command line instead of any widgets.
+class Daemon : public QObject
+{
+    Q_OBJECT
+
+public:
+    struct Options {
+        // INI file to read instead of the GUI's settings.
+        QString configFile;
+        // Bank file to load instead of the one named in the settings.
+        QString bankFile;
+        // Overrides for the values from the settings, empty or 0 keeps them.
+        // The serial port and baud rate apply to the first board.
+        QString serialPort;
+        qint32 baudRate = 0;
+        quint16 httpPort = 0;
+        bool nullSink = false;
+        // Journal to record to, overriding Journal/record and Journal/file.
+        QString recordFile;
+        // Journal to play back once all slots are loaded; the daemon exits afterwards.
+        QString replayFile;
+        bool replayMaxSpeed = false;
+    };
+
+    explicit Daemon(const Options &options, QObject *parent = nullptr);
+    ~Daemon();
+
+    bool start();
+
+private:
+    void startReplay();
+    void replayFinished(qint64 records, qint64 elapsedNs);
+
+    Options m_options;
+    Core *m_core = nullptr;
+    JournalReplay *m_replay = nullptr;
+};
+
+#endif // DAEMON_H
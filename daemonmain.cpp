@@ -0,0 +1,40 @@
+#include "daemon.h"
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication a(argc, argv);
+    QCoreApplication::setApplicationName("nb_qt_daemon");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Nippelboard without a GUI: serial board and HTTP API only.");
+    parser.addHelpOption();
+    parser.addOption({ { "c", "config" }, "Read settings from the INI file instead of the GUI's settings.", "file" });
+    parser.addOption({ "bank", "Load the sound bank from this file.", "file" });
+    parser.addOption({ { "s", "serial" }, "Serial port of the first board.", "port" });
+    parser.addOption({ { "b", "baud" }, "Baud rate of the first board.", "rate" });
+    parser.addOption({ { "p", "http-port" }, "Port of the HTTP API.", "port" });
+    parser.addOption({ "null-sink", "Render without an audio device." });
+    parser.addOption({ "record", "Record every input event to this journal file.", "file" });
+    parser.addOption({ "replay", "Replay a journal instead of reading the serial boards, then exit.", "file" });
+    parser.addOption({ "replay-speed", "realtime (default) or max.", "speed" });
+    parser.process(a);
+
+    Daemon::Options options;
+    options.configFile = parser.value("config");
+    options.bankFile = parser.value("bank");
+    options.serialPort = parser.value("serial");
+    options.baudRate = parser.value("baud").toInt();
+    options.httpPort = quint16(parser.value("http-port").toUInt());
+    options.nullSink = parser.isSet("null-sink");
+    options.recordFile = parser.value("record");
+    options.replayFile = parser.value("replay");
+    options.replayMaxSpeed = parser.value("replay-speed") == "max";
+
+    Daemon daemon(options);
+    if(!daemon.start())
+        return 1;
+    return a.exec();
+}
@@ -0,0 +1,23 @@
+#ifndef DSPCONFIG_H
+#define DSPCONFIG_H
+
+// Processing the mixer applies on top of plain summing, see Mixer::setDsp().
+struct DspConfig
+{
+    // Envelope of every voice when it starts and when it is stopped or stolen.
+    float fadeInMs = 2.0f;
+    float fadeOutMs = 15.0f;
+    // Voices already running are turned down by duckDb for duckHoldMs after
+    // a new one starts, then come back over duckReleaseMs. 0 dB disables it.
+    float duckDb = -6.0f;
+    int duckHoldMs = 300;
+    int duckReleaseMs = 250;
+    // Lookahead peak limiter on the master bus; adds the lookahead to the
+    // output latency.
+    bool limiter = true;
+    float limiterCeilingDb = -1.0f;
+    float limiterLookaheadMs = 1.5f;
+    int limiterReleaseMs = 80;
+};
+
+#endif // DSPCONFIG_H
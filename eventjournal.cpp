@@ -0,0 +1,208 @@
+#include "eventjournal.h"
+
+#include <QDateTime>
+#include <QDir>
+#include <QFileInfo>
+#include <QSettings>
+#include <QStandardPaths>
+#include <QThread>
+#include <QDebug>
+
+#include <cstring>
+
+namespace {
+
+const char Magic[8] = { 'N', 'B', 'J', 'O', 'U', 'R', 'N', 'L' };
+constexpr qint64 HeaderSize = 16;
+
+} // namespace
+
+EventJournal &EventJournal::instance()
+{
+    static EventJournal journal;
+    return journal;
+}
+
+// Room for a few seconds of a board sending at full rate between two writes.
+EventJournal::EventJournal()
+    : m_queue(16384)
+{
+}
+
+EventJournal::~EventJournal()
+{
+    stop();
+}
+
+void EventJournal::readSettings(QSettings &settings)
+{
+    settings.beginGroup("Journal");
+    const bool enabled = settings.value("record", false).toBool();
+    const QString path = settings.value("file", defaultPath()).toString();
+    settings.endGroup();
+
+    QString errorString;
+    if(enabled && !start(path, &errorString))
+        qWarning() << "cannot record the event journal to" << path << errorString;
+}
+
+QString EventJournal::defaultPath()
+{
+    return QStandardPaths::writableLocation(QStandardPaths::AppDataLocation) + "/journal/"
+            + QDateTime::currentDateTime().toString("yyyyMMdd-HHmmss") + ".nbj";
+}
+
+bool EventJournal::start(const QString &path, QString *errorString)
+{
+    stop();
+
+    QDir().mkpath(QFileInfo(path).absolutePath());
+    m_file.setFileName(path);
+    if(!m_file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        if(errorString)
+            *errorString = m_file.errorString();
+        return false;
+    }
+
+    char header[HeaderSize];
+    const quint32 version = Version;
+    const quint32 recordSize = sizeof(Record);
+    std::memcpy(header, Magic, sizeof(Magic));
+    std::memcpy(header + 8, &version, sizeof(version));
+    std::memcpy(header + 12, &recordSize, sizeof(recordSize));
+    if(m_file.write(header, HeaderSize) != HeaderSize) {
+        if(errorString)
+            *errorString = m_file.errorString();
+        m_file.close();
+        return false;
+    }
+
+    m_written.store(0, std::memory_order_relaxed);
+    m_stopping.store(false, std::memory_order_relaxed);
+    m_writer = QThread::create([this]() {
+        writeLoop();
+    });
+    m_writer->setObjectName("EventJournal");
+    m_writer->start(QThread::LowPriority);
+    m_recording.store(true, std::memory_order_release);
+    qDebug() << "recording event journal to" << path;
+    return true;
+}
+
+void EventJournal::stop()
+{
+    if(!m_writer)
+        return;
+    m_recording.store(false, std::memory_order_release);
+    m_stopping.store(true, std::memory_order_release);
+    m_writer->wait();
+    delete m_writer;
+    m_writer = nullptr;
+    m_file.close();
+    qDebug() << "event journal closed," << written() << "records," << dropped() << "dropped";
+}
+
+void EventJournal::recordFrame(int board, quint64 id, int value, qint64 timestamp)
+{
+    if(!isRecording())
+        return;
+    Record entry;
+    entry.timestamp = timestamp;
+    entry.id = id;
+    entry.value = value;
+    entry.kind = Frame;
+    entry.source = InputSource::Serial;
+    entry.board = quint8(board);
+    record(entry);
+}
+
+void EventJournal::recordPlay(InputSource source, int slot, qint64 timestamp)
+{
+    if(!isRecording())
+        return;
+    Record entry;
+    entry.timestamp = timestamp ? timestamp : InputEvent::now();
+    entry.id = quint64(slot);
+    entry.kind = Play;
+    entry.source = source;
+    record(entry);
+}
+
+void EventJournal::recordVolume(InputSource source, int volume, qint64 timestamp)
+{
+    if(!isRecording())
+        return;
+    Record entry;
+    entry.timestamp = timestamp ? timestamp : InputEvent::now();
+    entry.value = volume;
+    entry.kind = Volume;
+    entry.source = source;
+    record(entry);
+}
+
+void EventJournal::record(const Record &record)
+{
+    m_queue.push(record);
+}
+
+void EventJournal::writeLoop()
+{
+    while(!m_stopping.load(std::memory_order_acquire)) {
+        drain();
+        QThread::msleep(20);
+    }
+    drain();
+}
+
+void EventJournal::drain()
+{
+    Record records[256];
+    int count = 0;
+    for(;;) {
+        while(count < 256 && m_queue.tryPop(&records[count]))
+            ++count;
+        if(count == 0)
+            break;
+        const qint64 bytes = qint64(count) * qint64(sizeof(Record));
+        if(m_file.write(reinterpret_cast<const char *>(records), bytes) != bytes)
+            qWarning() << "event journal write failed:" << m_file.errorString();
+        m_written.fetch_add(quint64(count), std::memory_order_relaxed);
+        count = 0;
+    }
+    m_file.flush();
+}
+
+bool EventJournal::read(const QString &path, QVector<Record> *records, QString *errorString)
+{
+    QFile file(path);
+    if(!file.open(QIODevice::ReadOnly)) {
+        if(errorString)
+            *errorString = file.errorString();
+        return false;
+    }
+
+    const QByteArray header = file.read(HeaderSize);
+    quint32 version = 0;
+    quint32 recordSize = 0;
+    if(header.size() == HeaderSize) {
+        std::memcpy(&version, header.constData() + 8, sizeof(version));
+        std::memcpy(&recordSize, header.constData() + 12, sizeof(recordSize));
+    }
+    if(header.size() != HeaderSize || std::memcmp(header.constData(), Magic, sizeof(Magic)) != 0
+            || version > Version || recordSize != sizeof(Record)) {
+        if(errorString)
+            *errorString = "not an event journal";
+        return false;
+    }
+
+    // A journal cut short by a crash ends in a partial record, which is ignored.
+    const qint64 count = (file.size() - HeaderSize) / qint64(sizeof(Record));
+    records->resize(count);
+    const qint64 bytes = count * qint64(sizeof(Record));
+    if(file.read(reinterpret_cast<char *>(records->data()), bytes) != bytes) {
+        if(errorString)
+            *errorString = file.errorString();
+        return false;
+    }
+    return true;
+}
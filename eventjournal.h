@@ -0,0 +1,82 @@
+#ifndef EVENTJOURNAL_H
+#define EVENTJOURNAL_H
+
+#include <QFile>
+#include <QString>
+#include <QVector>
+#include <QtGlobal>
+
+#include <atomic>
+
+#include "inputevent.h"
+#include "mpscqueue.h"
+
+class QSettings;
+class QThread;
+
+// Append-only binary journal of every input, for reproducing a show and as a
+// repeatable load test (see JournalReplay). Recording threads only push a
+// fixed-size record into a lock-free queue; a writer thread appends them to
+// the file, so recording adds no latency to the input paths.
+//
+// File layout: "NBJOURNL", quint32 version, quint32 record size, then the
+// records in host byte order.
+class EventJournal
+{
+public:
+    enum Kind : quint8 {
+        Frame,      // raw serial frame: id is the button bitmask, value the pot
+        Play,       // id is the slot
+        Volume      // value is 0..100
+    };
+
+    struct Record {
+        qint64 timestamp = 0;   // InputEvent::now()
+        quint64 id = 0;
+        qint32 value = 0;
+        Kind kind = Frame;
+        InputSource source = InputSource::Serial;
+        quint8 board = 0;       // serial board the frame came from
+        quint8 reserved = 0;
+    };
+    static_assert(sizeof(Record) == 24, "journal records are 24 bytes on disk");
+
+    static constexpr quint32 Version = 1;
+
+    static EventJournal &instance();
+    ~EventJournal();
+
+    // Journal/record and Journal/file.
+    void readSettings(QSettings &settings);
+    static QString defaultPath();
+
+    bool start(const QString &path, QString *errorString = nullptr);
+    // Writes what is still queued and closes the file.
+    void stop();
+    bool isRecording() const { return m_recording.load(std::memory_order_relaxed); }
+    QString path() const { return m_file.fileName(); }
+
+    void recordFrame(int board, quint64 id, int value, qint64 timestamp);
+    void recordPlay(InputSource source, int slot, qint64 timestamp);
+    void recordVolume(InputSource source, int volume, qint64 timestamp);
+
+    quint64 written() const { return m_written.load(std::memory_order_relaxed); }
+    quint64 dropped() const { return m_queue.dropped(); }
+
+    static bool read(const QString &path, QVector<Record> *records, QString *errorString = nullptr);
+
+private:
+    EventJournal();
+    void record(const Record &record);
+    void writeLoop();
+    void drain();
+
+    MpscQueue<Record> m_queue;
+    std::atomic<bool> m_recording { false };
+    std::atomic<bool> m_stopping { false };
+    std::atomic<quint64> m_written { 0 };
+    QThread *m_writer = nullptr;
+    QFile m_file;
+};
+
+#endif // EVENTJOURNAL_H
@@ -0,0 +1,64 @@
+#include "frameparser.h"
+
+char *FrameParser::writePointer(qsizetype *space)
+{
+    const quint64 used = m_tail - m_head;
+    const qsizetype free = qsizetype(Capacity - used);
+    const qsizetype contiguous = qsizetype(Capacity - (m_tail & Mask));
+    *space = qMin(free, contiguous);
+    return *space > 0 ? m_ring + (m_tail & Mask) : nullptr;
+}
+
+void FrameParser::commit(qsizetype count)
+{
+    m_tail += quint64(count);
+    m_counters.bytes += quint64(count);
+}
+
+void FrameParser::reset()
+{
+    if(m_tail != m_head)
+        ++m_counters.dropped;
+    m_head = m_scan = m_tail;
+    m_discarding = true;
+}
+
+bool FrameParser::parseLine(quint64 begin, quint64 end, Frame *frame) const
+{
+    if(end > begin && m_ring[(end - 1) & Mask] == '\r')
+        --end;
+
+    quint64 id = 0;
+    int value = 0;
+    int field = 0;
+    int digits = 0;
+    for(quint64 i = begin; i < end; ++i) {
+        const char c = m_ring[i & Mask];
+        if(c >= '0' && c <= '9') {
+            const int digit = c - '0';
+            if(field == 0) {
+                // Up to 64 buttons, so the id may use all 20 digits of a quint64.
+                if(id > (~quint64(0) - digit) / 10)
+                    return false;
+                id = id * 10 + digit;
+            } else {
+                if(digits == 9)
+                    return false;
+                value = value * 10 + digit;
+            }
+            ++digits;
+        } else if(c == ';' && field == 0 && digits > 0) {
+            field = 1;
+            digits = 0;
+        } else {
+            return false;
+        }
+    }
+
+    if(field != 1 || digits == 0)
+        return false;
+
+    frame->id = id;
+    frame->value = value;
+    return true;
+}
@@ -0,0 +1,124 @@
+#ifndef FRAMEPARSER_H
+#define FRAMEPARSER_H
+
+#include <QtGlobal>
+
+// Streaming parser for the "id;value\r\n" frames sent by the Arduino.
+//
+// Bytes are read straight into a fixed ring buffer (writePointer()/commit())
+// and scanned in place, so a frame split across two reads is completed by the
+// next one and no memory is allocated per frame. Lines longer than
+// MaxFrameLength are discarded up to the next '\n', where the parser resyncs.
+class FrameParser
+{
+public:
+    struct Frame {
+        quint64 id = 0;     // bitmask of the pressed buttons, 0 for volume only
+        int value = 0;
+    };
+
+    struct Counters {
+        quint64 bytes = 0;
+        quint64 frames = 0;
+        quint64 malformed = 0;
+        quint64 dropped = 0;
+        quint64 resyncs = 0;
+    };
+
+    static constexpr qsizetype Capacity = 256;
+    static constexpr qsizetype MaxFrameLength = 32;
+
+    // Contiguous free space at the write position, nullptr when full.
+    char *writePointer(qsizetype *space);
+    void commit(qsizetype count);
+
+    // Copies data into the ring and parses it, for callers that already own the bytes.
+    template<typename Handler>
+    void feed(const char *data, qsizetype size, Handler &&handler);
+
+    // Scans the committed bytes and calls handler(const Frame &) for every complete frame.
+    template<typename Handler>
+    int parse(Handler &&handler);
+
+    // Forgets buffered bytes, e.g. after the port was reopened. The next line
+    // is treated as a possible fragment and discarded.
+    void reset();
+
+    const Counters &counters() const { return m_counters; }
+    qsizetype pending() const { return qsizetype(m_tail - m_head); }
+
+private:
+    static constexpr quint64 Mask = Capacity - 1;
+    static_assert((Capacity & Mask) == 0, "Capacity must be a power of two");
+    static_assert(MaxFrameLength < Capacity, "a frame must fit into the ring");
+
+    bool parseLine(quint64 begin, quint64 end, Frame *frame) const;
+
+    char m_ring[Capacity];
+    quint64 m_head = 0;
+    quint64 m_scan = 0;
+    quint64 m_tail = 0;
+    bool m_discarding = false;
+    Counters m_counters;
+};
+
+template<typename Handler>
+void FrameParser::feed(const char *data, qsizetype size, Handler &&handler)
+{
+    while(size > 0) {
+        qsizetype space = 0;
+        char *target = writePointer(&space);
+        if(!target) {
+            // Cannot happen while parse() keeps up, but never block the caller.
+            ++m_counters.dropped;
+            m_head = m_scan = m_tail;
+            m_discarding = true;
+            continue;
+        }
+        const qsizetype count = qMin(space, size);
+        for(qsizetype i = 0; i < count; ++i)
+            target[i] = data[i];
+        commit(count);
+        parse(handler);
+        data += count;
+        size -= count;
+    }
+}
+
+template<typename Handler>
+int FrameParser::parse(Handler &&handler)
+{
+    int frames = 0;
+    while(m_scan < m_tail) {
+        const char c = m_ring[m_scan & Mask];
+        ++m_scan;
+
+        if(c == '\n') {
+            const quint64 end = m_scan - 1;
+            const bool blank = end == m_head || (end - m_head == 1 && m_ring[m_head & Mask] == '\r');
+            Frame frame;
+            if(m_discarding) {
+                m_discarding = false;
+                ++m_counters.resyncs;
+            } else if(blank) {
+                // stray line break, nothing to report
+            } else if(parseLine(m_head, end, &frame)) {
+                ++m_counters.frames;
+                ++frames;
+                handler(frame);
+            } else {
+                ++m_counters.malformed;
+            }
+            m_head = m_scan;
+        } else if(m_scan - m_head > quint64(MaxFrameLength)) {
+            if(!m_discarding) {
+                ++m_counters.dropped;
+                m_discarding = true;
+            }
+            m_head = m_scan;
+        }
+    }
+    return frames;
+}
+
+#endif // FRAMEPARSER_H
@@ -0,0 +1,68 @@
+#ifndef INPUTEVENT_H
+#define INPUTEVENT_H
+
+#include <QtGlobal>
+
+#include <chrono>
+
+enum class InputSource : quint8 {
+    Serial,
+    Http,
+    Gui
+};
+
+constexpr int InputSourceCount = 3;
+
+inline const char *inputSourceName(InputSource source)
+{
+    switch(source) {
+    case InputSource::Serial:
+        return "serial";
+    case InputSource::Http:
+        return "http";
+    case InputSource::Gui:
+        return "gui";
+    }
+    return "unknown";
+}
+
+// Decoded input from the board, handed from the serial thread to the mixer.
+// A trigger carries every pressed slot as a bitmask (bit n = slot n).
+// timestamp is when the bytes arrived, dispatched when the event was queued,
+// sequence its place among the output's playback commands, see CommandBus.
+struct InputEvent
+{
+    enum Type : quint8 {
+        Volume,
+        Trigger
+    };
+
+    Type type = Trigger;
+    quint64 slotBits = 0;
+    int value = 0;
+    qint64 timestamp = 0;
+    qint64 dispatched = 0;
+    quint64 sequence = 0;
+
+    static qint64 now()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+};
+
+template<typename T>
+class SpscQueue;
+class CommandBus;
+
+// Where a board's events go, one route per audio output: triggers are split
+// by slot, volume changes go to every route. Events are sequenced against the
+// output's bus.
+struct InputRoute
+{
+    SpscQueue<InputEvent> *queue = nullptr;
+    const CommandBus *bus = nullptr;
+    quint64 slotMask = ~quint64(0);
+};
+
+#endif // INPUTEVENT_H
@@ -0,0 +1,90 @@
+#include "journalreplay.h"
+#include "playbackmodel.h"
+#include "receiverthread.h"
+#include "serialboards.h"
+
+#include <QElapsedTimer>
+#include <QDebug>
+
+JournalReplay::JournalReplay(const QVector<EventJournal::Record> &records, SerialBoards *boards,
+                             PlaybackModel *model, Speed speed, QObject *parent)
+    : QThread(parent),
+    m_records(records),
+    m_boards(boards),
+    m_model(model),
+    m_speed(speed)
+{
+    setObjectName("JournalReplay");
+}
+
+JournalReplay::~JournalReplay()
+{
+    cancel();
+    wait();
+}
+
+void JournalReplay::run()
+{
+    for(int board = 0; board < m_boards->count(); ++board)
+        m_boards->receiver(board)->prepareInjection();
+
+    QElapsedTimer clock;
+    clock.start();
+    const qint64 origin = m_records.isEmpty() ? 0 : m_records.first().timestamp;
+    qint64 replayed = 0;
+    qint64 skipped = 0;
+    QByteArray frame;
+    frame.reserve(FrameParser::MaxFrameLength);
+    PlaybackModel::Request request;
+    request.replayed = true;
+
+    for(const EventJournal::Record &record : std::as_const(m_records)) {
+        if(m_cancelled.load(std::memory_order_relaxed))
+            break;
+
+        if(m_speed == Speed::RealTime) {
+            const qint64 due = record.timestamp - origin;
+            const qint64 ahead = due - clock.nsecsElapsed();
+            if(ahead > 0)
+                QThread::usleep(quint64(ahead / 1000));
+        }
+
+        switch(record.kind) {
+        case EventJournal::Frame: {
+            ReceiverThread *receiver = m_boards->receiver(record.board);
+            if(!receiver) {
+                ++skipped;
+                continue;
+            }
+            frame = QByteArray::number(record.id) + ';' + QByteArray::number(record.value) + "\r\n";
+            receiver->inject(frame.constData(), frame.size());
+            break;
+        }
+        case EventJournal::Play:
+            if(record.source == InputSource::Gui) {
+                emit guiPlay(int(record.id), InputEvent::now());
+                break;
+            }
+            request.type = PlaybackModel::Request::Play;
+            request.value = int(record.id);
+            request.timestamp = InputEvent::now();
+            request.source = record.source;
+            m_model->apply({ request });
+            break;
+        case EventJournal::Volume:
+            request.type = PlaybackModel::Request::Volume;
+            request.value = qBound(0, record.value, 100);
+            request.timestamp = InputEvent::now();
+            request.source = record.source;
+            m_model->apply({ request });
+            break;
+        default:
+            ++skipped;
+            continue;
+        }
+        ++replayed;
+    }
+
+    qDebug() << "replayed" << replayed << "events in" << clock.elapsed() << "ms," << skipped << "skipped";
+    emit replayFinished(replayed, clock.nsecsElapsed());
+}
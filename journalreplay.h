@@ -0,0 +1,52 @@
+#ifndef JOURNALREPLAY_H
+#define JOURNALREPLAY_H
+
+#include <QThread>
+#include <QVector>
+
+#include <atomic>
+
+#include "eventjournal.h"
+
+class PlaybackModel;
+class SerialBoards;
+
+// Plays an EventJournal back through the live input paths: serial frames are
+// re-encoded and injected into the board's ReceiverThread (parser, slot map,
+// input queue, mixer), HTTP requests and volume changes go through the
+// PlaybackModel, GUI presses are handed to guiPlay() for the entry point live
+// presses use. Nothing replayed is journaled again. The serial boards are
+// stopped for the replay.
+class JournalReplay : public QThread
+{
+    Q_OBJECT
+
+public:
+    enum class Speed {
+        RealTime,   // keeps the recorded gaps between events
+        Max         // as fast as the queues take them
+    };
+
+    JournalReplay(const QVector<EventJournal::Record> &records, SerialBoards *boards,
+                  PlaybackModel *model, Speed speed, QObject *parent = nullptr);
+    ~JournalReplay();
+
+    void cancel() { m_cancelled.store(true, std::memory_order_relaxed); }
+
+signals:
+    void replayFinished(qint64 records, qint64 elapsedNs);
+    // Emitted from the replay thread.
+    void guiPlay(int slot, qint64 received);
+
+protected:
+    void run() override;
+
+private:
+    QVector<EventJournal::Record> m_records;
+    SerialBoards *m_boards;
+    PlaybackModel *m_model;
+    Speed m_speed;
+    std::atomic<bool> m_cancelled { false };
+};
+
+#endif // JOURNALREPLAY_H
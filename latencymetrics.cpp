@@ -0,0 +1,163 @@
+#include "latencymetrics.h"
+
+#include <QFile>
+#include <QList>
+#include <QMutexLocker>
+#include <QtAlgorithms>
+
+#ifdef Q_OS_LINUX
+#include <unistd.h>
+#endif
+
+namespace {
+
+const char *stageName(int stage)
+{
+    static const char *names[] = { "dispatch", "start", "buffer", "total" };
+    return names[stage];
+}
+
+void appendSeconds(QByteArray &out, qint64 ns)
+{
+    out += QByteArray::number(ns / 1e9, 'g', 9);
+}
+
+} // namespace
+
+int LatencyHistogram::bucketFor(qint64 ns)
+{
+    if(ns < SubBuckets)
+        return int(qMax<qint64>(ns, 0));
+    const int octave = 63 - int(qCountLeadingZeroBits(quint64(ns)));
+    const int shift = octave - 3;
+    const int sub = int((quint64(ns) >> shift) & (SubBuckets - 1));
+    const int bucket = (octave - 2) * SubBuckets + sub;
+    return qMin(bucket, BucketCount - 1);
+}
+
+qint64 LatencyHistogram::bucketUpperBound(int bucket)
+{
+    if(bucket < SubBuckets)
+        return bucket;
+    const int octave = bucket / SubBuckets + 2;
+    const int sub = bucket % SubBuckets;
+    const int shift = octave - 3;
+    return ((qint64(SubBuckets + sub + 1)) << shift) - 1;
+}
+
+void LatencyHistogram::record(qint64 ns)
+{
+    m_buckets[bucketFor(ns)].fetch_add(1, std::memory_order_relaxed);
+    m_count.fetch_add(1, std::memory_order_relaxed);
+    m_sum.fetch_add(ns, std::memory_order_relaxed);
+    qint64 previous = m_max.load(std::memory_order_relaxed);
+    while(ns > previous && !m_max.compare_exchange_weak(previous, ns, std::memory_order_relaxed)) {
+    }
+}
+
+qint64 LatencyHistogram::quantile(double q) const
+{
+    const quint64 total = count();
+    if(total == 0)
+        return 0;
+    const quint64 rank = qMax<quint64>(1, quint64(q * total + 0.5));
+    quint64 seen = 0;
+    for(int i = 0; i < BucketCount; ++i) {
+        seen += m_buckets[i].load(std::memory_order_relaxed);
+        if(seen >= rank)
+            return qMin(bucketUpperBound(i), max());
+    }
+    return max();
+}
+
+LatencyMetrics &LatencyMetrics::instance()
+{
+    static LatencyMetrics metrics;
+    return metrics;
+}
+
+void LatencyMetrics::recordTrigger(InputSource source, qint64 received, qint64 dispatched, qint64 started, qint64 buffered)
+{
+    const int index = int(source);
+    m_histograms[Dispatch][index].record(dispatched - received);
+    m_histograms[Start][index].record(started - dispatched);
+    m_histograms[Buffer][index].record(buffered - started);
+    m_histograms[Total][index].record(buffered - received);
+}
+
+QByteArray LatencyMetrics::prometheus() const
+{
+    QByteArray out;
+    out.reserve(8192);
+    out += "# HELP nb_trigger_latency_seconds Trigger latency per pipeline stage and input source.\n";
+    out += "# TYPE nb_trigger_latency_seconds summary\n";
+
+    static const double quantiles[] = { 0.5, 0.99 };
+    for(int stage = 0; stage < StageCount; ++stage) {
+        for(int source = 0; source < InputSourceCount; ++source) {
+            const LatencyHistogram &histogram = m_histograms[stage][source];
+            const QByteArray labels = QByteArray("stage=\"") + stageName(stage)
+                    + "\",source=\"" + inputSourceName(InputSource(source)) + "\"";
+            for(double q : quantiles) {
+                out += "nb_trigger_latency_seconds{" + labels + ",quantile=\"" + QByteArray::number(q) + "\"} ";
+                appendSeconds(out, histogram.quantile(q));
+                out += '\n';
+            }
+            out += "nb_trigger_latency_seconds_sum{" + labels + "} ";
+            appendSeconds(out, histogram.sum());
+            out += "\nnb_trigger_latency_seconds_count{" + labels + "} " + QByteArray::number(histogram.count()) + '\n';
+        }
+    }
+
+    out += "# HELP nb_trigger_latency_max_seconds Largest trigger latency seen per stage and input source.\n";
+    out += "# TYPE nb_trigger_latency_max_seconds gauge\n";
+    for(int stage = 0; stage < StageCount; ++stage) {
+        for(int source = 0; source < InputSourceCount; ++source) {
+            out += QByteArray("nb_trigger_latency_max_seconds{stage=\"") + stageName(stage)
+                    + "\",source=\"" + inputSourceName(InputSource(source)) + "\"} ";
+            appendSeconds(out, m_histograms[stage][source].max());
+            out += '\n';
+        }
+    }
+
+    out += "# HELP nb_startup_seconds Time from application startup until all slots were ready.\n";
+    out += "# TYPE nb_startup_seconds gauge\nnb_startup_seconds ";
+    appendSeconds(out, startupDuration());
+    out += "\n# HELP process_resident_memory_bytes Resident memory size in bytes.\n";
+    out += "# TYPE process_resident_memory_bytes gauge\nprocess_resident_memory_bytes "
+            + QByteArray::number(residentMemory()) + '\n';
+
+    QMutexLocker locker(&m_collectorsMutex);
+    for(const auto &collector : m_collectors)
+        collector.second(&out);
+    return out;
+}
+
+void LatencyMetrics::addCollector(const void *owner, const Collector &collector)
+{
+    QMutexLocker locker(&m_collectorsMutex);
+    m_collectors.append(qMakePair(owner, collector));
+}
+
+void LatencyMetrics::removeCollector(const void *owner)
+{
+    QMutexLocker locker(&m_collectorsMutex);
+    m_collectors.removeIf([owner](const QPair<const void *, Collector> &collector) {
+        return collector.first == owner;
+    });
+}
+
+qint64 LatencyMetrics::residentMemory()
+{
+#ifdef Q_OS_LINUX
+    QFile statm("/proc/self/statm");
+    if(!statm.open(QIODevice::ReadOnly))
+        return 0;
+    const QList<QByteArray> fields = statm.readAll().split(' ');
+    if(fields.size() < 2)
+        return 0;
+    return fields.at(1).toLongLong() * sysconf(_SC_PAGESIZE);
+#else
+    return 0;
+#endif
+}
@@ -0,0 +1,86 @@
+#ifndef LATENCYMETRICS_H
+#define LATENCYMETRICS_H
+
+#include <QByteArray>
+#include <QList>
+#include <QMutex>
+#include <QPair>
+#include <QtGlobal>
+
+#include <array>
+#include <atomic>
+#include <functional>
+
+#include "inputevent.h"
+
+// Lock-free log-linear histogram of nanosecond durations. record() only does
+// relaxed atomic increments, so it is safe on the audio and serial threads.
+class LatencyHistogram
+{
+public:
+    static constexpr int SubBuckets = 8;
+    static constexpr int Octaves = 40;
+    static constexpr int BucketCount = Octaves * SubBuckets;
+
+    void record(qint64 ns);
+
+    quint64 count() const { return m_count.load(std::memory_order_relaxed); }
+    qint64 sum() const { return m_sum.load(std::memory_order_relaxed); }
+    qint64 max() const { return m_max.load(std::memory_order_relaxed); }
+    qint64 quantile(double q) const;
+
+private:
+    static int bucketFor(qint64 ns);
+    static qint64 bucketUpperBound(int bucket);
+
+    std::array<std::atomic<quint64>, BucketCount> m_buckets {};
+    std::atomic<quint64> m_count { 0 };
+    std::atomic<qint64> m_sum { 0 };
+    std::atomic<qint64> m_max { 0 };
+};
+
+// Trigger latency per pipeline stage and input source, exported in the
+// Prometheus text format on /metrics.
+class LatencyMetrics
+{
+public:
+    enum Stage {
+        Dispatch,   // input received -> command handed to the engine
+        Start,      // handed to the engine -> voice started by the mixer
+        Buffer,     // voice started -> its first frame played out of the sink's buffer
+        Total,      // input received -> first frame played out of the sink's buffer
+        StageCount
+    };
+
+    static LatencyMetrics &instance();
+
+    LatencyHistogram &histogram(Stage stage, InputSource source)
+    {
+        return m_histograms[stage][int(source)];
+    }
+
+    // Records all stages of one trigger from its four timestamps.
+    void recordTrigger(InputSource source, qint64 received, qint64 dispatched, qint64 started, qint64 buffered);
+
+    // Time from application startup until every configured slot was ready.
+    void setStartupDuration(qint64 ns) { m_startup.store(ns, std::memory_order_relaxed); }
+    qint64 startupDuration() const { return m_startup.load(std::memory_order_relaxed); }
+    // Resident set size in bytes, 0 where it cannot be read.
+    static qint64 residentMemory();
+
+    // Appends further series to prometheus(), e.g. per serial port counters.
+    // Runs on the HTTP thread, so it must only read thread-safe state.
+    using Collector = std::function<void(QByteArray *out)>;
+    void addCollector(const void *owner, const Collector &collector);
+    void removeCollector(const void *owner);
+
+    QByteArray prometheus() const;
+
+private:
+    mutable QMutex m_collectorsMutex;
+    QList<QPair<const void *, Collector>> m_collectors;
+    std::array<std::array<LatencyHistogram, InputSourceCount>, StageCount> m_histograms;
+    std::atomic<qint64> m_startup { 0 };
+};
+
+#endif // LATENCYMETRICS_H
@@ -0,0 +1,82 @@
+#include "limiter.h"
+#include "mixkernels.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+Limiter::Limiter(int channels, int lookaheadFrames, float ceiling, int releaseFrames, int maxBlockFrames)
+    : m_channels(qMax(1, channels)),
+    m_lookahead(qMax(1, lookaheadFrames)),
+    m_ceiling(ceiling),
+    m_release(1.0f - std::exp(-1.0f / float(qMax(1, releaseFrames)))),
+    m_delay(size_t(m_lookahead + maxBlockFrames) * size_t(m_channels), 0.0f),
+    m_peaks(size_t(maxBlockFrames)),
+    m_gains(size_t(maxBlockFrames)),
+    m_minValues(size_t(m_lookahead + 1)),
+    m_minIndices(size_t(m_lookahead + 1)),
+    m_box(size_t(m_lookahead), 1.0f),
+    m_boxSum(m_lookahead)
+{
+}
+
+void Limiter::pushTarget(float target)
+{
+    const int capacity = int(m_minValues.size());
+    while(m_minSize > 0 && m_minIndices[size_t(m_minHead)] < m_index - m_lookahead) {
+        m_minHead = (m_minHead + 1) % capacity;
+        --m_minSize;
+    }
+    while(m_minSize > 0 && m_minValues[size_t((m_minHead + m_minSize - 1) % capacity)] >= target)
+        --m_minSize;
+    const size_t back = size_t((m_minHead + m_minSize) % capacity);
+    m_minValues[back] = target;
+    m_minIndices[back] = m_index;
+    ++m_minSize;
+    ++m_index;
+}
+
+void Limiter::process(float *block, qsizetype frames)
+{
+    const size_t lookaheadSamples = size_t(m_lookahead) * size_t(m_channels);
+    const size_t blockSamples = size_t(frames) * size_t(m_channels);
+    float *incoming = m_delay.data() + lookaheadSamples;
+    std::memcpy(incoming, block, blockSamples * sizeof(float));
+    MixKernels::framePeaks(m_peaks.data(), incoming, frames, m_channels);
+    const float blockPeak = *std::max_element(m_peaks.begin(), m_peaks.begin() + frames);
+
+    if(m_idle && blockPeak <= m_ceiling) {
+        std::memcpy(block, m_delay.data(), blockSamples * sizeof(float));
+    } else {
+        if(m_idle) {
+            // Everything before this block asked for a gain of 1.
+            m_idle = false;
+            m_minSize = 0;
+            std::fill(m_box.begin(), m_box.end(), 1.0f);
+            m_boxSum = m_lookahead;
+            m_gain = 1.0f;
+        }
+        for(qsizetype frame = 0; frame < frames; ++frame) {
+            const float peak = m_peaks[size_t(frame)];
+            const float target = peak > m_ceiling ? m_ceiling / peak : 1.0f;
+            m_quietFrames = target < 1.0f ? 0 : m_quietFrames + 1;
+            pushTarget(target);
+
+            const float held = m_minValues[size_t(m_minHead)];
+            m_boxSum += held - m_box[size_t(m_boxPosition)];
+            m_box[size_t(m_boxPosition)] = held;
+            m_boxPosition = (m_boxPosition + 1) % m_lookahead;
+
+            const float smoothed = float(m_boxSum / m_lookahead);
+            m_gain = smoothed < m_gain ? smoothed : m_gain + (smoothed - m_gain) * m_release;
+            m_gains[size_t(frame)] = m_gain;
+        }
+        MixKernels::applyGains(block, m_delay.data(), m_gains.data(), frames, m_channels);
+        if(m_quietFrames > 2 * m_lookahead && m_gain > 0.9999f) {
+            m_idle = true;
+            m_gain = 1.0f;
+        }
+    }
+
+    std::memmove(m_delay.data(), m_delay.data() + blockSamples, lookaheadSamples * sizeof(float));
+}
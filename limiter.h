@@ -0,0 +1,56 @@
+#ifndef LIMITER_H
+#define LIMITER_H
+
+#include <QtGlobal>
+
+#include <vector>
+
+// Lookahead peak limiter for interleaved float blocks. The signal is delayed
+// by lookaheadFrames; the gain is the minimum of the required gains over the
+// lookahead window, smoothed with a moving average of the same length, so it
+// has fully come down when a peak leaves the delay and never overshoots the
+// ceiling. It recovers with an exponential release. Render thread only.
+class Limiter
+{
+public:
+    Limiter(int channels, int lookaheadFrames, float ceiling, int releaseFrames, int maxBlockFrames);
+
+    // In place; frames must not exceed maxBlockFrames.
+    void process(float *block, qsizetype frames);
+
+    int latencyFrames() const { return m_lookahead; }
+    // Gain applied to the last frame, 1 when the limiter is idle.
+    float gain() const { return m_gain; }
+
+private:
+    void pushTarget(float target);
+
+    int m_channels;
+    int m_lookahead;
+    float m_ceiling;
+    float m_release;
+
+    std::vector<float> m_delay;
+    std::vector<float> m_peaks;
+    std::vector<float> m_gains;
+
+    // Sliding minimum over the last lookahead + 1 targets (monotonic deque).
+    std::vector<float> m_minValues;
+    std::vector<qint64> m_minIndices;
+    int m_minHead = 0;
+    int m_minSize = 0;
+    qint64 m_index = 0;
+    // Moving average over the last lookahead minima.
+    std::vector<float> m_box;
+    int m_boxPosition = 0;
+    double m_boxSum = 0.0;
+
+    float m_gain = 1.0f;
+    // Frames since a target below 1; once the window and the average only
+    // hold ones again and the gain is back at 1, blocks under the ceiling
+    // skip the per-frame work.
+    qint64 m_quietFrames = 0;
+    bool m_idle = true;
+};
+
+#endif // LIMITER_H
@@ -0,0 +1,425 @@
+#include "loudnessanalyzer.h"
+
+#include <QAudioBuffer>
+#include <QAudioDecoder>
+#include <QEventLoop>
+#include <QFile>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QMutexLocker>
+#include <QDir>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QSettings>
+#include <QStandardPaths>
+#include <QThread>
+#include <QUrl>
+#include <QDebug>
+
+#include <array>
+#include <cmath>
+#include <memory>
+#include <vector>
+
+namespace {
+
+// Direct form I biquad, run in double as the K-weighting shelf is sensitive
+// to rounding at low frequencies.
+struct Biquad {
+    double b0 = 1.0, b1 = 0.0, b2 = 0.0, a1 = 0.0, a2 = 0.0;
+    double x1 = 0.0, x2 = 0.0, y1 = 0.0, y2 = 0.0;
+
+    double process(double x)
+    {
+        const double y = b0 * x + b1 * x1 + b2 * x2 - a1 * y1 - a2 * y2;
+        x2 = x1;
+        x1 = x;
+        y2 = y1;
+        y1 = y;
+        return y;
+    }
+};
+
+// ITU-R BS.1770-4 K-weighting: high shelf followed by the RLB high-pass,
+// recomputed for the sample rate (the same derivation libebur128 uses).
+void kWeighting(int sampleRate, Biquad *shelf, Biquad *highPass)
+{
+    double f0 = 1681.974450955533;
+    const double gain = 3.999843853973347;
+    double q = 0.7071752369554196;
+    double k = std::tan(M_PI * f0 / sampleRate);
+    const double vh = std::pow(10.0, gain / 20.0);
+    const double vb = std::pow(vh, 0.4996667741545416);
+    double a0 = 1.0 + k / q + k * k;
+    shelf->b0 = (vh + vb * k / q + k * k) / a0;
+    shelf->b1 = 2.0 * (k * k - vh) / a0;
+    shelf->b2 = (vh - vb * k / q + k * k) / a0;
+    shelf->a1 = 2.0 * (k * k - 1.0) / a0;
+    shelf->a2 = (1.0 - k / q + k * k) / a0;
+
+    f0 = 38.13547087602444;
+    q = 0.5003270373238773;
+    k = std::tan(M_PI * f0 / sampleRate);
+    a0 = 1.0 + k / q + k * k;
+    highPass->b0 = 1.0;
+    highPass->b1 = -2.0;
+    highPass->b2 = 1.0;
+    highPass->a1 = 2.0 * (k * k - 1.0) / a0;
+    highPass->a2 = (1.0 - k / q + k * k) / a0;
+}
+
+double toLufs(double meanSquare)
+{
+    return meanSquare > 0.0 ? -0.691 + 10.0 * std::log10(meanSquare) : -HUGE_VAL;
+}
+
+// 4x oversampling for the true peak, windowed-sinc interpolation of the three
+// positions between two input samples.
+constexpr int Oversampling = 4;
+constexpr int Taps = 12;
+
+using Interpolator = std::array<std::array<float, Taps>, Oversampling - 1>;
+
+Interpolator makeInterpolator()
+{
+    Interpolator phases;
+    for(int phase = 1; phase < Oversampling; ++phase) {
+        for(int tap = 0; tap < Taps; ++tap) {
+            // Distance from the interpolated point to input sample 'tap'.
+            const double t = (Taps / 2 - 1) + double(phase) / Oversampling - tap;
+            const double sinc = t == 0.0 ? 1.0 : std::sin(M_PI * t) / (M_PI * t);
+            const double window = 0.5 * (1.0 + std::cos(M_PI * t / (Taps / 2)));
+            phases[phase - 1][tap] = float(sinc * window);
+        }
+    }
+    return phases;
+}
+
+// Gating blocks and true peak, fed a run of frames at a time, so a long track
+// can be measured while it is decoded instead of from memory.
+class Meter
+{
+public:
+    Meter(int channels, int sampleRate);
+
+    void add(const float *pcm, qsizetype frames);
+    LoudnessAnalyzer::Result result() const;
+
+private:
+    int m_channels;
+    std::vector<Biquad> m_shelves;
+    std::vector<Biquad> m_highPasses;
+    std::vector<std::array<float, Taps>> m_history;
+    float m_peak = 0.0f;
+    // Energy per 100 ms step; gating blocks are four consecutive steps (400 ms, 75% overlap).
+    qsizetype m_stepFrames;
+    std::vector<double> m_steps;
+    double m_stepEnergy = 0.0;
+    qsizetype m_stepFill = 0;
+    qsizetype m_frames = 0;
+};
+
+Meter::Meter(int channels, int sampleRate)
+    : m_channels(channels),
+    m_shelves(size_t(channels)),
+    m_highPasses(size_t(channels)),
+    m_history(size_t(channels)),
+    m_stepFrames(qMax<qsizetype>(1, sampleRate / 10))
+{
+    for(int c = 0; c < channels; ++c)
+        kWeighting(sampleRate, &m_shelves[size_t(c)], &m_highPasses[size_t(c)]);
+    for(auto &h : m_history)
+        h.fill(0.0f);
+}
+
+void Meter::add(const float *pcm, qsizetype frames)
+{
+    static const Interpolator interpolator = makeInterpolator();
+    for(qsizetype frame = 0; frame < frames; ++frame) {
+        const float *in = pcm + frame * m_channels;
+        for(int c = 0; c < m_channels; ++c) {
+            const float x = in[c];
+            const double weighted = m_highPasses[size_t(c)].process(m_shelves[size_t(c)].process(x));
+            m_stepEnergy += weighted * weighted;
+
+            std::array<float, Taps> &h = m_history[size_t(c)];
+            std::copy(h.begin() + 1, h.end(), h.begin());
+            h[Taps - 1] = x;
+            m_peak = qMax(m_peak, std::fabs(h[Taps / 2 - 1]));
+            for(const auto &phase : interpolator) {
+                float value = 0.0f;
+                for(int tap = 0; tap < Taps; ++tap)
+                    value += h[size_t(tap)] * phase[size_t(tap)];
+                m_peak = qMax(m_peak, std::fabs(value));
+            }
+        }
+        if(++m_stepFill == m_stepFrames) {
+            m_steps.push_back(m_stepEnergy);
+            m_stepEnergy = 0.0;
+            m_stepFill = 0;
+        }
+    }
+    m_frames += frames;
+}
+
+LoudnessAnalyzer::Result Meter::result() const
+{
+    LoudnessAnalyzer::Result result;
+    if(m_frames <= 0)
+        return result;
+
+    // Samples still in the interpolation history.
+    float peak = m_peak;
+    for(const auto &h : m_history) {
+        for(int tap = Taps / 2; tap < Taps; ++tap)
+            peak = qMax(peak, std::fabs(h[size_t(tap)]));
+    }
+
+    std::vector<double> blocks;
+    if(m_steps.size() < 4) {
+        // Shorter than one gating block: measure the clip as a whole.
+        double total = m_stepEnergy;
+        for(double energy : m_steps)
+            total += energy;
+        blocks.push_back(total / double(m_frames));
+    } else {
+        const double blockFrames = 4.0 * m_stepFrames;
+        for(size_t i = 0; i + 4 <= m_steps.size(); ++i)
+            blocks.push_back((m_steps[i] + m_steps[i + 1] + m_steps[i + 2] + m_steps[i + 3]) / blockFrames);
+    }
+
+    // Absolute gate at -70 LUFS, then relative gate 10 LU below the gated mean.
+    double sum = 0.0;
+    int count = 0;
+    for(double block : blocks) {
+        if(toLufs(block) > -70.0) {
+            sum += block;
+            ++count;
+        }
+    }
+    if(count > 0) {
+        const double relativeGate = toLufs(sum / count) - 10.0;
+        double gatedSum = 0.0;
+        int gatedCount = 0;
+        for(double block : blocks) {
+            const double lufs = toLufs(block);
+            if(lufs > -70.0 && lufs > relativeGate) {
+                gatedSum += block;
+                ++gatedCount;
+            }
+        }
+        result.integrated = toLufs(gatedSum / gatedCount);
+        result.truePeak = peak > 0.0f ? 20.0 * std::log10(double(peak)) : -HUGE_VAL;
+        result.valid = true;
+    }
+    return result;
+}
+
+} // namespace
+
+LoudnessAnalyzer::LoudnessAnalyzer(const QString &cacheFile, QObject *parent)
+    : QObject(parent),
+    m_cacheFile(cacheFile)
+{
+    m_pool.setMaxThreadCount(qMax(1, QThread::idealThreadCount()));
+    QDir().mkpath(QFileInfo(m_cacheFile).absolutePath());
+    readCache();
+}
+
+LoudnessAnalyzer::~LoudnessAnalyzer()
+{
+    m_pool.clear();
+    m_pool.waitForDone();
+}
+
+QString LoudnessAnalyzer::defaultCacheFile()
+{
+    return QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/loudness.json";
+}
+
+void LoudnessAnalyzer::readSettings(QSettings &settings)
+{
+    settings.beginGroup("Loudness");
+    setEnabled(settings.value("normalize", true).toBool());
+    setTarget(settings.value("targetLufs", DefaultTarget).toDouble());
+    settings.endGroup();
+}
+
+// Samples that did not come through the PcmStore have no hash; their results
+// are keyed by path and only kept for this run.
+QString LoudnessAnalyzer::keyFor(const SamplePtr &sample)
+{
+    return sample->hash.isEmpty() ? "path:" + sample->path : QString::fromLatin1(sample->hash);
+}
+
+void LoudnessAnalyzer::analyze(int slot, const SamplePtr &sample)
+{
+    if(!sample)
+        return;
+
+    const QString key = keyFor(sample);
+    {
+        QMutexLocker locker(&m_mutex);
+        const auto it = m_results.constFind(key);
+        if(it != m_results.cend()) {
+            const Result result = *it;
+            locker.unlock();
+            emit analyzed(slot, result);
+            return;
+        }
+        if(m_running.contains(key))
+            return;
+        m_running.insert(key);
+    }
+
+    emit progress(slot, 0);
+    // The destructor waits for the pool, so the task may use this.
+    m_pool.start([this, slot, sample, key]() {
+        const qsizetype frames = sample->pcm.size() / qsizetype(sizeof(float) * sample->format.channelCount());
+        int reported = 0;
+        const auto report = [&](int percent) {
+            if(percent < reported + 10)
+                return;
+            reported = percent;
+            QMetaObject::invokeMethod(this, [this, slot, percent]() {
+                emit progress(slot, percent);
+            }, Qt::QueuedConnection);
+        };
+        // A streamed sample only holds the head of the track; the intro says
+        // little about the rest, so the whole file is decoded once more here.
+        const Result result = sample->streamed
+                ? measureFile(sample->path, sample->format, report)
+                : measure(reinterpret_cast<const float *>(sample->pcm.constData()), frames,
+                          sample->format.channelCount(), sample->format.sampleRate(), report);
+
+        {
+            QMutexLocker locker(&m_mutex);
+            m_running.remove(key);
+            m_results.insert(key, result);
+            if(!sample->hash.isEmpty())
+                writeCache();
+        }
+        qDebug() << "loudness of" << sample->path << result.integrated << "LUFS, true peak" << result.truePeak << "dBTP";
+        QMetaObject::invokeMethod(this, [this, slot, result]() {
+            emit analyzed(slot, result);
+        }, Qt::QueuedConnection);
+    });
+}
+
+LoudnessAnalyzer::Result LoudnessAnalyzer::result(const SamplePtr &sample) const
+{
+    if(!sample)
+        return Result();
+    QMutexLocker locker(&m_mutex);
+    return m_results.value(keyFor(sample));
+}
+
+float LoudnessAnalyzer::normalizationGain(const SamplePtr &sample) const
+{
+    if(!m_enabled)
+        return 1.0f;
+    return normalizationGain(result(sample), m_target);
+}
+
+float LoudnessAnalyzer::normalizationGain(const Result &result, double target)
+{
+    if(!result.valid)
+        return 1.0f;
+    const double gainDb = qMin(target - result.integrated, PeakCeiling - result.truePeak);
+    return float(qBound(0.1, std::pow(10.0, gainDb / 20.0), 4.0));
+}
+
+LoudnessAnalyzer::Result LoudnessAnalyzer::measure(const float *pcm, qsizetype frames, int channels, int sampleRate,
+                                                   const std::function<void(int)> &progress)
+{
+    if(!pcm || frames <= 0 || channels <= 0 || sampleRate <= 0)
+        return Result();
+
+    Meter meter(channels, sampleRate);
+    const qsizetype progressInterval = qMax<qsizetype>(1, frames / 100);
+    for(qsizetype frame = 0; frame < frames; frame += progressInterval) {
+        if(progress)
+            progress(int(frame * 100 / frames));
+        meter.add(pcm + frame * channels, qMin(progressInterval, frames - frame));
+    }
+
+    if(progress)
+        progress(100);
+    return meter.result();
+}
+
+// Same event loop pattern as SampleCache::decode(), but every buffer goes
+// straight into the meter, so memory stays at one decoder buffer however long
+// the track is. The meter runs at the file's own rate; loudness and peak do
+// not need it resampled.
+LoudnessAnalyzer::Result LoudnessAnalyzer::measureFile(const QString &path, const QAudioFormat &format,
+                                                       const std::function<void(int)> &progress)
+{
+    QAudioDecoder decoder;
+    decoder.setAudioFormat(format);
+    decoder.setSource(QUrl::fromLocalFile(path));
+
+    const int channels = format.channelCount();
+    std::unique_ptr<Meter> meter;
+    QByteArray pcm;
+    bool failed = false;
+    QEventLoop loop;
+    QObject::connect(&decoder, &QAudioDecoder::bufferReady, &loop, [&]() {
+        const QAudioBuffer buffer = decoder.read();
+        if(!buffer.isValid())
+            return;
+        if(!meter)
+            meter = std::make_unique<Meter>(channels, buffer.format().sampleRate());
+        pcm.resize(0);
+        SampleCache::appendFloatFrames(pcm, buffer, channels);
+        meter->add(reinterpret_cast<const float *>(pcm.constData()), pcm.size() / qsizetype(sizeof(float) * channels));
+        if(progress && decoder.duration() > 0)
+            progress(int(qBound<qint64>(0, decoder.position() * 100 / decoder.duration(), 99)));
+    });
+    QObject::connect(&decoder, &QAudioDecoder::finished, &loop, &QEventLoop::quit);
+    QObject::connect(&decoder, QOverload<QAudioDecoder::Error>::of(&QAudioDecoder::error), &loop, [&]() {
+        qWarning() << "cannot measure loudness of" << path << decoder.errorString();
+        failed = true;
+        loop.quit();
+    });
+
+    decoder.start();
+    loop.exec();
+
+    if(progress)
+        progress(100);
+    return failed || !meter ? Result() : meter->result();
+}
+
+// {"<sha1>": {"lufs": -14.2, "peak": -0.3}, ...}
+void LoudnessAnalyzer::readCache()
+{
+    QFile file(m_cacheFile);
+    if(!file.open(QIODevice::ReadOnly))
+        return;
+    const QJsonObject root = QJsonDocument::fromJson(file.readAll()).object();
+    for(auto it = root.constBegin(); it != root.constEnd(); ++it) {
+        const QJsonObject object = it.value().toObject();
+        Result result;
+        result.integrated = object.value("lufs").toDouble();
+        result.truePeak = object.value("peak").toDouble();
+        result.valid = true;
+        m_results.insert(it.key(), result);
+    }
+}
+
+// Called with m_mutex held. Only results keyed by a content hash are kept.
+void LoudnessAnalyzer::writeCache() const
+{
+    QJsonObject root;
+    for(auto it = m_results.cbegin(); it != m_results.cend(); ++it) {
+        if(it->valid && !it.key().startsWith("path:"))
+            root.insert(it.key(), QJsonObject { { "lufs", it->integrated }, { "peak", it->truePeak } });
+    }
+    QSaveFile file(m_cacheFile);
+    if(!file.open(QIODevice::WriteOnly)
+        || file.write(QJsonDocument(root).toJson(QJsonDocument::Compact)) < 0
+        || !file.commit()) {
+        qDebug() << "failed to write loudness cache" << m_cacheFile << file.errorString();
+    }
+}
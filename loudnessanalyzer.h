@@ -0,0 +1,81 @@
+#ifndef LOUDNESSANALYZER_H
+#define LOUDNESSANALYZER_H
+
+#include <QObject>
+#include <QHash>
+#include <QSet>
+#include <QMutex>
+#include <QString>
+#include <QThreadPool>
+
+#include <functional>
+
+#include "samplecache.h"
+
+class QSettings;
+
+// Measures EBU R128 integrated loudness and true peak of every loaded sample
+// on a background pool and turns them into a per-slot normalisation gain. The
+// gain is folded into the slot's armed gain, so triggers pay nothing for it.
+// Results are cached on disk by content hash.
+class LoudnessAnalyzer : public QObject
+{
+    Q_OBJECT
+
+public:
+    struct Result {
+        double integrated = 0.0;    // LUFS
+        double truePeak = 0.0;      // dBTP
+        bool valid = false;
+    };
+
+    static constexpr double DefaultTarget = -16.0;
+    static constexpr double PeakCeiling = -1.0;
+
+    explicit LoudnessAnalyzer(const QString &cacheFile = defaultCacheFile(), QObject *parent = nullptr);
+    ~LoudnessAnalyzer();
+
+    static QString defaultCacheFile();
+
+    // Loudness/normalize and Loudness/targetLufs.
+    void readSettings(QSettings &settings);
+
+    void setEnabled(bool enabled) { m_enabled = enabled; }
+    bool isEnabled() const { return m_enabled; }
+    void setTarget(double lufs) { m_target = lufs; }
+    double target() const { return m_target; }
+
+    // Reports a cached result right away, otherwise analyses on the pool.
+    void analyze(int slot, const SamplePtr &sample);
+    Result result(const SamplePtr &sample) const;
+    // Gain that brings the sample to the target without pushing the true peak
+    // above PeakCeiling; 1 while unknown or when disabled.
+    float normalizationGain(const SamplePtr &sample) const;
+
+    static float normalizationGain(const Result &result, double target);
+    static Result measure(const float *pcm, qsizetype frames, int channels, int sampleRate,
+                          const std::function<void(int percent)> &progress = {});
+    // Decodes the file on the calling thread and measures all of it, for
+    // streamed samples whose pcm is only the head.
+    static Result measureFile(const QString &path, const QAudioFormat &format,
+                              const std::function<void(int percent)> &progress = {});
+
+signals:
+    void progress(int slot, int percent);
+    void analyzed(int slot, const LoudnessAnalyzer::Result &result);
+
+private:
+    static QString keyFor(const SamplePtr &sample);
+    void readCache();
+    void writeCache() const;
+
+    QString m_cacheFile;
+    bool m_enabled = true;
+    double m_target = DefaultTarget;
+    QThreadPool m_pool;
+    mutable QMutex m_mutex;
+    QHash<QString, Result> m_results;
+    QSet<QString> m_running;
+};
+
+#endif // LOUDNESSANALYZER_H
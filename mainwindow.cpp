@@ -1,316 +1,327 @@
 #include "mainwindow.h"
 #include "ui_mainwindow.h"
 #include "serialsettingsdialog.h"
+#include "bankfile.h"
+#include "eventjournal.h"
+#include "loudnessanalyzer.h"
+#include "samplecache.h"
 
 #include <QSerialPortInfo>
+#include <QAudioDevice>
 #include <QFileDialog>
 #include <QDir>
+#include <QPointer>
 #include <QSettings>
+#include <QSignalBlocker>
+#include <QLabel>
+#include <QLineEdit>
+#include <QPushButton>
+#include <QThreadPool>
+#include <QTimer>
 #include <QDebug>
 
+#include <cmath>
+
 MainWindow::MainWindow(QWidget *parent)
     : QMainWindow(parent),
     ui(new Ui::MainWindow),
-    m_serialSettingsDialog(new SerialSettingsDialog),
-    m_mediaPlayer(new QMediaPlayer(this)),
-    m_audioOutput(new QAudioOutput),
-    m_serial(new QSerialPort(this)),
-    m_apiServer(new QHttpServer(this))
+    m_serialSettingsDialog(new SerialSettingsDialog)
 {
     ui->setupUi(this);
 
-
-    m_mediaPlayer->setAudioOutput(m_audioOutput);
-
-    m_apiServer->route("/", []() {
-        qDebug() << "Return index.html";
-        return QHttpServerResponse::fromFile(":/assets/index.html");
+    QSettings settings("SV48Reichwalde", "Nippelboard");
+    EventJournal::instance().readSettings(settings);
+    const AudioEngine::Config audioConfig = AudioEngine::readConfig(settings);
+
+    m_core = new Core(audioConfig, SerialBoards::readSettings(settings), 11948, this);
+    m_core->loudness()->readSettings(settings);
+
+    connect(m_core->audioEngine(), &AudioEngine::masterGainChanged, this, &MainWindow::volumeChanged);
+    connect(m_core->audioEngine(), &AudioEngine::playingSlotsChanged, this, &MainWindow::playingSlotsChanged);
+    connect(m_core->sampleCache(), &SampleCache::sampleReady, this, &MainWindow::sampleReady);
+    connect(m_core, &Core::ready, this, [this](qint64 elapsedMs) {
+        ui->statusbar->showMessage(QString("Ready in %1 ms (%2 from store, %3 decoded)").arg(elapsedMs)
+                                   .arg(m_core->sampleCache()->storeLoads()).arg(m_core->sampleCache()->decodes()), 5000);
     });
-
-    m_apiServer->route("/play/", QHttpServerRequest::Method::Get, [&](int position) {
-        playSong(position);
-        return QHttpServerResponse(QHttpServerResponse::StatusCode::Accepted);
+    connect(m_core->loudness(), &LoudnessAnalyzer::progress, this, [this](int slot, int percent) {
+        if(slot < m_rows.size())
+            m_rows[slot].loudness->setText(QString("analysing %1%").arg(percent));
     });
+    connect(m_core->loudness(), &LoudnessAnalyzer::analyzed, this, &MainWindow::showLoudness);
+    connect(ui->actionSettings, &QAction::triggered, m_serialSettingsDialog, &SerialSettingsDialog::show);
+    connect(ui->actionImportBank, &QAction::triggered, this, &MainWindow::importBank);
+    connect(ui->actionExportBank, &QAction::triggered, this, &MainWindow::exportBank);
 
-    m_apiServer->route("/volume", QHttpServerRequest::Method::Get, [&]() {
-        return QHttpServerResponse(QString::number(ui->dial->value()), QHttpServerResponse::StatusCode::Ok);
+    connect(m_core->boards(), &SerialBoards::opened, this, [this](int board, const QString &portName, qint32 baudRate) {
+        ui->statusbar->showMessage(QString("Arduino %1 %2[%3] connected").arg(board + 1).arg(portName).arg(baudRate));
     });
-
-    m_apiServer->route("/volume/", QHttpServerRequest::Method::Get, [&](int volume) {
-        setVolume(volume);
-        return QHttpServerResponse(QHttpServerResponse::StatusCode::Accepted);
+    connect(m_core->boards(), &SerialBoards::openFailed, this, [this](int board, const QString &portName, const QString &errorString) {
+        ui->statusbar->showMessage(QString("failed to connect arduino %1 %2: %3").arg(board + 1).arg(portName, errorString));
+    });
+    connect(m_core->boards(), &SerialBoards::errorOccurred, this, &MainWindow::handleSerialError);
+    connect(m_core->boards(), &SerialBoards::recovered, this, [this](int board, const QString &portName, qint64 recoveryNs) {
+        ui->statusbar->showMessage(QString("Arduino %1 %2 back after %3 ms").arg(board + 1).arg(portName).arg(recoveryNs / 1000000), 5000);
     });
 
-    const auto port = m_apiServer->listen(QHostAddress::Any, 11948);
-    if (!port) {
-        qDebug() << "Server failed to listen on a port." << 11948;
-    }
-
-    connect(m_audioOutput, &QAudioOutput::volumeChanged, this, &MainWindow::volumeChanged);
-    connect(ui->actionSettings, &QAction::triggered, m_serialSettingsDialog, &SerialSettingsDialog::show);
-
-    connect(m_serial, &QSerialPort::readyRead, this, &MainWindow::readData);
-
-    connect(ui->pushButtonPlay1, &QAbstractButton::clicked, this, &MainWindow::pushButtonPlay1Pressed);
-    connect(ui->pushButtonPlay2, &QAbstractButton::clicked, this, &MainWindow::pushButtonPlay2Pressed);
-    connect(ui->pushButtonPlay3, &QAbstractButton::clicked, this, &MainWindow::pushButtonPlay3Pressed);
-    connect(ui->pushButtonPlay4, &QAbstractButton::clicked, this, &MainWindow::pushButtonPlay4Pressed);
-    connect(ui->pushButtonPlay5, &QAbstractButton::clicked, this, &MainWindow::pushButtonPlay5Pressed);
-
-    connect(ui->pushButtonSelect1, &QAbstractButton::clicked, this, &MainWindow::pushButtonSelect1Pressed);
-    connect(ui->pushButtonSelect2, &QAbstractButton::clicked, this, &MainWindow::pushButtonSelect2Pressed);
-    connect(ui->pushButtonSelect3, &QAbstractButton::clicked, this, &MainWindow::pushButtonSelect3Pressed);
-    connect(ui->pushButtonSelect4, &QAbstractButton::clicked, this, &MainWindow::pushButtonSelect4Pressed);
-    connect(ui->pushButtonSelect5, &QAbstractButton::clicked, this, &MainWindow::pushButtonSelect5Pressed);
+    m_outputLabel = new QLabel(this);
+    ui->statusbar->addPermanentWidget(m_outputLabel);
+    QTimer *outputTimer = new QTimer(this);
+    connect(outputTimer, &QTimer::timeout, this, &MainWindow::showOutputStats);
+    outputTimer->start(1000);
 
     connect(ui->dial, &QAbstractSlider::valueChanged, this, &MainWindow::volumeDialValueChanged);
 
-    m_audioOutput->setVolume(1.0);
+    m_core->audioEngine()->setMasterGain(1.0f);
     ui->dial->setValue(100);
 
     readSettings();
-
-    SerialSettingsDialog::Settings serialSettings = m_serialSettingsDialog->settings();
-    qDebug() << "loaded serial settings port: " << serialSettings.name << " baud rate: " << serialSettings.baudRate;
-
-    m_serial->setBaudRate(serialSettings.baudRate);
-    m_serial->setPortName(serialSettings.name);
-
-    if(m_serial->open(QIODevice::ReadWrite)){
-        ui->statusbar->showMessage(QString("Arduino %1[%2] connected").arg(serialSettings.name).arg(serialSettings.baudRate));
-    } else {
-        ui->statusbar->showMessage(QString("failed to connect arduino %1[%2]").arg(serialSettings.name).arg(serialSettings.baudRate));
-    }
-
+    m_core->startBoards();
 }
 
 MainWindow::~MainWindow()
 {
+    delete m_core;
+    EventJournal::instance().stop();
     delete ui;
 }
 
 void MainWindow::writeSettings() {
-    QSettings settings("SV48Reichwalde", "Nippelboard");
-    settings.beginGroup("Buttons");
-    settings.setValue("button0", ui->lineEdit_1->text());
-    settings.setValue("button1", ui->lineEdit_2->text());
-    settings.setValue("button2", ui->lineEdit_3->text());
-    settings.setValue("button3", ui->lineEdit_4->text());
-    settings.setValue("button4", ui->lineEdit_5->text());
-    settings.endGroup();
+    m_bankFile->scheduleSave(bankContents());
 }
 
 void MainWindow::readSettings() {
     QSettings settings("SV48Reichwalde", "Nippelboard");
-    settings.beginGroup("Buttons");
-    ui->lineEdit_1->setText(settings.value("button0", QString()).toString());
-    ui->lineEdit_2->setText(settings.value("button1", QString()).toString());
-    ui->lineEdit_3->setText(settings.value("button2", QString()).toString());
-    ui->lineEdit_4->setText(settings.value("button3", QString()).toString());
-    ui->lineEdit_5->setText(settings.value("button4", QString()).toString());
-    settings.endGroup();
-}
+    m_bankFile = new BankFile(settings.value("Bank/file", BankFile::defaultPath()).toString(), this);
 
-void MainWindow::readData() {
-
-    const QByteArray data = m_serial->readAll();
-    QString dataString = QString(data);
-    qDebug() << "Received: " << dataString;
-    auto requests = dataString.split("\r\n");
-
-    for(const QString &requestString : std::as_const(requests)) {
-        QStringList parts = requestString.split(";");
-        if(parts.size() == 2) {
-            int songId = parts.at(0).toInt();
-            int volume = map(parts.at(1).toInt(), 0, 255, 0, 100);
-            switch(songId) {
-            case 0:
-                setVolume(volume);
-                break;
-            case 1:
-                playSong(0);
-                setVolume(volume);
-                break;
-            case 2:
-                playSong(1);
-                setVolume(volume);
-                break;
-            case 4:
-                playSong(2);
-                setVolume(volume);
-                break;
-            case 8:
-                playSong(3);
-                setVolume(volume);
-                break;
-            case 16:
-                playSong(4);
-                setVolume(volume);
-                break;
-            }
-        }
-    }
+    BankFile::Contents contents;
+    if(!m_core->readBank(m_bankFile->path(), settings, &contents))
+        writeSettings();
 
-}
-
-void MainWindow::handleSerialError(QSerialPort::SerialPortError error) {
+    m_core->sampleCache()->readSettings(settings);
 
+    buildSlotRows();
+    m_core->loadBank();
 }
 
-void MainWindow::volumeChanged(float value)
-{
-    ui->dial->setValue(value * 100);
+BankFile::Contents MainWindow::bankContents() const {
+    const SerialSettingsDialog::Settings serialSettings = m_serialSettingsDialog->settings();
+    BankFile::Contents contents;
+    contents.entries = m_core->bank().allSlots();
+    contents.serial.port = serialSettings.name;
+    contents.serial.baudRate = serialSettings.baudRate;
+    return contents;
 }
 
-void MainWindow::setVolume(int volume) {
-    if(volume < 0) volume = 0;
-    if(volume > 100) volume = 100;
-    m_audioOutput->setVolume(volume / 100.0);
-}
+void MainWindow::importBank() {
+    const QString path = QFileDialog::getOpenFileName(this, tr("Import bank"), QDir::homePath(), tr("Nippelboard bank (*.json)"));
+    if(path.isEmpty())
+        return;
 
-void MainWindow::playSong(int pos) {
-    switch(pos) {
-    case 0:
-        if(!ui->lineEdit_1->text().isEmpty()){
-            m_mediaPlayer->setSource(QUrl::fromLocalFile(ui->lineEdit_1->text()));
-            m_mediaPlayer->play();
-
-            ui->pushButtonPlay1->setChecked(true);
-            ui->pushButtonPlay2->setChecked(false);
-            ui->pushButtonPlay3->setChecked(false);
-            ui->pushButtonPlay4->setChecked(false);
-            ui->pushButtonPlay5->setChecked(false);
-        }
-        break;
-    case 1:
-        if(!ui->lineEdit_2->text().isEmpty()){
-            m_mediaPlayer->setSource(QUrl::fromLocalFile(ui->lineEdit_2->text()));
-            m_mediaPlayer->play();
-
-            ui->pushButtonPlay1->setChecked(false);
-            ui->pushButtonPlay2->setChecked(true);
-            ui->pushButtonPlay3->setChecked(false);
-            ui->pushButtonPlay4->setChecked(false);
-            ui->pushButtonPlay5->setChecked(false);
-        }
-        break;
-    case 2:
-        if(!ui->lineEdit_3->text().isEmpty()){
-            m_mediaPlayer->setSource(QUrl::fromLocalFile(ui->lineEdit_3->text()));
-            m_mediaPlayer->play();
-
-            ui->pushButtonPlay1->setChecked(false);
-            ui->pushButtonPlay2->setChecked(false);
-            ui->pushButtonPlay3->setChecked(true);
-            ui->pushButtonPlay4->setChecked(false);
-            ui->pushButtonPlay5->setChecked(false);
-        }
-        break;
-    case 3:
-        if(!ui->lineEdit_4->text().isEmpty()){
-            m_mediaPlayer->setSource(QUrl::fromLocalFile(ui->lineEdit_4->text()));
-            m_mediaPlayer->play();
-
-            ui->pushButtonPlay1->setChecked(false);
-            ui->pushButtonPlay2->setChecked(false);
-            ui->pushButtonPlay3->setChecked(false);
-            ui->pushButtonPlay4->setChecked(true);
-            ui->pushButtonPlay5->setChecked(false);
-        }
-        break;
-    case 4:
-        if(!ui->lineEdit_5->text().isEmpty()){
-            m_mediaPlayer->setSource(QUrl::fromLocalFile(ui->lineEdit_5->text()));
-            m_mediaPlayer->play();
-
-            ui->pushButtonPlay1->setChecked(false);
-            ui->pushButtonPlay2->setChecked(false);
-            ui->pushButtonPlay3->setChecked(false);
-            ui->pushButtonPlay4->setChecked(false);
-            ui->pushButtonPlay5->setChecked(true);
-        }
-        break;
+    BankFile::Contents contents;
+    QString errorString;
+    if(!BankFile::read(path, &contents, &errorString)) {
+        ui->statusbar->showMessage(QString("Cannot import %1: %2").arg(path, errorString), 5000);
+        return;
     }
-}
 
-void MainWindow::openSerialSettings() {
+    m_core->replaceBank(contents.entries);
+    buildSlotRows();
+
+    if(!contents.serial.port.isEmpty()) {
+        QSettings settings("SV48Reichwalde", "Nippelboard");
+        settings.beginGroup("serial");
+        settings.setValue("port", contents.serial.port);
+        if(contents.serial.baudRate > 0)
+            settings.setValue("baudrate", contents.serial.baudRate);
+        settings.endGroup();
+        // The bank only knows one port, it replaces the first board.
+        SerialBoards::Board first = m_core->boardConfigs().first();
+        first.port = contents.serial.port;
+        if(contents.serial.baudRate > 0)
+            first.baudRate = contents.serial.baudRate;
+        m_core->restartBoard(0, first);
+    }
 
+    writeSettings();
+    ui->statusbar->showMessage(QString("Imported %1 slots from %2").arg(m_core->bank().slotCount()).arg(path), 5000);
 }
 
-void MainWindow::volumeDialValueChanged(int value)
-{
-    setVolume(value);
+void MainWindow::exportBank() {
+    const QString path = QFileDialog::getSaveFileName(this, tr("Export bank"), QDir::homePath(), tr("Nippelboard bank (*.json)"));
+    if(path.isEmpty())
+        return;
+
+    const BankFile::Contents contents = bankContents();
+    QPointer<MainWindow> self(this);
+    QThreadPool::globalInstance()->start([self, path, contents]() {
+        QString errorString;
+        const bool ok = BankFile::write(path, contents, &errorString);
+        if(!self)
+            return;
+        QMetaObject::invokeMethod(self, [self, path, ok, errorString]() {
+            self->ui->statusbar->showMessage(ok ? QString("Exported bank to %1").arg(path)
+                                                : QString("Cannot export %1: %2").arg(path, errorString), 5000);
+        }, Qt::QueuedConnection);
+    });
 }
 
+void MainWindow::buildSlotRows() {
+    for(const SlotRow &row : std::as_const(m_rows)) {
+        delete row.select;
+        delete row.path;
+        delete row.play;
+        delete row.loudness;
+    }
+    ui->bankLayout->setRowStretch(m_rows.size(), 0);
+    m_rows.clear();
+
+    const QList<SoundBank::Slot> table = m_core->bank().allSlots();
+    for(int slot = 0; slot < table.size(); ++slot) {
+        SlotRow row;
+        row.select = new QPushButton(table[slot].label, ui->bankWidget);
+        row.path = new QLineEdit(table[slot].path, ui->bankWidget);
+        row.path->setReadOnly(true);
+        row.play = new QPushButton(QString("Play %1").arg(slot + 1), ui->bankWidget);
+        row.play->setCheckable(true);
+        row.loudness = new QLabel(ui->bankWidget);
+
+        ui->bankLayout->addWidget(row.select, slot, 0);
+        ui->bankLayout->addWidget(row.path, slot, 1);
+        ui->bankLayout->addWidget(row.play, slot, 2);
+        ui->bankLayout->addWidget(row.loudness, slot, 3);
+
+        connect(row.select, &QAbstractButton::clicked, this, [this, slot]() {
+            selectFile(slot);
+        });
+        connect(row.play, &QAbstractButton::clicked, this, [this, slot]() {
+            playPressed(slot);
+        });
+        m_rows.append(row);
+    }
+    ui->bankLayout->setRowStretch(table.size(), 1);
+}
 
-void MainWindow::pushButtonSelect1Pressed()
+void MainWindow::handleSerialError(int board, QSerialPort::SerialPortError error, const QString &errorString)
 {
-    ui->lineEdit_1->setText(
-            QFileDialog::getOpenFileName(this, tr("Choose MP3 file for button"), QDir::homePath(), tr("MP3 (*.mp3)"))
-        );
-    writeSettings();
+    // Only a vanished port changes the connection.
+    if(error != QSerialPort::ResourceError)
+        return;
+    const QList<SerialBoards::Board> &boards = m_core->boardConfigs();
+    const bool reconnect = board < boards.size() && boards.at(board).reconnect;
+    ui->statusbar->showMessage(QString("Arduino %1 disconnected (%2)%3").arg(board + 1).arg(errorString,
+                                                                             reconnect ? ", reconnecting" : ""));
 }
 
-void MainWindow::pushButtonSelect2Pressed()
+void MainWindow::volumeChanged(float value, InputSource source)
 {
-    ui->lineEdit_2->setText(
-        QFileDialog::getOpenFileName(this, tr("Choose MP3 file for button"), QDir::homePath(), tr("MP3 (*.mp3)"))
-        );
-    writeSettings();
+    // The dial already shows its own value; for other sources it is moved
+    // without emitting valueChanged, so the change does not come back around.
+    if(source != InputSource::Gui) {
+        const QSignalBlocker blocker(ui->dial);
+        ui->dial->setValue(qRound(value * 100));
+    }
 }
 
-void MainWindow::pushButtonSelect3Pressed()
-{
-    ui->lineEdit_3->setText(
-        QFileDialog::getOpenFileName(this, tr("Choose MP3 file for button"), QDir::homePath(), tr("MP3 (*.mp3)"))
-        );
-    writeSettings();
+void MainWindow::setVolume(int volume) {
+    if(volume < 0) volume = 0;
+    if(volume > 100) volume = 100;
+    EventJournal::instance().recordVolume(InputSource::Gui, volume, InputEvent::now());
+    m_core->audioEngine()->setMasterGain(volume / 100.0f);
 }
 
-void MainWindow::pushButtonSelect4Pressed()
-{
-    ui->lineEdit_4->setText(
-        QFileDialog::getOpenFileName(this, tr("Choose MP3 file for button"), QDir::homePath(), tr("MP3 (*.mp3)"))
-        );
-    writeSettings();
+void MainWindow::playSong(int pos) {
+    const qint64 received = InputEvent::now();
+    const bool started = m_core->play(pos, InputSource::Gui, received);
+    const SampleCache::SlotStats stats = m_core->sampleCache()->stats(pos);
+    qDebug() << "play slot" << pos << (started ? "from cache" : "not ready")
+             << "hits:" << stats.hits << "misses:" << stats.misses;
+
+    if(!started && !m_core->sampleCache()->path(pos).isEmpty())
+        ui->statusbar->showMessage(QString("Button %1 is still loading").arg(pos + 1), 2000);
 }
 
-void MainWindow::pushButtonSelect5Pressed()
-{
-    ui->lineEdit_5->setText(
-        QFileDialog::getOpenFileName(this, tr("Choose MP3 file for button"), QDir::homePath(), tr("MP3 (*.mp3)"))
-        );
-    writeSettings();
+void MainWindow::loadSlot(int slot, const QString &path) {
+    m_core->loadSlot(slot, path);
+    m_rows[slot].path->setText(path);
+    m_rows[slot].loudness->clear();
 }
 
+void MainWindow::showLoudness(int slot) {
+    if(slot >= m_rows.size())
+        return;
+    const SamplePtr sample = m_core->sampleCache()->sample(slot);
+    const LoudnessAnalyzer::Result result = m_core->loudness()->result(sample);
+    if(!result.valid) {
+        m_rows[slot].loudness->setText(sample ? "silent" : QString());
+        return;
+    }
+    const double gainDb = 20.0 * std::log10(double(m_core->loudness()->normalizationGain(sample)));
+    m_rows[slot].loudness->setText(QString("%1 LUFS / %2 dBTP, %3 dB")
+                                   .arg(result.integrated, 0, 'f', 1)
+                                   .arg(result.truePeak, 0, 'f', 1)
+                                   .arg(gainDb, 0, 'f', 1));
+}
 
+void MainWindow::sampleReady(int slot, const QString &path) {
+    qDebug() << "sample ready" << slot << path;
+    const SamplePtr sample = m_core->sampleCache()->sample(slot);
+    if(sample && !sample->hash.isEmpty() && m_core->bank().setHash(slot, sample->hash))
+        writeSettings();
+}
 
-void MainWindow::pushButtonPlay1Pressed()
-{
-    playSong(0);
+void MainWindow::playingSlotsChanged(quint64 playing) {
+    for(int slot = 0; slot < m_rows.size(); ++slot)
+        m_rows[slot].play->setChecked(playing & (quint64(1) << slot));
 }
 
-void MainWindow::pushButtonPlay2Pressed()
+void MainWindow::showOutputStats()
 {
-    playSong(1);
+    const AudioEngine *engine = m_core->audioEngine();
+    QStringList texts;
+    QStringList tips;
+    for(int output = 0; output < engine->outputCount(); ++output) {
+        const AudioEngine::OutputStats stats = engine->outputStats(output);
+        const QString prefix = engine->outputCount() > 1 ? stats.name + ": " : QString();
+        const double depthMs = stats.sampleRate > 0 ? stats.depthFrames * 1000.0 / stats.sampleRate : 0.0;
+        texts.append(prefix + QString("Buffer %1%2 frames, %3 ms, depth %4 frames (%5 ms), %6 underruns")
+                                  .arg(stats.adaptive ? "~" : "")
+                                  .arg(stats.bufferFrames)
+                                  .arg(stats.latencyMs(), 0, 'f', 1)
+                                  .arg(stats.depthFrames)
+                                  .arg(depthMs, 0, 'f', 1)
+                                  .arg(stats.underruns));
+        tips.append(prefix + QString("Depth: frames queued when the output last asked for more"));
+    }
+    m_outputLabel->setText(texts.join(" | "));
+    m_outputLabel->setToolTip(tips.join('\n'));
 }
 
-void MainWindow::pushButtonPlay3Pressed()
+void MainWindow::openSerialSettings() {
+
+}
+
+void MainWindow::volumeDialValueChanged(int value)
 {
-    playSong(2);
+    setVolume(value);
 }
 
-void MainWindow::pushButtonPlay4Pressed()
+
+void MainWindow::selectFile(int slot)
 {
-    playSong(3);
+    const QString path = QFileDialog::getOpenFileName(this, tr("Choose MP3 file for button"), QDir::homePath(), tr("MP3 (*.mp3)"));
+    loadSlot(slot, path);
+    writeSettings();
 }
 
-void MainWindow::pushButtonPlay5Pressed()
+void MainWindow::playPressed(int slot)
 {
-    playSong(4);
+    EventJournal::instance().recordPlay(InputSource::Gui, slot, InputEvent::now());
+    playSong(slot);
+    playingSlotsChanged(m_core->audioEngine()->playingSlots());
 }
 
 void MainWindow::closeEvent(QCloseEvent *event) {
     qDebug() << "CloseEvent";
     writeSettings();
+    m_bankFile->flush();
 }
@@ -2,19 +2,20 @@
 #define MAINWINDOW_H
 
 #include <QMainWindow>
-#include <QMediaPlayer>
-#include <QAudioOutput>
 #include <QSerialPort>
-#include <QHttpServer>
+
+#include "core.h"
 
 QT_BEGIN_NAMESPACE
 namespace Ui {
 class MainWindow;
 }
+class QLabel;
+class QLineEdit;
+class QPushButton;
 QT_END_NAMESPACE
 
 class SerialSettingsDialog;
-class ReceiverThread;
 
 class MainWindow : public QMainWindow
 {
@@ -25,34 +26,39 @@ public:
     ~MainWindow();
 
 private slots:
-    void readData();
-    void handleSerialError(QSerialPort::SerialPortError error);
+    void handleSerialError(int board, QSerialPort::SerialPortError error, const QString &errorString);
 
-    void volumeChanged(float value);
+    void volumeChanged(float value, InputSource source);
     void volumeDialValueChanged(int value);
-
-    void pushButtonSelect1Pressed();
-    void pushButtonSelect2Pressed();
-    void pushButtonSelect3Pressed();
-    void pushButtonSelect4Pressed();
-    void pushButtonSelect5Pressed();
-
-    void pushButtonPlay1Pressed();
-    void pushButtonPlay2Pressed();
-    void pushButtonPlay3Pressed();
-    void pushButtonPlay4Pressed();
-    void pushButtonPlay5Pressed();
+    void playingSlotsChanged(quint64 playing);
+    void sampleReady(int slot, const QString &path);
+    void playSong(int pos);
+    void showOutputStats();
+    void selectFile(int slot);
+    void playPressed(int slot);
+    void importBank();
+    void exportBank();
 
 private:
+    struct SlotRow {
+        QPushButton *select;
+        QLineEdit *path;
+        QPushButton *play;
+        QLabel *loudness;
+    };
+
     Ui::MainWindow *ui;
-    QMediaPlayer *m_mediaPlayer;
-    QAudioOutput *m_audioOutput;
     SerialSettingsDialog *m_serialSettingsDialog;
-    QSerialPort *m_serial = nullptr;
-    QHttpServer *m_apiServer = nullptr;
-    void playSong(int pos);
+    Core *m_core = nullptr;
+    BankFile *m_bankFile = nullptr;
+    QList<SlotRow> m_rows;
+    QLabel *m_outputLabel = nullptr;
+    void buildSlotRows();
+    void loadSlot(int slot, const QString &path);
+    void showLoudness(int slot);
     void readSettings();
     void writeSettings();
+    BankFile::Contents bankContents() const;
     void openSerialSettings();
     void setVolume(int volume);
     void closeEvent(QCloseEvent *event);
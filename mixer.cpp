@@ -0,0 +1,571 @@
+#include "mixer.h"
+#include "latencymetrics.h"
+#include "mixkernels.h"
+
+#include <QtAlgorithms>
+#include <QDebug>
+
+#include <algorithm>
+#include <cmath>
+
+Mixer::Mixer(const QAudioFormat &mixFormat, QAudioFormat::SampleFormat outputFormat,
+             int voices, int periodFrames, const QVector<SpscQueue<InputEvent> *> &inputQueues,
+             QObject *parent)
+    : QIODevice(parent),
+    m_mixFormat(mixFormat),
+    m_outputFormat(outputFormat),
+    m_channels(mixFormat.channelCount()),
+    m_periodFrames(qMax(16, periodFrames)),
+    m_voices(qMax(1, voices)),
+    m_releasing(m_voices.size()),
+    m_scratch(size_t(m_periodFrames) * m_channels),
+    m_inputQueues(inputQueues)
+{
+    m_armedGain.fill(1.0f);
+    setDsp(DspConfig());
+}
+
+void Mixer::setDsp(const DspConfig &dsp)
+{
+    const float framesPerMs = m_mixFormat.sampleRate() / 1000.0f;
+    auto stepFor = [framesPerMs](float ms, float range) {
+        return ms > 0.0f ? range / (ms * framesPerMs) : 0.0f;
+    };
+    m_fadeInStep = stepFor(dsp.fadeInMs, 1.0f);
+    m_fadeOutStep = stepFor(dsp.fadeOutMs, 1.0f);
+
+    m_duckGain = std::pow(10.0f, qMin(0.0f, dsp.duckDb) / 20.0f);
+    m_duckHoldFrames = qint64(dsp.duckHoldMs * framesPerMs);
+    // The duck itself comes in quickly but not as a step.
+    m_duckAttackStep = stepFor(10.0f, 1.0f - m_duckGain);
+    m_duckReleaseStep = dsp.duckReleaseMs > 0 ? stepFor(dsp.duckReleaseMs, 1.0f - m_duckGain) : 1.0f;
+
+    m_limiter.reset();
+    if(dsp.limiter) {
+        m_limiter = std::make_unique<Limiter>(m_channels, qMax(1, int(dsp.limiterLookaheadMs * framesPerMs)),
+                                              std::pow(10.0f, qMin(0.0f, dsp.limiterCeilingDb) / 20.0f),
+                                              qMax(1, int(dsp.limiterReleaseMs * framesPerMs)), m_periodFrames);
+    }
+    m_dspLatencyFrames.store(m_limiter ? m_limiter->latencyFrames() : 0, std::memory_order_relaxed);
+}
+
+void Mixer::setStreaming(int count, qint64 bufferFrames)
+{
+    m_streams.clear();
+    for(int i = 0; i < count; ++i)
+        m_streams.push_back(std::make_unique<PcmStream>(m_mixFormat, bufferFrames));
+    m_streamBusy.assign(m_streams.size(), false);
+    m_streamScratch.resize(size_t(m_periodFrames) * m_channels);
+}
+
+void Mixer::arm(int slot, const SamplePtr &sample, float gain)
+{
+    if(slot < 0 || slot >= MaxSlots)
+        return;
+    Command command;
+    command.type = Command::Arm;
+    command.slot = slot;
+    command.gain = gain;
+    command.sample = sample;
+    post(std::move(command));
+}
+
+void Mixer::trigger(int slot, float gain, InputSource source, qint64 received)
+{
+    Command command;
+    command.type = Command::Trigger;
+    command.slot = slot;
+    command.gain = gain;
+    command.source = source;
+    command.received = received;
+    post(std::move(command));
+}
+
+void Mixer::play(int slot, const SamplePtr &sample, float gain, InputSource source, qint64 received)
+{
+    if(!sample)
+        return;
+    Command command;
+    command.type = Command::Play;
+    command.slot = slot;
+    command.gain = gain;
+    command.sample = sample;
+    command.source = source;
+    command.received = received;
+    post(std::move(command));
+}
+
+void Mixer::stop(int slot)
+{
+    Command command;
+    command.type = Command::Stop;
+    command.slot = slot;
+    post(std::move(command));
+}
+
+void Mixer::stopAll()
+{
+    Command command;
+    command.type = Command::StopAll;
+    post(std::move(command));
+}
+
+void Mixer::seek(int slot, qint64 frame)
+{
+    Command command;
+    command.type = Command::Seek;
+    command.slot = slot;
+    command.position = frame;
+    post(std::move(command));
+}
+
+void Mixer::setMasterGain(float gain, InputSource source)
+{
+    Command command;
+    command.type = Command::MasterGain;
+    command.gain = gain;
+    command.source = source;
+    post(std::move(command));
+}
+
+void Mixer::submit(const QList<PlaybackCommand> &commands)
+{
+    if(commands.isEmpty())
+        return;
+    Command command;
+    command.type = Command::Batch;
+    command.source = commands.first().source;
+    command.received = commands.first().timestamp;
+    command.batch = commands;
+    post(std::move(command));
+}
+
+void Mixer::post(Command &&command)
+{
+    const InputSource source = command.source;
+    if(!m_bus.post(std::move(command)))
+        qWarning() << "command bus full, dropped a command from" << inputSourceName(source);
+}
+
+qint64 Mixer::bytesAvailable() const
+{
+    const qint64 bytesPerFrame = m_channels * (m_outputFormat == QAudioFormat::Float ? sizeof(float) : sizeof(qint16));
+    return m_periodFrames * bytesPerFrame + QIODevice::bytesAvailable();
+}
+
+qint64 Mixer::writeData(const char *data, qint64 maxSize)
+{
+    Q_UNUSED(data);
+    Q_UNUSED(maxSize);
+    return 0;
+}
+
+qint64 Mixer::readData(char *data, qint64 maxSize)
+{
+    const bool commandsApplied = applyCommands();
+    const quint64 previousSlots = m_playingSlots.load(std::memory_order_relaxed);
+
+    const bool floatOutput = m_outputFormat == QAudioFormat::Float;
+    const qint64 bytesPerFrame = m_channels * (floatOutput ? sizeof(float) : sizeof(qint16));
+    const qint64 frames = maxSize / bytesPerFrame;
+    checkUnderrun(frames);
+    recordBuffered(frames);
+
+    qint64 done = 0;
+    while(done < frames) {
+        const qint64 chunk = qMin<qint64>(frames - done, m_periodFrames);
+        if(floatOutput) {
+            render(reinterpret_cast<float *>(data) + done * m_channels, chunk);
+        } else {
+            render(m_scratch.data(), chunk);
+            MixKernels::toInt16(reinterpret_cast<qint16 *>(data) + done * m_channels, m_scratch.data(), chunk * m_channels);
+        }
+        done += chunk;
+    }
+
+    quint64 playing = 0;
+    const Voice *newest = nullptr;
+    for(const Voice &voice : m_voices) {
+        if(!voice.active)
+            continue;
+        if(voice.slot >= 0 && voice.slot < MaxSlots)
+            playing |= quint64(1) << voice.slot;
+        if(!newest || voice.startedAt > newest->startedAt)
+            newest = &voice;
+    }
+    m_playingSlots.store(playing, std::memory_order_relaxed);
+    m_currentSlot.store(newest ? newest->slot : -1, std::memory_order_relaxed);
+    m_currentPosition.store(newest ? newest->position : 0, std::memory_order_relaxed);
+    m_currentStarted.store(newest ? newest->started : 0, std::memory_order_relaxed);
+    if(commandsApplied || playing != previousSlots)
+        emit playingSlotsChanged(playing);
+
+    // However many volume updates arrived, listeners hear about the one applied.
+    if(m_appliedGain != m_reportedGain) {
+        m_reportedGain = m_appliedGain;
+        emit masterGainChanged(m_appliedGain, m_gainSource);
+    }
+
+    return done * bytesPerFrame;
+}
+
+void Mixer::setBufferFrames(int frames)
+{
+    m_bufferFrames.store(frames, std::memory_order_relaxed);
+    m_lastReadAt = 0;
+}
+
+// The sink asks for data whenever there is room, and the buffer is full after
+// every read. If the next read comes later than the buffer takes to play, the
+// device has run dry in between.
+void Mixer::checkUnderrun(qint64 requestedFrames)
+{
+    const int bufferFrames = m_bufferFrames.load(std::memory_order_relaxed);
+    const qint64 now = InputEvent::now();
+    if(bufferFrames > 0 && m_lastReadAt) {
+        const qint64 bufferNs = bufferFrames * 1000000000LL / m_mixFormat.sampleRate();
+        if(now - m_lastReadAt > bufferNs) {
+            m_underruns.fetch_add(1, std::memory_order_relaxed);
+            emit underrun();
+        }
+        m_depthFrames.store(int(qMax<qint64>(0, bufferFrames - requestedFrames)), std::memory_order_relaxed);
+    }
+    m_lastReadAt = now;
+}
+
+// The sink plays what it already holds before the frames returned now, so a
+// voice has left its buffer once the frames played reach the voice's first
+// one. What the sink holds is the buffer minus the room it asks to fill.
+void Mixer::recordBuffered(qint64 requestedFrames)
+{
+    const qint64 queued = qMax<qint64>(0, m_bufferFrames.load(std::memory_order_relaxed) - requestedFrames);
+    const qint64 played = m_frameClock - queued;
+    qint64 now = 0;
+    for(Voice &voice : m_voices) {
+        if(!voice.measure || voice.firstFrame > played)
+            continue;
+        if(!now)
+            now = InputEvent::now();
+        voice.measure = false;
+        LatencyMetrics::instance().recordTrigger(voice.stamp.source, voice.stamp.received,
+                                                 voice.stamp.dispatched, voice.started, now);
+    }
+}
+
+// The bus and the input queues are each in sequence order; always take the
+// lowest head, so everything is applied in the order it was posted, whichever
+// thread it came from. Serial events between the same two commands share a
+// sequence; each board's stay in order. A command still being posted while
+// this runs is simply picked up in the next period.
+bool Mixer::applyCommands()
+{
+    const int limit = m_maxCommandsPerPeriod.load(std::memory_order_relaxed);
+    int applied = 0;
+    Command command;
+    InputEvent event;
+    while(limit <= 0 || applied < limit) {
+        const Command *next = m_bus.front();
+        SpscQueue<InputEvent> *lane = nullptr;
+        quint64 lowest = next ? next->sequence : ~quint64(0);
+        for(SpscQueue<InputEvent> *queue : std::as_const(m_inputQueues)) {
+            const InputEvent *head = queue->front();
+            if(head && head->sequence < lowest) {
+                lane = queue;
+                lowest = head->sequence;
+            }
+        }
+
+        if(lane) {
+            lane->tryPop(&event);
+            applyInputEvent(event);
+        } else if(next) {
+            m_bus.tryPop(&command);
+            applyCommand(command);
+        } else {
+            break;
+        }
+        ++applied;
+    }
+    return applied > 0;
+}
+
+void Mixer::applyCommand(const Command &command)
+{
+    Stamp stamp;
+    stamp.source = command.source;
+    stamp.received = command.received;
+    stamp.dispatched = command.dispatched;
+
+    switch(command.type) {
+    case Command::Arm:
+        m_armed[command.slot] = command.sample;
+        m_armedGain[command.slot] = command.gain;
+        break;
+    case Command::Trigger:
+        if(command.slot >= 0 && command.slot < MaxSlots && m_armed[command.slot])
+            startVoice(command.slot, m_armed[command.slot], command.gain * m_armedGain[command.slot], stamp);
+        else
+            emit triggerMissed(command.slot, command.source);
+        break;
+    case Command::Play:
+        startVoice(command.slot, command.sample, command.gain, stamp);
+        break;
+    case Command::Stop:
+        for(Voice &voice : m_voices) {
+            if(voice.active && voice.slot == command.slot)
+                releaseVoice(voice);
+        }
+        break;
+    case Command::StopAll:
+        for(Voice &voice : m_voices) {
+            if(voice.active)
+                releaseVoice(voice);
+        }
+        break;
+    case Command::MasterGain:
+        setTargetGain(command.gain, command.source);
+        break;
+    case Command::Seek:
+        for(Voice &voice : m_voices) {
+            if(voice.active && voice.slot == command.slot && voice.envelopeStep >= 0.0f)
+                seekVoice(voice, command.position);
+        }
+        break;
+    case Command::Batch:
+        for(const PlaybackCommand &playbackCommand : command.batch) {
+            Command part;
+            part.slot = playbackCommand.slot;
+            part.gain = playbackCommand.value;
+            part.source = playbackCommand.source;
+            part.received = playbackCommand.timestamp ? playbackCommand.timestamp : command.received;
+            part.dispatched = command.dispatched;
+            switch(playbackCommand.type) {
+            case PlaybackCommand::Trigger:
+                part.type = Command::Trigger;
+                break;
+            case PlaybackCommand::Stop:
+                part.type = Command::Stop;
+                break;
+            case PlaybackCommand::StopAll:
+                part.type = Command::StopAll;
+                break;
+            case PlaybackCommand::MasterGain:
+                part.type = Command::MasterGain;
+                break;
+            }
+            applyCommand(part);
+        }
+        break;
+    }
+}
+
+void Mixer::applyInputEvent(const InputEvent &event)
+{
+    switch(event.type) {
+    case InputEvent::Trigger: {
+        Stamp stamp;
+        stamp.source = InputSource::Serial;
+        stamp.received = event.timestamp;
+        stamp.dispatched = event.dispatched;
+        for(quint64 pending = event.slotBits; pending; pending &= pending - 1) {
+            const int slot = qCountTrailingZeroBits(pending);
+            if(m_armed[slot])
+                startVoice(slot, m_armed[slot], m_armedGain[slot], stamp);
+            else
+                emit triggerMissed(slot, stamp.source);
+        }
+        break;
+    }
+    case InputEvent::Volume:
+        setTargetGain(qBound(0, event.value, 100) / 100.0f, InputSource::Serial);
+        break;
+    }
+}
+
+void Mixer::startVoice(int slot, const SamplePtr &sample, float gain, const Stamp &stamp)
+{
+    auto target = std::find_if(m_voices.begin(), m_voices.end(), [](const Voice &voice) {
+        return !voice.active;
+    });
+    if(target == m_voices.end()) {
+        target = std::min_element(m_voices.begin(), m_voices.end(), [](const Voice &a, const Voice &b) {
+            return a.startedAt < b.startedAt;
+        });
+        // The stolen voice fades out on the side instead of being cut off.
+        auto spare = std::find_if(m_releasing.begin(), m_releasing.end(), [](const Voice &voice) {
+            return !voice.active;
+        });
+        if(spare != m_releasing.end() && m_fadeOutStep > 0.0f) {
+            *spare = *target;
+            spare->measure = false;
+            releaseVoice(*spare);
+            // Its stream went along with it.
+            target->stream = -1;
+        } else {
+            endVoice(*target);
+        }
+    }
+
+    if(m_duckGain < 1.0f) {
+        for(Voice &voice : m_voices) {
+            if(voice.active && voice.envelopeStep >= 0.0f)
+                voice.duckUntil = m_frameClock + m_duckHoldFrames;
+        }
+    }
+
+    Voice &voice = *target;
+    voice.sample = sample;
+    voice.data = reinterpret_cast<const float *>(sample->pcm.constData());
+    voice.frames = sample->pcm.size() / qint64(sizeof(float) * m_channels);
+    voice.position = 0;
+    voice.gain = gain;
+    voice.slot = slot;
+    voice.startedAt = ++m_voiceClock;
+    voice.stream = -1;
+    if(sample->streamed) {
+        const auto idle = std::find(m_streamBusy.begin(), m_streamBusy.end(), false);
+        if(idle != m_streamBusy.end()) {
+            *idle = true;
+            voice.stream = int(idle - m_streamBusy.begin());
+            m_streams[size_t(voice.stream)]->start(sample, voice.frames);
+        }
+    }
+    voice.active = voice.frames > 0 || voice.stream >= 0;
+    voice.measure = voice.active;
+    voice.stamp = stamp;
+    voice.started = InputEvent::now();
+    voice.firstFrame = m_frameClock + m_dspLatencyFrames.load(std::memory_order_relaxed);
+    voice.envelope = m_fadeInStep > 0.0f ? 0.0f : 1.0f;
+    voice.envelopeStep = m_fadeInStep;
+    voice.duck = 1.0f;
+    voice.duckUntil = 0;
+}
+
+void Mixer::releaseVoice(Voice &voice)
+{
+    if(m_fadeOutStep > 0.0f) {
+        voice.envelopeStep = -m_fadeOutStep;
+        return;
+    }
+    endVoice(voice);
+}
+
+void Mixer::endVoice(Voice &voice)
+{
+    voice.active = false;
+    voice.sample.reset();
+    if(voice.stream >= 0) {
+        m_streams[size_t(voice.stream)]->stop();
+        m_streamBusy[size_t(voice.stream)] = false;
+        voice.stream = -1;
+    }
+}
+
+// A jump in the middle of the sound would click, so the voice fades in from
+// the new position like a new one.
+void Mixer::seekVoice(Voice &voice, qint64 frame)
+{
+    frame = qMax<qint64>(0, frame);
+    if(voice.stream >= 0) {
+        // Inside the head the stream picks up where the head ends; further
+        // on the voice is silent until the stream has decoded up to frame.
+        m_streams[size_t(voice.stream)]->start(voice.sample, qMax(frame, voice.frames));
+        voice.position = frame;
+    } else {
+        voice.position = qMin(frame, voice.frames);
+    }
+    voice.envelope = m_fadeInStep > 0.0f ? 0.0f : 1.0f;
+    voice.envelopeStep = m_fadeInStep;
+}
+
+void Mixer::mixVoice(Voice &voice, float *out, qint64 frames, float master)
+{
+    qint64 done = 0;
+    while(voice.active && done < frames) {
+        if(voice.position < voice.frames) {
+            const qint64 count = qMin(frames - done, voice.frames - voice.position);
+            mixFrames(voice, out + done * m_channels, voice.data + voice.position * m_channels, count, master);
+            done += count;
+            continue;
+        }
+        if(voice.stream < 0) {
+            endVoice(voice);
+            break;
+        }
+
+        PcmStream *stream = m_streams[size_t(voice.stream)].get();
+        const qint64 count = stream->read(m_streamScratch.data(), frames - done);
+        if(count > 0) {
+            mixFrames(voice, out + done * m_channels, m_streamScratch.data(), count, master);
+            done += count;
+            continue;
+        }
+        // Nothing decoded to play: the voice keeps its place and is silent
+        // for the rest of the chunk.
+        if(stream->atEnd() || voice.envelopeStep < 0.0f)
+            endVoice(voice);
+        else if(stream->isReady())
+            m_streamUnderruns.fetch_add(1, std::memory_order_relaxed);
+        break;
+    }
+}
+
+// Envelope and duck gain are followed per chunk: the voice's gain moves
+// linearly from its value at the start of the chunk to the one at the end.
+void Mixer::mixFrames(Voice &voice, float *out, const float *src, qint64 count, float master)
+{
+    const float envelope = qBound(0.0f, voice.envelope + voice.envelopeStep * count, 1.0f);
+    const float duckTarget = m_frameClock < voice.duckUntil ? m_duckGain : 1.0f;
+    float duck = voice.duck;
+    if(duck > duckTarget)
+        duck = qMax(duckTarget, duck - m_duckAttackStep * count);
+    else if(duck < duckTarget)
+        duck = qMin(duckTarget, duck + m_duckReleaseStep * count);
+
+    const float from = voice.gain * master * voice.envelope * voice.duck;
+    const float to = voice.gain * master * envelope * duck;
+    if(from == to)
+        MixKernels::mixAdd(out, src, count * m_channels, to);
+    else
+        MixKernels::mixAddRamp(out, src, count, m_channels, from, to);
+
+    voice.envelope = envelope;
+    if(voice.envelopeStep > 0.0f && envelope >= 1.0f)
+        voice.envelopeStep = 0.0f;
+    voice.duck = duck;
+    voice.position += count;
+    if((voice.stream < 0 && voice.position >= voice.frames) || (voice.envelopeStep < 0.0f && envelope <= 0.0f))
+        endVoice(voice);
+}
+
+void Mixer::setTargetGain(float gain, InputSource source)
+{
+    m_masterGain.store(qBound(0.0f, gain, 1.0f), std::memory_order_relaxed);
+    m_gainSource = source;
+}
+
+void Mixer::render(float *out, qint64 frames)
+{
+    std::fill(out, out + frames * m_channels, 0.0f);
+
+    // A new target is reached over one chunk instead of jumping, which would click.
+    const float target = masterGain();
+    const bool ramp = target != m_appliedGain;
+    const float master = ramp ? 1.0f : target;
+    for(Voice &voice : m_voices) {
+        if(voice.active)
+            mixVoice(voice, out, frames, master);
+    }
+    for(Voice &voice : m_releasing) {
+        if(voice.active)
+            mixVoice(voice, out, frames, master);
+    }
+
+    if(ramp) {
+        MixKernels::ramp(out, frames, m_channels, m_appliedGain, target);
+        m_appliedGain = target;
+    }
+    if(m_limiter)
+        m_limiter->process(out, frames);
+    m_frameClock += frames;
+}
@@ -0,0 +1,200 @@
+#ifndef MIXER_H
+#define MIXER_H
+
+#include <QIODevice>
+#include <QAudioFormat>
+#include <QVector>
+
+#include <array>
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include "commandbus.h"
+#include "dspconfig.h"
+#include "inputevent.h"
+#include "limiter.h"
+#include "pcmstream.h"
+#include "playbackcommand.h"
+#include "samplecache.h"
+#include "spscqueue.h"
+
+// Pull-mode source for QAudioSink. Mixes up to voiceCount() samples into
+// interleaved float frames; commands posted to the bus from other threads and
+// events from the input queues are picked up at the start of the next period.
+// Every serial board has its own queue; they and the bus are merged here by
+// sequence number. Voices fade in and out instead of starting and stopping
+// hard, and the master bus goes through a limiter, see DspConfig. A streamed
+// sample plays its head from memory and the rest from a PcmStream, so long
+// tracks and short clips share the same voices.
+class Mixer : public QIODevice
+{
+    Q_OBJECT
+
+public:
+    static constexpr int MaxSlots = 64;
+
+    Mixer(const QAudioFormat &mixFormat, QAudioFormat::SampleFormat outputFormat,
+          int voices, int periodFrames, const QVector<SpscQueue<InputEvent> *> &inputQueues,
+          QObject *parent = nullptr);
+
+    const CommandBus &commandBus() const { return m_bus; }
+    // Before the sink starts pulling, or on the render thread.
+    void setDsp(const DspConfig &dsp);
+    // Delay added by the limiter's lookahead.
+    int dspLatencyFrames() const { return m_dspLatencyFrames.load(std::memory_order_relaxed); }
+    // Streamed samples play through one of count streams with a ring of
+    // bufferFrames each; with all of them busy only the head plays. Before
+    // the sink starts pulling.
+    void setStreaming(int count, qint64 bufferFrames);
+    // Periods in which a streamed voice had played all its stream had decoded.
+    quint64 streamUnderruns() const { return m_streamUnderruns.load(std::memory_order_relaxed); }
+    // Caps the commands and input events applied per period, 0 for no limit.
+    // Whatever is over the limit waits on the bus for the next period.
+    void setMaxCommandsPerPeriod(int count) { m_maxCommandsPerPeriod.store(count, std::memory_order_relaxed); }
+
+    // gain is the slot's own level, applied to every trigger of it.
+    void arm(int slot, const SamplePtr &sample, float gain = 1.0f);
+    void trigger(int slot, float gain, InputSource source, qint64 received);
+    void play(int slot, const SamplePtr &sample, float gain, InputSource source, qint64 received);
+    void stop(int slot);
+    void stopAll();
+    // Moves the voices of the slot to frame, with a short fade in.
+    void seek(int slot, qint64 frame);
+    // Queues several commands so they are applied in order within one period.
+    void submit(const QList<PlaybackCommand> &commands);
+
+    // Every source only moves the target gain; the render thread applies the
+    // latest target once per period with a ramp and reports it once.
+    void setMasterGain(float gain, InputSource source);
+    float masterGain() const { return m_masterGain.load(std::memory_order_relaxed); }
+    quint64 playingSlots() const { return m_playingSlots.load(std::memory_order_relaxed); }
+    // Slot and frame position of the most recently started voice, slot -1 when idle.
+    int currentSlot() const { return m_currentSlot.load(std::memory_order_relaxed); }
+    qint64 currentPosition() const { return m_currentPosition.load(std::memory_order_relaxed); }
+    // InputEvent::now() when that voice started, comparable across mixers.
+    qint64 currentStarted() const { return m_currentStarted.load(std::memory_order_relaxed); }
+    int voiceCount() const { return int(m_voices.size()); }
+    int periodFrames() const { return m_periodFrames; }
+
+    // Size of the sink's buffer; called on the render thread whenever the
+    // sink is (re)started. Reads further apart than the buffer lasts are
+    // counted as underruns.
+    void setBufferFrames(int frames);
+    int bufferFrames() const { return m_bufferFrames.load(std::memory_order_relaxed); }
+    // Frames still queued in the sink when it last asked for more.
+    int depthFrames() const { return m_depthFrames.load(std::memory_order_relaxed); }
+    quint64 underruns() const { return m_underruns.load(std::memory_order_relaxed); }
+
+    bool isSequential() const override { return true; }
+    qint64 bytesAvailable() const override;
+
+signals:
+    void playingSlotsChanged(quint64 playing);
+    void masterGainChanged(float gain, InputSource source);
+    void triggerMissed(int slot, InputSource source);
+    // Emitted on the render thread from within readData().
+    void underrun();
+
+protected:
+    qint64 readData(char *data, qint64 maxSize) override;
+    qint64 writeData(const char *data, qint64 maxSize) override;
+
+private:
+    // Where a trigger came from and when, for the latency histograms.
+    struct Stamp {
+        InputSource source = InputSource::Gui;
+        qint64 received = 0;
+        qint64 dispatched = 0;
+    };
+
+    struct Voice {
+        SamplePtr sample;
+        const float *data = nullptr;
+        // In memory; a streamed voice goes on from its stream after these.
+        qint64 frames = 0;
+        qint64 position = 0;
+        int stream = -1;
+        float gain = 1.0f;
+        int slot = -1;
+        quint64 startedAt = 0;
+        bool active = false;
+        bool measure = false;
+        Stamp stamp;
+        qint64 started = 0;
+        // m_frameClock at which the first frame leaves the mixer.
+        qint64 firstFrame = 0;
+        // Fade envelope, moving by envelopeStep per frame; negative while
+        // the voice fades out, it ends at 0.
+        float envelope = 1.0f;
+        float envelopeStep = 0.0f;
+        // Ducked while m_frameClock < duckUntil.
+        float duck = 1.0f;
+        qint64 duckUntil = 0;
+    };
+
+    using Command = CommandBus::Command;
+
+    void post(Command &&command);
+    bool applyCommands();
+    void applyCommand(const Command &command);
+    void applyInputEvent(const InputEvent &event);
+    void startVoice(int slot, const SamplePtr &sample, float gain, const Stamp &stamp);
+    void releaseVoice(Voice &voice);
+    void endVoice(Voice &voice);
+    void seekVoice(Voice &voice, qint64 frame);
+    void mixVoice(Voice &voice, float *out, qint64 frames, float master);
+    void mixFrames(Voice &voice, float *out, const float *src, qint64 count, float master);
+    void setTargetGain(float gain, InputSource source);
+    void render(float *out, qint64 frames);
+    void checkUnderrun(qint64 requestedFrames);
+    void recordBuffered(qint64 requestedFrames);
+
+    QAudioFormat m_mixFormat;
+    QAudioFormat::SampleFormat m_outputFormat;
+    int m_channels;
+    int m_periodFrames;
+    std::vector<Voice> m_voices;
+    // Stolen voices fading out; they no longer count as playing.
+    std::vector<Voice> m_releasing;
+    std::vector<float> m_scratch;
+    quint64 m_voiceClock = 0;
+    std::array<SamplePtr, MaxSlots> m_armed;
+    std::array<float, MaxSlots> m_armedGain;
+    QVector<SpscQueue<InputEvent> *> m_inputQueues;
+
+    CommandBus m_bus;
+
+    float m_fadeInStep = 0.0f;
+    float m_fadeOutStep = 0.0f;
+    float m_duckGain = 1.0f;
+    qint64 m_duckHoldFrames = 0;
+    float m_duckAttackStep = 1.0f;
+    float m_duckReleaseStep = 1.0f;
+    qint64 m_frameClock = 0;
+    std::unique_ptr<Limiter> m_limiter;
+    std::vector<std::unique_ptr<PcmStream>> m_streams;
+    // Render thread only.
+    std::vector<bool> m_streamBusy;
+    std::vector<float> m_streamScratch;
+    std::atomic<quint64> m_streamUnderruns { 0 };
+    std::atomic<int> m_dspLatencyFrames { 0 };
+    std::atomic<int> m_maxCommandsPerPeriod { 0 };
+
+    // Target gain, only written on the render thread.
+    std::atomic<float> m_masterGain { 1.0f };
+    float m_appliedGain = 1.0f;
+    float m_reportedGain = 1.0f;
+    InputSource m_gainSource = InputSource::Gui;
+    std::atomic<quint64> m_playingSlots { 0 };
+    std::atomic<int> m_currentSlot { -1 };
+    std::atomic<qint64> m_currentPosition { 0 };
+    std::atomic<qint64> m_currentStarted { 0 };
+
+    qint64 m_lastReadAt = 0;
+    std::atomic<int> m_bufferFrames { 0 };
+    std::atomic<int> m_depthFrames { 0 };
+    std::atomic<quint64> m_underruns { 0 };
+};
+
+#endif // MIXER_H
@@ -0,0 +1,269 @@
+#include "mixkernels.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define NB_HAVE_SSE2 1
+#include <emmintrin.h>
+#endif
+
+#if defined(NB_HAVE_SSE2) && defined(__GNUC__)
+#define NB_HAVE_AVX2 1
+#include <immintrin.h>
+#endif
+
+namespace MixKernels {
+
+namespace {
+
+void mixAddScalar(float *dst, const float *src, qsizetype count, float gain)
+{
+    for(qsizetype i = 0; i < count; ++i)
+        dst[i] += src[i] * gain;
+}
+
+void scaleScalar(float *dst, qsizetype count, float gain)
+{
+    for(qsizetype i = 0; i < count; ++i)
+        dst[i] *= gain;
+}
+
+void toInt16Scalar(qint16 *dst, const float *src, qsizetype count)
+{
+    for(qsizetype i = 0; i < count; ++i)
+        dst[i] = qint16(std::clamp(src[i], -1.0f, 1.0f) * 32767.0f);
+}
+
+void mixAddRampScalar(float *dst, const float *src, qsizetype frames, int channels, float from, float to)
+{
+    const float step = (to - from) / float(frames);
+    float gain = from;
+    for(qsizetype frame = 0; frame < frames; ++frame) {
+        gain += step;
+        for(int c = 0; c < channels; ++c)
+            *dst++ += *src++ * gain;
+    }
+}
+
+void framePeaksScalar(float *peaks, const float *src, qsizetype frames, int channels)
+{
+    for(qsizetype frame = 0; frame < frames; ++frame) {
+        float peak = 0.0f;
+        for(int c = 0; c < channels; ++c)
+            peak = std::max(peak, std::fabs(*src++));
+        peaks[frame] = peak;
+    }
+}
+
+void applyGainsScalar(float *dst, const float *src, const float *gains, qsizetype frames, int channels)
+{
+    for(qsizetype frame = 0; frame < frames; ++frame) {
+        for(int c = 0; c < channels; ++c)
+            *dst++ = *src++ * gains[frame];
+    }
+}
+
+#ifdef NB_HAVE_SSE2
+void mixAddSse2(float *dst, const float *src, qsizetype count, float gain)
+{
+    const __m128 g = _mm_set1_ps(gain);
+    qsizetype i = 0;
+    for(; i + 4 <= count; i += 4) {
+        const __m128 s = _mm_loadu_ps(src + i);
+        const __m128 d = _mm_loadu_ps(dst + i);
+        _mm_storeu_ps(dst + i, _mm_add_ps(d, _mm_mul_ps(s, g)));
+    }
+    mixAddScalar(dst + i, src + i, count - i, gain);
+}
+
+void scaleSse2(float *dst, qsizetype count, float gain)
+{
+    const __m128 g = _mm_set1_ps(gain);
+    qsizetype i = 0;
+    for(; i + 4 <= count; i += 4)
+        _mm_storeu_ps(dst + i, _mm_mul_ps(_mm_loadu_ps(dst + i), g));
+    scaleScalar(dst + i, count - i, gain);
+}
+
+void toInt16Sse2(qint16 *dst, const float *src, qsizetype count)
+{
+    const __m128 scale = _mm_set1_ps(32767.0f);
+    const __m128 lo = _mm_set1_ps(-1.0f);
+    const __m128 hi = _mm_set1_ps(1.0f);
+    qsizetype i = 0;
+    for(; i + 8 <= count; i += 8) {
+        const __m128 a = _mm_mul_ps(_mm_min_ps(_mm_max_ps(_mm_loadu_ps(src + i), lo), hi), scale);
+        const __m128 b = _mm_mul_ps(_mm_min_ps(_mm_max_ps(_mm_loadu_ps(src + i + 4), lo), hi), scale);
+        const __m128i packed = _mm_packs_epi32(_mm_cvttps_epi32(a), _mm_cvttps_epi32(b));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), packed);
+    }
+    toInt16Scalar(dst + i, src + i, count - i);
+}
+
+// The stereo kernels below handle two frames per register; anything else
+// takes the scalar path.
+void mixAddRampSse2(float *dst, const float *src, qsizetype frames, int channels, float from, float to)
+{
+    if(channels != 2) {
+        mixAddRampScalar(dst, src, frames, channels, from, to);
+        return;
+    }
+    const float step = (to - from) / float(frames);
+    __m128 gain = _mm_setr_ps(from + step, from + step, from + 2 * step, from + 2 * step);
+    const __m128 advance = _mm_set1_ps(2 * step);
+    qsizetype frame = 0;
+    for(; frame + 2 <= frames; frame += 2) {
+        const __m128 d = _mm_loadu_ps(dst + 2 * frame);
+        _mm_storeu_ps(dst + 2 * frame, _mm_add_ps(d, _mm_mul_ps(_mm_loadu_ps(src + 2 * frame), gain)));
+        gain = _mm_add_ps(gain, advance);
+    }
+    if(frame < frames) {
+        const float last = from + step * float(frame + 1);
+        dst[2 * frame] += src[2 * frame] * last;
+        dst[2 * frame + 1] += src[2 * frame + 1] * last;
+    }
+}
+
+void framePeaksSse2(float *peaks, const float *src, qsizetype frames, int channels)
+{
+    if(channels != 2) {
+        framePeaksScalar(peaks, src, frames, channels);
+        return;
+    }
+    const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+    qsizetype frame = 0;
+    for(; frame + 4 <= frames; frame += 4) {
+        const __m128 a = _mm_and_ps(_mm_loadu_ps(src + 2 * frame), absMask);
+        const __m128 b = _mm_and_ps(_mm_loadu_ps(src + 2 * frame + 4), absMask);
+        const __m128 ma = _mm_max_ps(a, _mm_shuffle_ps(a, a, _MM_SHUFFLE(2, 3, 0, 1)));
+        const __m128 mb = _mm_max_ps(b, _mm_shuffle_ps(b, b, _MM_SHUFFLE(2, 3, 0, 1)));
+        _mm_storeu_ps(peaks + frame, _mm_shuffle_ps(ma, mb, _MM_SHUFFLE(2, 0, 2, 0)));
+    }
+    framePeaksScalar(peaks + frame, src + 2 * frame, frames - frame, channels);
+}
+
+void applyGainsSse2(float *dst, const float *src, const float *gains, qsizetype frames, int channels)
+{
+    if(channels != 2) {
+        applyGainsScalar(dst, src, gains, frames, channels);
+        return;
+    }
+    qsizetype frame = 0;
+    for(; frame + 4 <= frames; frame += 4) {
+        const __m128 g = _mm_loadu_ps(gains + frame);
+        _mm_storeu_ps(dst + 2 * frame, _mm_mul_ps(_mm_loadu_ps(src + 2 * frame), _mm_unpacklo_ps(g, g)));
+        _mm_storeu_ps(dst + 2 * frame + 4, _mm_mul_ps(_mm_loadu_ps(src + 2 * frame + 4), _mm_unpackhi_ps(g, g)));
+    }
+    applyGainsScalar(dst + 2 * frame, src + 2 * frame, gains + frame, frames - frame, channels);
+}
+#endif
+
+#ifdef NB_HAVE_AVX2
+__attribute__((target("avx2,fma")))
+void mixAddAvx2(float *dst, const float *src, qsizetype count, float gain)
+{
+    const __m256 g = _mm256_set1_ps(gain);
+    qsizetype i = 0;
+    for(; i + 8 <= count; i += 8) {
+        const __m256 s = _mm256_loadu_ps(src + i);
+        const __m256 d = _mm256_loadu_ps(dst + i);
+        _mm256_storeu_ps(dst + i, _mm256_fmadd_ps(s, g, d));
+    }
+    mixAddScalar(dst + i, src + i, count - i, gain);
+}
+
+__attribute__((target("avx2")))
+void scaleAvx2(float *dst, qsizetype count, float gain)
+{
+    const __m256 g = _mm256_set1_ps(gain);
+    qsizetype i = 0;
+    for(; i + 8 <= count; i += 8)
+        _mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_loadu_ps(dst + i), g));
+    scaleScalar(dst + i, count - i, gain);
+}
+#endif
+
+struct Table {
+    void (*mixAdd)(float *, const float *, qsizetype, float);
+    void (*scale)(float *, qsizetype, float);
+    void (*toInt16)(qint16 *, const float *, qsizetype);
+    void (*mixAddRamp)(float *, const float *, qsizetype, int, float, float);
+    void (*framePeaks)(float *, const float *, qsizetype, int);
+    void (*applyGains)(float *, const float *, const float *, qsizetype, int);
+    const char *name;
+};
+
+Table selectTable()
+{
+#ifdef NB_HAVE_AVX2
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+        return { mixAddAvx2, scaleAvx2, toInt16Sse2, mixAddRampSse2, framePeaksSse2, applyGainsSse2, "avx2" };
+#endif
+#ifdef NB_HAVE_SSE2
+    return { mixAddSse2, scaleSse2, toInt16Sse2, mixAddRampSse2, framePeaksSse2, applyGainsSse2, "sse2" };
+#else
+    return { mixAddScalar, scaleScalar, toInt16Scalar, mixAddRampScalar, framePeaksScalar, applyGainsScalar, "scalar" };
+#endif
+}
+
+const Table &table()
+{
+    static const Table t = selectTable();
+    return t;
+}
+
+} // namespace
+
+void mixAdd(float *dst, const float *src, qsizetype count, float gain)
+{
+    table().mixAdd(dst, src, count, gain);
+}
+
+void scale(float *dst, qsizetype count, float gain)
+{
+    table().scale(dst, count, gain);
+}
+
+void toInt16(qint16 *dst, const float *src, qsizetype count)
+{
+    table().toInt16(dst, src, count);
+}
+
+// Only runs on the periods where the gain changes, so it stays scalar.
+void ramp(float *dst, qsizetype frames, int channels, float from, float to)
+{
+    if(frames <= 0)
+        return;
+    const float step = (to - from) / float(frames);
+    float gain = from;
+    for(qsizetype frame = 0; frame < frames; ++frame) {
+        gain += step;
+        for(int c = 0; c < channels; ++c)
+            *dst++ *= gain;
+    }
+}
+
+void mixAddRamp(float *dst, const float *src, qsizetype frames, int channels, float from, float to)
+{
+    if(frames > 0)
+        table().mixAddRamp(dst, src, frames, channels, from, to);
+}
+
+void framePeaks(float *peaks, const float *src, qsizetype frames, int channels)
+{
+    table().framePeaks(peaks, src, frames, channels);
+}
+
+void applyGains(float *dst, const float *src, const float *gains, qsizetype frames, int channels)
+{
+    table().applyGains(dst, src, gains, frames, channels);
+}
+
+const char *implementation()
+{
+    return table().name;
+}
+
+} // namespace MixKernels
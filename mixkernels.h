@@ -0,0 +1,30 @@
+#ifndef MIXKERNELS_H
+#define MIXKERNELS_H
+
+#include <QtGlobal>
+
+// Block kernels used by the mixer. The implementation is picked once at
+// runtime: AVX2 when the CPU has it, SSE2 on other x86 machines and plain
+// loops everywhere else.
+namespace MixKernels {
+
+// dst[i] += src[i] * gain
+void mixAdd(float *dst, const float *src, qsizetype count, float gain);
+// dst[i] *= gain
+void scale(float *dst, qsizetype count, float gain);
+// dst[i] = clamp(src[i], -1, 1) * 32767
+void toInt16(qint16 *dst, const float *src, qsizetype count);
+// Interleaved frames scaled by a gain moving linearly from 'from' to 'to'.
+void ramp(float *dst, qsizetype frames, int channels, float from, float to);
+// dst += src with the gain moving linearly from 'from' to 'to', like ramp().
+void mixAddRamp(float *dst, const float *src, qsizetype frames, int channels, float from, float to);
+// peaks[frame] = largest |sample| of the frame's channels
+void framePeaks(float *peaks, const float *src, qsizetype frames, int channels);
+// dst[frame][c] = src[frame][c] * gains[frame]
+void applyGains(float *dst, const float *src, const float *gains, qsizetype frames, int channels);
+
+const char *implementation();
+
+} // namespace MixKernels
+
+#endif // MIXKERNELS_H
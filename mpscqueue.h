@@ -0,0 +1,110 @@
+#ifndef MPSCQUEUE_H
+#define MPSCQUEUE_H
+
+#include <QtGlobal>
+
+#include <atomic>
+#include <vector>
+
+// Bounded lock-free queue for any number of producer threads and exactly one
+// consumer. Every cell carries a sequence number that tells producers and the
+// consumer whose turn it is (Vyukov's bounded queue), so a push is one CAS on
+// the tail and never waits for another producer to finish. A full queue drops
+// the new element and counts it.
+template<typename T>
+class MpscQueue
+{
+public:
+    explicit MpscQueue(qsizetype capacity)
+        : m_cells(size_t(roundUp(capacity))),
+        m_mask(quint64(m_cells.size()) - 1)
+    {
+        for(size_t i = 0; i < m_cells.size(); ++i)
+            m_cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    MpscQueue(const MpscQueue &) = delete;
+    MpscQueue &operator=(const MpscQueue &) = delete;
+
+    qsizetype capacity() const { return qsizetype(m_cells.size()); }
+
+    // Producer side, any thread.
+    bool push(const T &value)
+    {
+        return push(value, [](T &, quint64) {});
+    }
+
+    // stamp(element, position) runs on the copy in its cell once the CAS has
+    // won position, before the consumer can see it. Positions count every
+    // push that got a cell, so they are in queue order.
+    template<typename Stamp>
+    bool push(const T &value, Stamp &&stamp)
+    {
+        quint64 position = m_tail.load(std::memory_order_relaxed);
+        for(;;) {
+            Cell &cell = m_cells[position & m_mask];
+            const quint64 sequence = cell.sequence.load(std::memory_order_acquire);
+            const qint64 lag = qint64(sequence - position);
+            if(lag == 0) {
+                if(m_tail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                    cell.value = value;
+                    stamp(cell.value, position);
+                    cell.sequence.store(position + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if(lag < 0) {
+                m_dropped.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            } else {
+                position = m_tail.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // Consumer side, one thread only. The oldest element, nullptr when empty.
+    const T *front() const
+    {
+        const Cell &cell = m_cells[m_head & m_mask];
+        const quint64 sequence = cell.sequence.load(std::memory_order_acquire);
+        return qint64(sequence - (m_head + 1)) < 0 ? nullptr : &cell.value;
+    }
+
+    bool tryPop(T *value)
+    {
+        Cell &cell = m_cells[m_head & m_mask];
+        const quint64 sequence = cell.sequence.load(std::memory_order_acquire);
+        if(qint64(sequence - (m_head + 1)) < 0)
+            return false;
+        *value = std::move(cell.value);
+        cell.sequence.store(m_head + m_mask + 1, std::memory_order_release);
+        ++m_head;
+        return true;
+    }
+
+    quint64 dropped() const { return m_dropped.load(std::memory_order_relaxed); }
+    // Positions claimed so far, i.e. the position the next push will get.
+    quint64 claimed() const { return m_tail.load(std::memory_order_acquire); }
+
+private:
+    struct Cell {
+        std::atomic<quint64> sequence { 0 };
+        T value {};
+    };
+
+    static qsizetype roundUp(qsizetype capacity)
+    {
+        qsizetype size = 2;
+        while(size < capacity)
+            size <<= 1;
+        return size;
+    }
+
+    std::vector<Cell> m_cells;
+    const quint64 m_mask;
+
+    alignas(64) std::atomic<quint64> m_tail { 0 };
+    alignas(64) quint64 m_head = 0;
+    alignas(64) std::atomic<quint64> m_dropped { 0 };
+};
+
+#endif // MPSCQUEUE_H
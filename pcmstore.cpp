@@ -0,0 +1,194 @@
+#include "pcmstore.h"
+
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QMutexLocker>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QDebug>
+
+#include <cstring>
+
+namespace {
+
+constexpr char Magic[8] = { 'N', 'B', 'P', 'C', 'M', 0, 0, 0 };
+constexpr quint32 Version = 1;
+
+// Fixed 64 byte header, the float frames follow it so they stay aligned in the mapping.
+struct Header {
+    char magic[8];
+    quint32 version;
+    quint32 sampleRate;
+    quint32 channels;
+    quint32 reserved;
+    quint64 frames;
+    char padding[32];
+};
+static_assert(sizeof(Header) == 64, "PCM store header must be 64 bytes");
+
+} // namespace
+
+PcmStore::PcmStore(const QString &directory)
+    : m_directory(directory)
+{
+    QDir().mkpath(m_directory);
+    readIndex();
+}
+
+QString PcmStore::defaultDirectory()
+{
+    return QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/pcm";
+}
+
+QByteArray PcmStore::contentHash(const QString &path)
+{
+    const QFileInfo info(path);
+    const qint64 size = info.size();
+    const qint64 modified = info.lastModified().toMSecsSinceEpoch();
+
+    {
+        QMutexLocker locker(&m_mutex);
+        const auto it = m_index.constFind(path);
+        if(it != m_index.cend() && it->size == size && it->modified == modified)
+            return it->hash;
+    }
+
+    QFile file(path);
+    if(!file.open(QIODevice::ReadOnly))
+        return QByteArray();
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    if(!hash.addData(&file))
+        return QByteArray();
+
+    IndexEntry entry;
+    entry.size = size;
+    entry.modified = modified;
+    entry.hash = hash.result().toHex();
+
+    QMutexLocker locker(&m_mutex);
+    const QByteArray previous = m_index.value(path).hash;
+    m_index.insert(path, entry);
+    if(!previous.isEmpty() && previous != entry.hash) {
+        qDebug() << "source changed, rebuilding" << path;
+        removeUnused(previous);
+    }
+    writeIndex();
+    return entry.hash;
+}
+
+SamplePtr PcmStore::load(const QByteArray &hash, const QString &path, const QAudioFormat &format) const
+{
+    if(hash.isEmpty())
+        return SamplePtr();
+
+    auto file = QSharedPointer<QFile>::create(fileName(hash, format));
+    if(!file->open(QIODevice::ReadOnly) || file->size() < qint64(sizeof(Header)))
+        return SamplePtr();
+
+    uchar *data = file->map(0, file->size());
+    if(!data)
+        return SamplePtr();
+
+    Header header;
+    std::memcpy(&header, data, sizeof(header));
+    const qint64 bytes = qint64(header.frames) * header.channels * qint64(sizeof(float));
+    if(std::memcmp(header.magic, Magic, sizeof(Magic)) != 0 || header.version != Version
+        || int(header.sampleRate) != format.sampleRate() || int(header.channels) != format.channelCount()
+        || file->size() != qint64(sizeof(Header)) + bytes) {
+        qDebug() << "ignoring invalid store entry" << file->fileName();
+        return SamplePtr();
+    }
+
+    auto sample = QSharedPointer<Sample>::create();
+    sample->path = path;
+    sample->format = format;
+    sample->hash = hash;
+    sample->pcm = QByteArray::fromRawData(reinterpret_cast<const char *>(data + sizeof(Header)), bytes);
+    sample->mapping = file;
+    return sample;
+}
+
+SamplePtr PcmStore::save(const QByteArray &hash, const SamplePtr &sample)
+{
+    if(hash.isEmpty())
+        return sample;
+
+    Header header {};
+    std::memcpy(header.magic, Magic, sizeof(Magic));
+    header.version = Version;
+    header.sampleRate = quint32(sample->format.sampleRate());
+    header.channels = quint32(sample->format.channelCount());
+    header.frames = quint64(sample->pcm.size() / (qint64(sizeof(float)) * header.channels));
+
+    QSaveFile file(fileName(hash, sample->format));
+    if(!file.open(QIODevice::WriteOnly)
+        || file.write(reinterpret_cast<const char *>(&header), sizeof(header)) != qint64(sizeof(header))
+        || file.write(sample->pcm) != sample->pcm.size()
+        || !file.commit()) {
+        qDebug() << "failed to write store entry" << file.fileName() << file.errorString();
+        return sample;
+    }
+
+    const SamplePtr mapped = load(hash, sample->path, sample->format);
+    return mapped ? mapped : sample;
+}
+
+QString PcmStore::fileName(const QByteArray &hash, const QAudioFormat &format) const
+{
+    return QString("%1/%2-%3-%4.pcm").arg(m_directory, QString::fromLatin1(hash))
+        .arg(format.sampleRate()).arg(format.channelCount());
+}
+
+// {"version": 1, "files": {"/path/a.mp3": {"size": 1234, "mtime": 1700000000000, "sha1": "..."}}}
+void PcmStore::readIndex()
+{
+    QFile file(m_directory + "/index.json");
+    if(!file.open(QIODevice::ReadOnly))
+        return;
+
+    const QJsonObject files = QJsonDocument::fromJson(file.readAll()).object().value("files").toObject();
+    for(auto it = files.constBegin(); it != files.constEnd(); ++it) {
+        const QJsonObject object = it.value().toObject();
+        IndexEntry entry;
+        entry.size = object.value("size").toInteger();
+        entry.modified = object.value("mtime").toInteger();
+        entry.hash = object.value("sha1").toString().toLatin1();
+        m_index.insert(it.key(), entry);
+    }
+}
+
+void PcmStore::writeIndex() const
+{
+    QJsonObject files;
+    for(auto it = m_index.cbegin(); it != m_index.cend(); ++it) {
+        files.insert(it.key(), QJsonObject {
+            { "size", it->size },
+            { "mtime", it->modified },
+            { "sha1", QString::fromLatin1(it->hash) }
+        });
+    }
+
+    QSaveFile file(m_directory + "/index.json");
+    if(!file.open(QIODevice::WriteOnly)
+        || file.write(QJsonDocument(QJsonObject { { "version", 1 }, { "files", files } }).toJson(QJsonDocument::Compact)) < 0
+        || !file.commit()) {
+        qDebug() << "failed to write store index" << file.fileName() << file.errorString();
+    }
+}
+
+void PcmStore::removeUnused(const QByteArray &hash)
+{
+    for(const IndexEntry &entry : std::as_const(m_index)) {
+        if(entry.hash == hash)
+            return;
+    }
+    QDir directory(m_directory);
+    const QStringList stale = directory.entryList({ QString::fromLatin1(hash) + "-*.pcm" }, QDir::Files);
+    for(const QString &name : stale)
+        directory.remove(name);
+}
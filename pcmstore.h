@@ -0,0 +1,52 @@
+#ifndef PCMSTORE_H
+#define PCMSTORE_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QMutex>
+#include <QString>
+
+#include "samplecache.h"
+
+// Decoded PCM kept on disk, one file per source content hash and output
+// format. Entries are memory-mapped read-only, so after a restart a slot can
+// play straight from the page cache without decoding the MP3 again.
+//
+// A small index remembers size, mtime and hash of every source file; the file
+// is only hashed again when size or mtime change. Safe to use from several
+// threads at once.
+class PcmStore
+{
+public:
+    explicit PcmStore(const QString &directory = defaultDirectory());
+
+    static QString defaultDirectory();
+    QString directory() const { return m_directory; }
+
+    // SHA-1 of the file contents, empty if it cannot be read.
+    QByteArray contentHash(const QString &path);
+
+    // Mapped sample for the hash and format, null if the store has none.
+    SamplePtr load(const QByteArray &hash, const QString &path, const QAudioFormat &format) const;
+    // Writes the sample atomically and returns the mapped copy, or the
+    // sample itself if it cannot be written.
+    SamplePtr save(const QByteArray &hash, const SamplePtr &sample);
+
+private:
+    struct IndexEntry {
+        qint64 size = 0;
+        qint64 modified = 0;
+        QByteArray hash;
+    };
+
+    QString fileName(const QByteArray &hash, const QAudioFormat &format) const;
+    void readIndex();
+    void writeIndex() const;
+    void removeUnused(const QByteArray &hash);
+
+    QString m_directory;
+    QMutex m_mutex;
+    QHash<QString, IndexEntry> m_index;
+};
+
+#endif // PCMSTORE_H
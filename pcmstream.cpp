@@ -0,0 +1,241 @@
+#include "pcmstream.h"
+
+#include <QAudioBuffer>
+#include <QAudioDecoder>
+#include <QTimer>
+#include <QUrl>
+#include <QDebug>
+
+#include <algorithm>
+#include <cmath>
+
+PcmStream::PcmStream(const QAudioFormat &format, qint64 capacityFrames)
+    : m_format(format),
+    m_channels(format.channelCount()),
+    m_capacity(qMax<qint64>(1024, capacityFrames)),
+    m_ring(size_t(m_capacity) * size_t(m_channels)),
+    m_context(new QObject)
+{
+    // The render thread must not post events, so it leaves its requests in
+    // m_requests and the stream thread looks for them every PollMs.
+    QTimer *poll = new QTimer(m_context);
+    poll->setTimerType(Qt::PreciseTimer);
+    poll->setInterval(PollMs);
+    QObject::connect(poll, &QTimer::timeout, m_context, [this]() {
+        takeRequests();
+    });
+    m_context->moveToThread(&m_thread);
+    QObject::connect(&m_thread, &QThread::started, poll, QOverload<>::of(&QTimer::start));
+    QObject::connect(&m_thread, &QThread::finished, m_context, &QObject::deleteLater);
+    m_thread.setObjectName("AudioStream");
+    m_thread.start(QThread::HighPriority);
+}
+
+PcmStream::~PcmStream()
+{
+    // Lets a decoder waiting for room give up.
+    m_requested.fetch_add(1, std::memory_order_acq_rel);
+    m_thread.quit();
+    m_thread.wait();
+}
+
+void PcmStream::start(const SamplePtr &sample, qint64 frame)
+{
+    const quint64 generation = m_requested.fetch_add(1, std::memory_order_acq_rel) + 1;
+    m_requests.tryPush(Request { sample, frame, generation });
+}
+
+void PcmStream::stop()
+{
+    const quint64 generation = m_requested.fetch_add(1, std::memory_order_acq_rel) + 1;
+    m_requests.tryPush(Request { SamplePtr(), 0, generation });
+}
+
+bool PcmStream::isReady() const
+{
+    return m_ready.load(std::memory_order_acquire) == m_requested.load(std::memory_order_relaxed);
+}
+
+bool PcmStream::atEnd() const
+{
+    return isReady() && m_finished.load(std::memory_order_acquire)
+           && m_read.load(std::memory_order_relaxed) == m_written.load(std::memory_order_acquire);
+}
+
+qint64 PcmStream::read(float *out, qint64 frames)
+{
+    if(!isReady())
+        return 0;
+    const qint64 read = m_read.load(std::memory_order_relaxed);
+    const qint64 count = qMin(frames, m_written.load(std::memory_order_acquire) - read);
+    if(count <= 0)
+        return 0;
+    const qint64 offset = read % m_capacity;
+    const qint64 first = qMin(count, m_capacity - offset);
+    const float *ring = m_ring.data();
+    std::copy(ring + offset * m_channels, ring + (offset + first) * m_channels, out);
+    std::copy(ring, ring + (count - first) * m_channels, out + first * m_channels);
+    m_read.store(read + count, std::memory_order_release);
+    return count;
+}
+
+// Only the last request counts; the ones before it were superseded.
+void PcmStream::takeRequests()
+{
+    Request latest;
+    Request request;
+    while(m_requests.tryPop(&request))
+        latest = std::move(request);
+    if(!latest.generation)
+        return;
+    if(latest.sample)
+        restart(latest.sample, latest.frame, latest.generation);
+    else
+        halt(latest.generation);
+}
+
+void PcmStream::restart(const SamplePtr &sample, qint64 frame, quint64 generation)
+{
+    // A later start() or stop() has come in since.
+    if(generation != m_requested.load(std::memory_order_acquire))
+        return;
+
+    if(!m_decoder) {
+        m_decoder = new QAudioDecoder(m_context);
+        QObject::connect(m_decoder, &QAudioDecoder::bufferReady, m_context, [this]() {
+            decoded();
+        });
+        QObject::connect(m_decoder, &QAudioDecoder::finished, m_context, [this]() {
+            finished();
+        });
+        QObject::connect(m_decoder, QOverload<QAudioDecoder::Error>::of(&QAudioDecoder::error), m_context, [this]() {
+            qWarning() << "stream decoder failed:" << m_decoder->errorString();
+            finished();
+        });
+    }
+
+    m_generation = generation;
+    m_published = false;
+    m_written.store(0, std::memory_order_relaxed);
+    m_read.store(0, std::memory_order_relaxed);
+    m_finished.store(false, std::memory_order_relaxed);
+
+    // The decoder cannot seek. Forward in the same track it goes on from where
+    // it is; otherwise it decodes from the start and drops up to frame.
+    if(!m_decoder->isDecoding() || m_path != sample->path || frame < m_decoded) {
+        m_decoder->stop();
+        m_path = sample->path;
+        m_decoded = 0;
+        m_carry.clear();
+        m_phase = 0.0;
+        m_decoder->setAudioFormat(m_format);
+        m_decoder->setSource(QUrl::fromLocalFile(m_path));
+        m_decoder->start();
+    }
+    m_skip = frame - m_decoded;
+}
+
+void PcmStream::halt(quint64 generation)
+{
+    if(m_decoder && generation == m_requested.load(std::memory_order_acquire))
+        m_decoder->stop();
+}
+
+void PcmStream::decoded()
+{
+    const QAudioBuffer buffer = m_decoder->read();
+    if(!buffer.isValid())
+        return;
+
+    m_converted.resize(0);
+    SampleCache::appendFloatFrames(m_converted, buffer, m_channels);
+    const float *data = reinterpret_cast<const float *>(m_converted.constData());
+    qint64 frames = m_converted.size() / qint64(sizeof(float) * m_channels);
+    const int rate = buffer.format().sampleRate();
+    if(rate > 0 && rate != m_format.sampleRate())
+        data = resample(data, frames, rate, &frames);
+    // Counted even when a restart is queued, which may go on from here.
+    m_decoded += frames;
+    if(m_generation != m_requested.load(std::memory_order_acquire))
+        return;
+
+    const qint64 skipped = qMin(frames, m_skip);
+    m_skip -= skipped;
+    push(data + skipped * m_channels, frames - skipped);
+}
+
+void PcmStream::finished()
+{
+    // A finish left over from before the last restart.
+    if(m_decoder->isDecoding() || m_generation != m_requested.load(std::memory_order_acquire))
+        return;
+    m_finished.store(true, std::memory_order_release);
+    publish();
+}
+
+// Linear, like SampleCache::decode() does for a whole track, carried over
+// from one decoder buffer to the next.
+const float *PcmStream::resample(const float *in, qint64 frames, int fromRate, qint64 *outFrames)
+{
+    const double step = double(fromRate) / m_format.sampleRate();
+    // Source frame -1 is the last one of the previous buffer.
+    auto frameAt = [this, in](qint64 index) {
+        return index < 0 ? m_carry.data() : in + index * m_channels;
+    };
+
+    m_resampled.clear();
+    double position = m_phase;
+    while(position + 1 < frames) {
+        const qint64 index = qint64(std::floor(position));
+        const float fraction = float(position - index);
+        const float *a = frameAt(index);
+        const float *b = frameAt(index + 1);
+        for(int c = 0; c < m_channels; ++c)
+            m_resampled.push_back(a[c] + (b[c] - a[c]) * fraction);
+        position += step;
+    }
+    if(frames > 0) {
+        m_carry.assign(in + (frames - 1) * m_channels, in + frames * m_channels);
+        m_phase = position - frames;
+    }
+    *outFrames = qint64(m_resampled.size()) / m_channels;
+    return m_resampled.data();
+}
+
+// Waits for room while the render thread plays what is there; gives up as
+// soon as the stream is stopped or started again.
+void PcmStream::push(const float *data, qint64 frames)
+{
+    while(frames > 0) {
+        if(m_generation != m_requested.load(std::memory_order_acquire))
+            return;
+        const qint64 written = m_written.load(std::memory_order_relaxed);
+        const qint64 space = m_capacity - (written - m_read.load(std::memory_order_acquire));
+        if(space <= 0) {
+            publish();
+            QThread::msleep(2);
+            continue;
+        }
+        const qint64 count = qMin(frames, space);
+        const qint64 offset = written % m_capacity;
+        const qint64 first = qMin(count, m_capacity - offset);
+        float *ring = m_ring.data();
+        std::copy(data, data + first * m_channels, ring + offset * m_channels);
+        std::copy(data + first * m_channels, data + count * m_channels, ring);
+        m_written.store(written + count, std::memory_order_release);
+        data += count * m_channels;
+        frames -= count;
+    }
+    // After a seek past the head the voice is silent until here; a quarter of
+    // the ring is enough of a lead over the render thread.
+    if(m_written.load(std::memory_order_relaxed) >= m_capacity / 4)
+        publish();
+}
+
+void PcmStream::publish()
+{
+    if(m_published)
+        return;
+    m_published = true;
+    m_ready.store(m_generation, std::memory_order_release);
+}
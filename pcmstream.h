@@ -0,0 +1,98 @@
+#ifndef PCMSTREAM_H
+#define PCMSTREAM_H
+
+#include <QAudioFormat>
+#include <QByteArray>
+#include <QThread>
+
+#include <atomic>
+#include <vector>
+
+#include "samplecache.h"
+#include "spscqueue.h"
+
+class QAudioDecoder;
+
+// Plays the rest of a track whose Sample only holds the head, see
+// Sample::streamed. A decoder on the stream's own thread runs ahead into a
+// fixed ring of capacityFrames; when the ring is full it waits for the render
+// thread to catch up, so a voice never holds more than that, however long the
+// track. Every start() drops what is in the ring and decodes from the given
+// frame, which is how a voice seeks. The decoder cannot seek: going forward in
+// the track being decoded costs the frames up to the target, anything else
+// decodes from the start of the file, so that seek takes longer the further
+// into the track it goes.
+class PcmStream
+{
+public:
+    PcmStream(const QAudioFormat &format, qint64 capacityFrames);
+    ~PcmStream();
+
+    // Render thread, lock-free: the request goes through m_requests, which the
+    // stream thread polls. Delivers the track from frame on; read() returns
+    // nothing until the decoder has got there.
+    void start(const SamplePtr &sample, qint64 frame);
+    void stop();
+    // Render thread. Copies up to frames interleaved frames, fewer when the
+    // decoder is behind.
+    qint64 read(float *out, qint64 frames);
+    // The frames since the last start() are arriving.
+    bool isReady() const;
+    // Ready, decoded to the end and all of it read.
+    bool atEnd() const;
+
+    qint64 capacityFrames() const { return m_capacity; }
+
+private:
+    // A null sample stops the stream.
+    struct Request
+    {
+        SamplePtr sample;
+        qint64 frame = 0;
+        quint64 generation = 0;
+    };
+
+    // Far more than a voice asks for between two polls.
+    static constexpr int RequestCapacity = 64;
+    static constexpr int PollMs = 2;
+
+    // Stream thread only.
+    void takeRequests();
+    void restart(const SamplePtr &sample, qint64 frame, quint64 generation);
+    void halt(quint64 generation);
+    void decoded();
+    void finished();
+    const float *resample(const float *in, qint64 frames, int fromRate, qint64 *outFrames);
+    void push(const float *data, qint64 frames);
+    void publish();
+
+    QAudioFormat m_format;
+    int m_channels;
+    qint64 m_capacity;
+    std::vector<float> m_ring;
+    // Frames written and read since the last restart; the writer resets
+    // both while the reader waits for m_ready to catch up with m_requested.
+    std::atomic<qint64> m_written { 0 };
+    std::atomic<qint64> m_read { 0 };
+    std::atomic<quint64> m_requested { 0 };
+    std::atomic<quint64> m_ready { 0 };
+    std::atomic<bool> m_finished { false };
+    SpscQueue<Request> m_requests { RequestCapacity };
+
+    QThread m_thread;
+    QObject *m_context = nullptr;
+    // Stream thread only.
+    QAudioDecoder *m_decoder = nullptr;
+    quint64 m_generation = 0;
+    bool m_published = false;
+    QString m_path;
+    // Frames the decoder has delivered since it started on m_path.
+    qint64 m_decoded = 0;
+    qint64 m_skip = 0;
+    QByteArray m_converted;
+    std::vector<float> m_resampled;
+    std::vector<float> m_carry;
+    double m_phase = 0.0;
+};
+
+#endif // PCMSTREAM_H
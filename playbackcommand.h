@@ -0,0 +1,23 @@
+#ifndef PLAYBACKCOMMAND_H
+#define PLAYBACKCOMMAND_H
+
+#include "inputevent.h"
+
+// A change requested from the playback engine by one of the remote inputs.
+struct PlaybackCommand
+{
+    enum Type {
+        Trigger,
+        Stop,
+        StopAll,
+        MasterGain
+    };
+
+    Type type = Trigger;
+    int slot = -1;
+    float value = 1.0f;
+    InputSource source = InputSource::Http;
+    qint64 timestamp = 0;
+};
+
+#endif // PLAYBACKCOMMAND_H
@@ -0,0 +1,108 @@
+#include "playbackmodel.h"
+#include "audioengine.h"
+#include "eventjournal.h"
+#include "soundbank.h"
+
+#include <QMutexLocker>
+
+PlaybackModel::PlaybackModel(AudioEngine *engine, SoundBank *bank, QObject *parent)
+    : QObject(parent),
+    m_engine(engine),
+    m_bank(bank)
+{
+}
+
+bool PlaybackModel::play(int slot, qint64 timestamp, InputSource source)
+{
+    Request request;
+    request.type = Request::Play;
+    request.value = slot;
+    request.timestamp = timestamp;
+    request.source = source;
+    return apply({ request });
+}
+
+void PlaybackModel::setVolume(int volume, qint64 timestamp, InputSource source)
+{
+    Request request;
+    request.type = Request::Volume;
+    request.value = qBound(0, volume, 100);
+    request.timestamp = timestamp;
+    request.source = source;
+    apply({ request });
+}
+
+int PlaybackModel::volume() const
+{
+    return qRound(m_engine->masterGain() * 100);
+}
+
+bool PlaybackModel::seek(int slot, qint64 ms)
+{
+    if(!m_bank->contains(slot) || ms < 0)
+        return false;
+    m_engine->seek(slot, ms);
+    return true;
+}
+
+bool PlaybackModel::apply(const QList<Request> &requests, QString *errorString)
+{
+    QMutexLocker locker(&m_applyMutex);
+
+    for(const Request &request : requests) {
+        if(!validate(request, errorString))
+            return false;
+    }
+
+    QList<PlaybackCommand> commands;
+    commands.reserve(requests.size());
+    for(const Request &request : requests) {
+        PlaybackCommand command;
+        command.source = request.source;
+        command.timestamp = request.timestamp;
+        if(request.type == Request::Play) {
+            command.type = PlaybackCommand::Trigger;
+            command.slot = request.value;
+            if(!request.replayed)
+                EventJournal::instance().recordPlay(request.source, request.value, request.timestamp);
+        } else {
+            command.type = PlaybackCommand::MasterGain;
+            command.value = request.value / 100.0f;
+            if(!request.replayed)
+                EventJournal::instance().recordVolume(request.source, request.value, request.timestamp);
+        }
+        commands.append(command);
+    }
+    m_engine->submit(commands);
+    for(const Request &request : requests) {
+        if(request.type == Request::Play)
+            emit played(request.value);
+    }
+    return true;
+}
+
+bool PlaybackModel::validate(const Request &request, QString *errorString) const
+{
+    switch(request.type) {
+    case Request::Play:
+        if(!m_bank->contains(request.value)) {
+            if(errorString)
+                *errorString = QString("slot %1 is not in the bank").arg(request.value);
+            return false;
+        }
+        if(m_bank->path(request.value).isEmpty()) {
+            if(errorString)
+                *errorString = QString("slot %1 has no file").arg(request.value);
+            return false;
+        }
+        return true;
+    case Request::Volume:
+        if(request.value < 0 || request.value > 100) {
+            if(errorString)
+                *errorString = QString("volume %1 out of range").arg(request.value);
+            return false;
+        }
+        return true;
+    }
+    return false;
+}
@@ -0,0 +1,63 @@
+#ifndef PLAYBACKMODEL_H
+#define PLAYBACKMODEL_H
+
+#include <QObject>
+#include <QList>
+#include <QMutex>
+#include <QString>
+
+#include "inputevent.h"
+#include "playbackcommand.h"
+
+class AudioEngine;
+class SoundBank;
+
+// Thread-safe view of the playback state for remote control. The HTTP thread
+// reads and changes state here instead of going through the widgets.
+class PlaybackModel : public QObject
+{
+    Q_OBJECT
+
+public:
+    struct Request {
+        enum Type {
+            Play,
+            Volume
+        };
+        Type type = Play;
+        int value = 0;
+        qint64 timestamp = 0;
+        InputSource source = InputSource::Http;
+        // Played back from a journal; not journaled again.
+        bool replayed = false;
+    };
+
+    explicit PlaybackModel(AudioEngine *engine, SoundBank *bank, QObject *parent = nullptr);
+
+    SoundBank *bank() const { return m_bank; }
+    AudioEngine *engine() const { return m_engine; }
+
+    // timestamp is the InputEvent::now() time the request arrived.
+    bool play(int slot, qint64 timestamp = 0, InputSource source = InputSource::Http);
+    void setVolume(int volume, qint64 timestamp = 0, InputSource source = InputSource::Http);
+    int volume() const;
+    // Jumps a playing slot to ms into its track.
+    bool seek(int slot, qint64 ms);
+
+    // Validates every request first and applies none of them if one is
+    // invalid; otherwise they reach the engine in order in a single period.
+    bool apply(const QList<Request> &requests, QString *errorString = nullptr);
+
+signals:
+    // Emitted from the calling thread for every play request submitted.
+    void played(int slot);
+
+private:
+    bool validate(const Request &request, QString *errorString) const;
+
+    AudioEngine *m_engine;
+    SoundBank *m_bank;
+    QMutex m_applyMutex;
+};
+
+#endif // PLAYBACKMODEL_H
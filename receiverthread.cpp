@@ -0,0 +1,315 @@
+#include "receiverthread.h"
+#include "commandbus.h"
+#include "eventjournal.h"
+
+#include <QMutexLocker>
+#include <QSerialPortInfo>
+#include <QTimer>
+#include <QtAlgorithms>
+#include <QDebug>
+
+ReceiverThread::ReceiverThread(const QVector<InputRoute> &routes, QObject *parent)
+    : QThread(parent),
+    m_routes(routes)
+{
+    setObjectName("SerialReceiver");
+}
+
+ReceiverThread::ReceiverThread(SpscQueue<InputEvent> *queue, QObject *parent)
+    : ReceiverThread(QVector<InputRoute> { InputRoute { queue } }, parent)
+{
+}
+
+ReceiverThread::~ReceiverThread()
+{
+    stopReceiver();
+}
+
+void ReceiverThread::startReceiver(const QString &portName, qint32 baudRate)
+{
+    stopReceiver();
+    {
+        QMutexLocker locker(&m_countersMutex);
+        m_portName = portName;
+    }
+    m_baudRate = baudRate;
+    m_injecting = false;
+    m_hasIdentity = false;
+    m_lostAt = 0;
+    start(QThread::HighPriority);
+}
+
+void ReceiverThread::stopReceiver()
+{
+    if(!isRunning())
+        return;
+    quit();
+    wait();
+}
+
+void ReceiverThread::setReconnect(bool enabled, int maxBackoffMs)
+{
+    m_reconnect = enabled;
+    m_maxBackoffMs = qMax(InitialBackoffMs, maxBackoffMs);
+}
+
+void ReceiverThread::setSlotMap(const QVector<int> &map)
+{
+    QMutexLocker locker(&m_countersMutex);
+    m_pendingSlotMap = map;
+}
+
+QString ReceiverThread::portName() const
+{
+    QMutexLocker locker(&m_countersMutex);
+    return m_portName;
+}
+
+FrameParser::Counters ReceiverThread::parserCounters() const
+{
+    QMutexLocker locker(&m_countersMutex);
+    return m_counters;
+}
+
+SpscQueue<InputEvent>::Counters ReceiverThread::queueCounters() const
+{
+    SpscQueue<InputEvent>::Counters total;
+    for(const InputRoute &route : m_routes) {
+        const SpscQueue<InputEvent>::Counters counters = route.queue->counters();
+        total.pushed += counters.pushed;
+        total.popped += counters.popped;
+        total.overflows += counters.overflows;
+        total.dropped += counters.dropped;
+        total.highWater = qMax(total.highWater, counters.highWater);
+    }
+    return total;
+}
+
+void ReceiverThread::applySlotMap()
+{
+    QMutexLocker locker(&m_countersMutex);
+    m_identityMap = m_pendingSlotMap.isEmpty();
+    m_slotMap.fill(-1);
+    for(int button = 0; button < qMin(int(m_slotMap.size()), int(m_pendingSlotMap.size())); ++button) {
+        const int slot = m_pendingSlotMap.at(button);
+        if(slot >= 0 && slot < int(m_slotMap.size()))
+            m_slotMap[size_t(button)] = qint8(slot);
+    }
+}
+
+void ReceiverThread::prepareInjection()
+{
+    stopReceiver();
+    applySlotMap();
+    m_parser.reset();
+    // reset() drops the next line as a possible fragment; end it right away.
+    m_parser.feed("\n", 1, [](const FrameParser::Frame &) {});
+    m_lastVolume = -1;
+    m_injecting = true;
+}
+
+void ReceiverThread::inject(const char *data, qsizetype size)
+{
+    m_readTimestamp = InputEvent::now();
+    m_parser.feed(data, size, [this](const FrameParser::Frame &frame) {
+        handleFrame(frame);
+    });
+
+    QMutexLocker locker(&m_countersMutex);
+    m_counters = m_parser.counters();
+}
+
+void ReceiverThread::run()
+{
+    applySlotMap();
+
+    QSerialPort serial;
+    serial.setBaudRate(m_baudRate);
+    QTimer retryTimer;
+    retryTimer.setSingleShot(true);
+    int backoffMs = InitialBackoffMs;
+
+    connect(&serial, &QSerialPort::readyRead, &serial, [this, &serial]() {
+        readAvailable(serial);
+    }, Qt::DirectConnection);
+    connect(&serial, &QSerialPort::errorOccurred, &serial, [this, &serial, &retryTimer, &backoffMs](QSerialPort::SerialPortError error) {
+        if(error == QSerialPort::NoError)
+            return;
+        m_serialErrors.fetch_add(1, std::memory_order_relaxed);
+        emit errorOccurred(error, serial.errorString());
+        // ResourceError is how an unplugged device shows up. Closing is left
+        // to the event loop, not done from inside the port's own signal.
+        if(error != QSerialPort::ResourceError || !m_reconnect)
+            return;
+        QMetaObject::invokeMethod(&serial, [this, &serial, &retryTimer, &backoffMs]() {
+            if(!serial.isOpen())
+                return;
+            serial.close();
+            m_lostAt = InputEvent::now();
+            backoffMs = InitialBackoffMs;
+            qWarning() << "serial port" << portName() << "lost, reconnecting";
+            emit disconnected(portName());
+            retryTimer.start(backoffMs);
+        }, Qt::QueuedConnection);
+    }, Qt::DirectConnection);
+    connect(&retryTimer, &QTimer::timeout, &serial, [this, &serial, &retryTimer, &backoffMs]() {
+        const QStringList candidates = candidatePorts();
+        for(const QString &candidate : candidates) {
+            if(openPort(serial, candidate)) {
+                if(m_lostAt)
+                    m_reconnects.fetch_add(1, std::memory_order_relaxed);
+                emit opened(candidate, m_baudRate);
+                return;
+            }
+        }
+        backoffMs = qMin(backoffMs * 2, m_maxBackoffMs);
+        retryTimer.start(backoffMs);
+    }, Qt::DirectConnection);
+
+    if(openPort(serial, m_portName)) {
+        emit opened(m_portName, m_baudRate);
+    } else {
+        emit openFailed(m_portName, serial.errorString());
+        if(!m_reconnect)
+            return;
+        retryTimer.start(backoffMs);
+    }
+
+    exec();
+
+    serial.close();
+}
+
+bool ReceiverThread::openPort(QSerialPort &serial, const QString &portName)
+{
+    serial.setPortName(portName);
+    if(!serial.open(QIODevice::ReadWrite))
+        return false;
+
+    {
+        QMutexLocker locker(&m_countersMutex);
+        m_portName = portName;
+    }
+    const QSerialPortInfo info(serial);
+    if(!m_hasIdentity && info.hasVendorIdentifier() && info.hasProductIdentifier()) {
+        m_hasIdentity = true;
+        m_vendorId = info.vendorIdentifier();
+        m_productId = info.productIdentifier();
+        m_serialNumber = info.serialNumber();
+    }
+    resync(serial);
+    return true;
+}
+
+// Ports that may be this board, the one it was last seen on first. It can
+// come back under another name, e.g. ttyUSB1 instead of ttyUSB0. Without a USB
+// identity only the configured name is tried.
+QStringList ReceiverThread::candidatePorts() const
+{
+    const QString current = portName();
+    if(!m_hasIdentity)
+        return { current };
+
+    QStringList candidates;
+    const QList<QSerialPortInfo> ports = QSerialPortInfo::availablePorts();
+    for(const QSerialPortInfo &info : ports) {
+        if(!info.hasVendorIdentifier() || info.vendorIdentifier() != m_vendorId
+           || !info.hasProductIdentifier() || info.productIdentifier() != m_productId)
+            continue;
+        if(!m_serialNumber.isEmpty() && info.serialNumber() != m_serialNumber)
+            continue;
+        if(info.portName() == current || info.systemLocation() == current)
+            candidates.prepend(current);
+        else
+            candidates.append(info.portName());
+    }
+    return candidates;
+}
+
+// Whatever was buffered before the port was (re)opened may end in the middle
+// of a frame or be stale; it is dropped and the parser skips to the next line
+// end, so the first frame dispatched is a complete, current one.
+void ReceiverThread::resync(QSerialPort &serial)
+{
+    serial.clear(QSerialPort::Input);
+    m_parser.reset();
+    m_lastVolume = -1;
+}
+
+void ReceiverThread::readAvailable(QSerialPort &serial)
+{
+    m_readTimestamp = InputEvent::now();
+
+    qsizetype space = 0;
+    while(char *buffer = m_parser.writePointer(&space)) {
+        const qint64 count = serial.read(buffer, space);
+        if(count <= 0)
+            break;
+        m_parser.commit(count);
+        m_parser.parse([this](const FrameParser::Frame &frame) {
+            handleFrame(frame);
+        });
+    }
+
+    QMutexLocker locker(&m_countersMutex);
+    m_counters = m_parser.counters();
+}
+
+void ReceiverThread::handleFrame(const FrameParser::Frame &frame)
+{
+    if(!m_injecting)
+        EventJournal::instance().recordFrame(m_board, frame.id, frame.value, m_readTimestamp);
+
+    if(m_lostAt) {
+        const qint64 recoveryNs = m_readTimestamp - m_lostAt;
+        m_lostAt = 0;
+        m_lastRecoveryNs.store(recoveryNs, std::memory_order_relaxed);
+        emit recovered(portName(), recoveryNs);
+    }
+
+    InputEvent event;
+    event.timestamp = m_readTimestamp;
+
+    // Buttons pressed in the same frame arrive as one trigger per output, each
+    // mixer starts its part of them in the same period.
+    const quint64 pressed = mapButtons(frame.id) & m_slotMask.load(std::memory_order_relaxed);
+    if(pressed) {
+        event.type = InputEvent::Trigger;
+        event.dispatched = InputEvent::now();
+        for(const InputRoute &route : std::as_const(m_routes)) {
+            event.slotBits = pressed & route.slotMask;
+            event.sequence = route.bus ? route.bus->claimed() : 0;
+            if(event.slotBits)
+                route.queue->push(event);
+        }
+        emit triggered(pressed);
+    }
+
+    // The board repeats the pot position in every frame; only changes are queued.
+    // The pot reads 0..255, but the frame allows nine digits.
+    const int volume = qBound(0, frame.value, 255) * 100 / 255;
+    if((frame.id == 0 || pressed) && volume != m_lastVolume) {
+        m_lastVolume = volume;
+        event.type = InputEvent::Volume;
+        event.slotBits = 0;
+        event.value = volume;
+        event.dispatched = InputEvent::now();
+        for(const InputRoute &route : std::as_const(m_routes)) {
+            event.sequence = route.bus ? route.bus->claimed() : 0;
+            route.queue->push(event);
+        }
+    }
+}
+
+quint64 ReceiverThread::mapButtons(quint64 buttons) const
+{
+    if(m_identityMap)
+        return buttons;
+    quint64 mapped = 0;
+    for(; buttons; buttons &= buttons - 1) {
+        const int slot = m_slotMap[qCountTrailingZeroBits(buttons)];
+        if(slot >= 0)
+            mapped |= quint64(1) << slot;
+    }
+    return mapped;
+}
@@ -0,0 +1,119 @@
+#ifndef RECEIVERTHREAD_H
+#define RECEIVERTHREAD_H
+
+#include <QThread>
+#include <QMutex>
+#include <QSerialPort>
+#include <QStringList>
+#include <QVector>
+
+#include <array>
+#include <atomic>
+
+#include "frameparser.h"
+#include "inputevent.h"
+#include "spscqueue.h"
+
+// Owns the serial port on its own thread. Frames are parsed there and pushed
+// as InputEvents into the queues the audio engine drains, so button presses do
+// not wait for the GUI event loop. With several audio outputs a trigger is
+// split by slot into the queue of each output, see AudioEngine::inputRoutes().
+// When the port goes away (cable pulled) the thread keeps looking for the same
+// board, by USB vendor/product id and serial number, and reopens it with a
+// backoff of at most maxBackoffMs.
+class ReceiverThread : public QThread
+{
+    Q_OBJECT
+
+public:
+    explicit ReceiverThread(const QVector<InputRoute> &routes, QObject *parent = nullptr);
+    explicit ReceiverThread(SpscQueue<InputEvent> *queue, QObject *parent = nullptr);
+    ~ReceiverThread();
+
+    void startReceiver(const QString &portName, qint32 baudRate);
+    void stopReceiver();
+
+    // Replay support: feeds bytes through the parser and dispatch exactly as
+    // if they had been read from the port. Only while the receiver is
+    // stopped; the calling thread then is the queue's only producer. Injected
+    // frames are not journaled again.
+    void prepareInjection();
+    void inject(const char *data, qsizetype size);
+
+    // Button n of this board triggers slot map[n]; buttons without an entry
+    // (or mapped to -1) are ignored. An empty map keeps button n on slot n.
+    // Takes effect at the next startReceiver().
+    void setSlotMap(const QVector<int> &map);
+    // Index of this board in the event journal.
+    void setBoard(int board) { m_board = board; }
+    int board() const { return m_board; }
+    // Slots outside the mask are ignored, see SoundBank::slotMask().
+    void setSlotMask(quint64 mask) { m_slotMask.store(mask, std::memory_order_relaxed); }
+    // Takes effect at the next startReceiver().
+    void setReconnect(bool enabled, int maxBackoffMs);
+
+    QString portName() const;
+    FrameParser::Counters parserCounters() const;
+    quint64 serialErrors() const { return m_serialErrors.load(std::memory_order_relaxed); }
+    quint64 reconnects() const { return m_reconnects.load(std::memory_order_relaxed); }
+    // From losing the port to the first frame after reopening it, 0 before the first recovery.
+    qint64 lastRecoveryNs() const { return m_lastRecoveryNs.load(std::memory_order_relaxed); }
+    // Summed over the routes, highWater is the deepest of them.
+    SpscQueue<InputEvent>::Counters queueCounters() const;
+
+signals:
+    void opened(const QString &portName, qint32 baudRate);
+    void openFailed(const QString &portName, const QString &errorString);
+    void errorOccurred(QSerialPort::SerialPortError error, const QString &errorString);
+    // The port went away; opened() follows once it is back.
+    void disconnected(const QString &portName);
+    // The first frame arrived after a reconnect.
+    void recovered(const QString &portName, qint64 recoveryNs);
+    // After the trigger has been queued for the mixer.
+    void triggered(quint64 slotBits);
+
+protected:
+    void run() override;
+
+private:
+    static constexpr int InitialBackoffMs = 50;
+
+    bool openPort(QSerialPort &serial, const QString &portName);
+    QStringList candidatePorts() const;
+    void resync(QSerialPort &serial);
+    void readAvailable(QSerialPort &serial);
+    void handleFrame(const FrameParser::Frame &frame);
+    quint64 mapButtons(quint64 buttons) const;
+    void applySlotMap();
+
+    QVector<InputRoute> m_routes;
+    QString m_portName;
+    qint32 m_baudRate = 0;
+    FrameParser m_parser;
+    qint64 m_readTimestamp = 0;
+    int m_lastVolume = -1;
+    // Between prepareInjection() and the next startReceiver().
+    bool m_injecting = false;
+    int m_board = 0;
+    std::atomic<quint64> m_slotMask { ~quint64(0) };
+    std::atomic<quint64> m_serialErrors { 0 };
+    std::atomic<quint64> m_reconnects { 0 };
+    std::atomic<qint64> m_lastRecoveryNs { 0 };
+    bool m_reconnect = true;
+    int m_maxBackoffMs = 2000;
+    // Receiver thread only: what identifies the board, and when it was lost.
+    bool m_hasIdentity = false;
+    quint16 m_vendorId = 0;
+    quint16 m_productId = 0;
+    QString m_serialNumber;
+    qint64 m_lostAt = 0;
+    // Only read on the receiver thread, copied from m_pendingSlotMap in run().
+    std::array<qint8, 64> m_slotMap;
+    bool m_identityMap = true;
+
+    mutable QMutex m_countersMutex;
+    FrameParser::Counters m_counters;
+    QVector<int> m_pendingSlotMap;
+};
+
+#endif // RECEIVERTHREAD_H
@@ -0,0 +1,377 @@
+#include "samplecache.h"
+#include "pcmstore.h"
+
+#include <QAudioBuffer>
+#include <QAudioDecoder>
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QList>
+#include <QPointer>
+#include <QSettings>
+#include <QThreadPool>
+#include <QTimer>
+#include <QUrl>
+#include <QDebug>
+
+#include <cmath>
+
+SampleCache::SampleCache(const QAudioFormat &format, QObject *parent)
+    : QObject(parent),
+    m_format(format),
+    m_warmTimer(new QTimer(this))
+{
+    connect(m_warmTimer, &QTimer::timeout, this, &SampleCache::warmHeads);
+    m_warmTimer->start(10000);
+}
+
+void SampleCache::readSettings(QSettings &settings)
+{
+    settings.beginGroup("Cache");
+    setMemoryBudget(settings.value("budgetMB", 256).toLongLong() * 1024 * 1024);
+    if(settings.value("store", true).toBool())
+        setStore(QSharedPointer<PcmStore>::create(settings.value("storeDir", PcmStore::defaultDirectory()).toString()));
+    else
+        setStore(QSharedPointer<PcmStore>());
+    setWarming(settings.value("warmHeadMs", m_warmHeadMs).toInt(), settings.value("warmIntervalSeconds", 10).toInt());
+    setHeatHalfLife(settings.value("heatHalfLife", m_heatHalfLife).toInt());
+    setStreaming(settings.value("streamAboveSeconds", m_streamAboveSeconds).toInt(),
+                 settings.value("streamHeadMs", m_streamHeadMs).toInt());
+    settings.endGroup();
+}
+
+void SampleCache::setStreaming(int aboveSeconds, int headMs)
+{
+    m_streamAboveSeconds = qMax(0, aboveSeconds);
+    m_streamHeadMs = qBound(0, headMs, m_streamAboveSeconds * 1000);
+}
+
+void SampleCache::setWarming(int headMs, int intervalSeconds)
+{
+    m_warmHeadMs = qMax(0, headMs);
+    if(m_warmHeadMs > 0 && intervalSeconds > 0)
+        m_warmTimer->start(intervalSeconds * 1000);
+    else
+        m_warmTimer->stop();
+}
+
+void SampleCache::setMemoryBudget(qint64 bytes)
+{
+    m_budget = qMax<qint64>(0, bytes);
+    evict(0);
+}
+
+void SampleCache::load(int slot, const QString &path)
+{
+    if(path.isEmpty()) {
+        m_slots.remove(slot);
+        return;
+    }
+
+    m_slots.insert(slot, path);
+
+    auto it = m_entries.find(path);
+    if(it != m_entries.end()) {
+        warm(it->sample, headBytes());
+        emit sampleReady(slot, path);
+        return;
+    }
+
+    decodeAsync(path);
+}
+
+SamplePtr SampleCache::acquire(int slot)
+{
+    SlotStats &stats = m_stats[slot];
+    const QString path = m_slots.value(slot);
+
+    auto it = m_entries.find(path);
+    if(path.isEmpty() || it == m_entries.end()) {
+        ++stats.misses;
+        if(!path.isEmpty())
+            decodeAsync(path);
+        return SamplePtr();
+    }
+
+    ++stats.hits;
+    return it->sample;
+}
+
+void SampleCache::recordPlay(int slot)
+{
+    ++m_stats[slot].plays;
+    auto it = m_entries.find(m_slots.value(slot));
+    if(it == m_entries.end())
+        return;
+    ++m_clock;
+    it->heat = heat(*it) + 1.0;
+    it->heatedAt = m_clock;
+}
+
+double SampleCache::heat(const Entry &entry) const
+{
+    return entry.heat * std::exp2(-double(m_clock - entry.heatedAt) / m_heatHalfLife);
+}
+
+void SampleCache::decodeAsync(const QString &path)
+{
+    if(m_pending.contains(path))
+        return;
+    m_pending.insert(path);
+
+    const QAudioFormat format = m_format;
+    const QSharedPointer<PcmStore> store = m_store;
+    const qint64 streamAboveFrames = qint64(m_streamAboveSeconds) * format.sampleRate();
+    const qint64 headFrames = qint64(m_streamHeadMs) * format.sampleRate() / 1000;
+    QPointer<SampleCache> self(this);
+    QThreadPool::globalInstance()->start([self, path, format, store, streamAboveFrames, headFrames]() {
+        QString errorString;
+        QByteArray hash;
+        SamplePtr sample;
+        if(store) {
+            hash = store->contentHash(path);
+            sample = store->load(hash, path, format);
+        }
+        const bool decoded = !sample;
+        if(decoded) {
+            sample = decode(path, format, &errorString, streamAboveFrames, headFrames);
+            // Only whole tracks go to the store; a head is quick to decode again.
+            // It still carries the hash, which keys the loudness cache.
+            if(sample && store && !sample->streamed) {
+                sample = store->save(hash, sample);
+            } else if(sample && store) {
+                auto head = QSharedPointer<Sample>::create(*sample);
+                head->hash = hash;
+                sample = head;
+            }
+        }
+        if(!self)
+            return;
+        QMetaObject::invokeMethod(self, [self, path, sample, decoded, errorString]() {
+            self->m_pending.remove(path);
+            if(sample) {
+                if(decoded)
+                    ++self->m_decodes;
+                else
+                    ++self->m_storeLoads;
+                self->insert(path, sample);
+                return;
+            }
+            qDebug() << "failed to decode" << path << errorString;
+            for(auto it = self->m_slots.cbegin(); it != self->m_slots.cend(); ++it) {
+                if(it.value() == path)
+                    emit self->sampleFailed(it.key(), path, errorString);
+            }
+        }, Qt::QueuedConnection);
+    });
+}
+
+void SampleCache::insert(const QString &path, const SamplePtr &sample)
+{
+    const qint64 size = sample->pcm.size();
+    if(size > m_budget) {
+        qDebug() << "sample" << path << "exceeds cache budget" << size << ">" << m_budget;
+        return;
+    }
+
+    evict(size);
+
+    Entry entry;
+    entry.sample = sample;
+    entry.heatedAt = m_clock;
+    m_entries.insert(path, entry);
+    m_usage += size;
+    warm(sample, headBytes());
+
+    for(auto it = m_slots.cbegin(); it != m_slots.cend(); ++it) {
+        if(it.value() == path)
+            emit sampleReady(it.key(), path);
+    }
+}
+
+void SampleCache::evict(qint64 required)
+{
+    const QSet<QString> referenced(m_slots.cbegin(), m_slots.cend());
+    while(!m_entries.isEmpty() && m_usage + required > m_budget) {
+        auto coldest = m_entries.begin();
+        bool coldestReferenced = referenced.contains(coldest.key());
+        double coldestHeat = heat(*coldest);
+        for(auto it = std::next(m_entries.begin()); it != m_entries.end(); ++it) {
+            const bool itReferenced = referenced.contains(it.key());
+            const double itHeat = heat(*it);
+            if(itReferenced < coldestReferenced || (itReferenced == coldestReferenced && itHeat < coldestHeat)) {
+                coldest = it;
+                coldestReferenced = itReferenced;
+                coldestHeat = itHeat;
+            }
+        }
+        const QString path = coldest.key();
+        qDebug() << "evicting" << path << "from sample cache, heat" << coldestHeat;
+        m_usage -= coldest->sample->pcm.size();
+        m_entries.erase(coldest);
+        for(auto it = m_slots.cbegin(); it != m_slots.cend(); ++it) {
+            if(it.value() == path)
+                emit sampleEvicted(it.key(), path);
+        }
+    }
+}
+
+qsizetype SampleCache::headBytes() const
+{
+    return qsizetype(m_format.bytesPerFrame()) * m_format.sampleRate() * m_warmHeadMs / 1000;
+}
+
+// A page that has to come back from the disk would stall the GUI thread, so
+// the pass runs on the pool; the samples it holds keep their mappings alive.
+void SampleCache::warmHeads()
+{
+    if(m_warming)
+        return;
+
+    QList<SamplePtr> samples;
+    const QSet<QString> paths(m_slots.cbegin(), m_slots.cend());
+    for(const QString &path : paths) {
+        const SamplePtr sample = m_entries.value(path).sample;
+        if(sample)
+            samples.append(sample);
+    }
+    if(samples.isEmpty())
+        return;
+
+    m_warming = true;
+    const qsizetype bytes = headBytes();
+    QPointer<SampleCache> self(this);
+    QThreadPool::globalInstance()->start([self, samples, bytes]() {
+        QElapsedTimer timer;
+        timer.start();
+        qint64 pages = 0;
+        for(const SamplePtr &sample : samples)
+            pages += warm(sample, bytes);
+        const qint64 elapsed = timer.nsecsElapsed();
+        if(!self)
+            return;
+        QMetaObject::invokeMethod(self, [self, pages, elapsed]() {
+            self->m_warming = false;
+            self->m_warmedPages = pages;
+            self->m_warmNs = elapsed;
+        }, Qt::QueuedConnection);
+    });
+}
+
+// Mapped samples are read from the page cache, which the kernel may have
+// dropped while the slot sat unused; the first period after a trigger would
+// then wait for the disk on the render thread.
+qint64 SampleCache::warm(const SamplePtr &sample, qsizetype bytes)
+{
+    if(!sample || bytes <= 0)
+        return 0;
+    constexpr qsizetype PageSize = 4096;
+    const volatile char *data = sample->pcm.constData();
+    const qsizetype size = qMin(bytes, sample->pcm.size());
+    qint64 pages = 0;
+    for(qsizetype offset = 0; offset < size; offset += PageSize, ++pages)
+        (void)data[offset];
+    return pages;
+}
+
+void SampleCache::appendFloatFrames(QByteArray &pcm, const QAudioBuffer &buffer, int channels)
+{
+    const QAudioFormat source = buffer.format();
+    const char *data = buffer.constData<char>();
+    const qsizetype frames = buffer.frameCount();
+    const int sourceChannels = source.channelCount();
+    const int bytesPerFrame = source.bytesPerFrame();
+    const int bytesPerSample = source.bytesPerSample();
+
+    const qsizetype offset = pcm.size();
+    pcm.resize(offset + frames * channels * qsizetype(sizeof(float)));
+    float *out = reinterpret_cast<float *>(pcm.data() + offset);
+
+    for(qsizetype i = 0; i < frames; ++i) {
+        const char *frame = data + i * bytesPerFrame;
+        for(int c = 0; c < channels; ++c) {
+            const int sourceChannel = qMin(c, sourceChannels - 1);
+            *out++ = source.normalizedSampleValue(frame + sourceChannel * bytesPerSample);
+        }
+    }
+}
+
+namespace {
+
+QByteArray resampleLinear(const QByteArray &pcm, int channels, int fromRate, int toRate)
+{
+    const float *in = reinterpret_cast<const float *>(pcm.constData());
+    const qsizetype inFrames = pcm.size() / qsizetype(sizeof(float) * channels);
+    const qsizetype outFrames = qsizetype(double(inFrames) * toRate / fromRate);
+    const double step = double(fromRate) / toRate;
+
+    QByteArray result(outFrames * channels * qsizetype(sizeof(float)), Qt::Uninitialized);
+    float *out = reinterpret_cast<float *>(result.data());
+    for(qsizetype i = 0; i < outFrames; ++i) {
+        const double position = i * step;
+        const qsizetype index = qsizetype(position);
+        const float fraction = float(position - index);
+        const qsizetype next = qMin(index + 1, inFrames - 1);
+        for(int c = 0; c < channels; ++c) {
+            const float a = in[index * channels + c];
+            const float b = in[next * channels + c];
+            *out++ = a + (b - a) * fraction;
+        }
+    }
+    return result;
+}
+
+} // namespace
+
+// Decodes the whole file into interleaved float PCM with the channel count and
+// sample rate of the given format, whatever the decoder backend hands out.
+SamplePtr SampleCache::decode(const QString &path, const QAudioFormat &format, QString *errorString,
+                              qint64 streamAboveFrames, qint64 headFrames)
+{
+    QAudioDecoder decoder;
+    decoder.setAudioFormat(format);
+    decoder.setSource(QUrl::fromLocalFile(path));
+
+    auto sample = QSharedPointer<Sample>::create();
+    sample->path = path;
+    sample->format = format;
+
+    const int channels = format.channelCount();
+    int sourceRate = format.sampleRate();
+    bool failed = false;
+    QEventLoop loop;
+    QObject::connect(&decoder, &QAudioDecoder::bufferReady, &loop, [&]() {
+        const QAudioBuffer buffer = decoder.read();
+        if(!buffer.isValid() || sample->streamed)
+            return;
+        sourceRate = buffer.format().sampleRate();
+        appendFloatFrames(sample->pcm, buffer, channels);
+        // Frame counts are at the source rate until the end.
+        const qint64 frames = sample->pcm.size() / qint64(sizeof(float) * channels);
+        if(streamAboveFrames > 0 && sourceRate > 0
+           && frames * format.sampleRate() > streamAboveFrames * sourceRate) {
+            sample->streamed = true;
+            sample->pcm.truncate(qsizetype(headFrames * sourceRate / format.sampleRate()) * channels * qsizetype(sizeof(float)));
+            decoder.stop();
+            loop.quit();
+        }
+    });
+    QObject::connect(&decoder, &QAudioDecoder::finished, &loop, &QEventLoop::quit);
+    QObject::connect(&decoder, QOverload<QAudioDecoder::Error>::of(&QAudioDecoder::error), &loop, [&]() {
+        failed = true;
+        if(errorString)
+            *errorString = decoder.errorString();
+        loop.quit();
+    });
+
+    decoder.start();
+    loop.exec();
+
+    if(failed || sample->pcm.isEmpty())
+        return SamplePtr();
+
+    if(sourceRate > 0 && sourceRate != format.sampleRate())
+        sample->pcm = resampleLinear(sample->pcm, channels, sourceRate, format.sampleRate());
+
+    sample->pcm.squeeze();
+    return sample;
+}
@@ -0,0 +1,143 @@
+#ifndef SAMPLECACHE_H
+#define SAMPLECACHE_H
+
+#include <QObject>
+#include <QAudioFormat>
+#include <QByteArray>
+#include <QHash>
+#include <QSet>
+#include <QSharedPointer>
+#include <QString>
+
+class QAudioBuffer;
+class QFile;
+class QSettings;
+class QTimer;
+class PcmStore;
+
+struct Sample
+{
+    QString path;
+    QAudioFormat format;
+    QByteArray pcm;
+    // Content hash of the source file, empty when there is no PcmStore.
+    QByteArray hash;
+    // Set when pcm points into a mapped PcmStore file; keeps the mapping alive.
+    QSharedPointer<QFile> mapping;
+    // pcm is only the head of a track too long to keep decoded; the mixer
+    // streams the rest from path, see PcmStream.
+    bool streamed = false;
+};
+
+using SamplePtr = QSharedPointer<const Sample>;
+
+// Keeps the configured button files decoded to PCM so a trigger does not have
+// to open and decode the file again. Decoding runs on the global thread pool,
+// the cache itself is only touched from the thread that owns it. With a store
+// set, decoded PCM is persisted and mapped from there on the next start.
+//
+// Over budget, samples no slot refers to go first, then the coldest: every
+// play heats a sample up and the heat halves every heatHalfLife plays of any
+// slot, so both the last played and the most played slots stay. The head of
+// every slot's sample is touched regularly so a mapped sample's first period
+// does not wait for the disk.
+class SampleCache : public QObject
+{
+    Q_OBJECT
+
+public:
+    struct SlotStats {
+        quint64 hits = 0;
+        quint64 misses = 0;
+        quint64 plays = 0;
+    };
+
+    explicit SampleCache(const QAudioFormat &format, QObject *parent = nullptr);
+
+    // Cache/budgetMB, Cache/store, Cache/storeDir, Cache/warmHeadMs,
+    // Cache/warmIntervalSeconds, Cache/heatHalfLife, Cache/streamAboveSeconds,
+    // Cache/streamHeadMs.
+    void readSettings(QSettings &settings);
+    void setStore(const QSharedPointer<PcmStore> &store) { m_store = store; }
+    void setMemoryBudget(qint64 bytes);
+    qint64 memoryBudget() const { return m_budget; }
+    qint64 memoryUsage() const { return m_usage; }
+
+    // Length of the head kept warm, 0 to stop warming.
+    void setWarming(int headMs, int intervalSeconds);
+    void setHeatHalfLife(int plays) { m_heatHalfLife = qMax(1, plays); }
+    // Tracks longer than aboveSeconds keep only headMs decoded and are
+    // streamed from there; 0 decodes everything.
+    void setStreaming(int aboveSeconds, int headMs);
+
+    void load(int slot, const QString &path);
+    SamplePtr acquire(int slot);
+    // Every trigger of the slot, whichever input it came from and whether or
+    // not the slot is already playing.
+    void recordPlay(int slot);
+    // Like acquire() but without touching the statistics or the LRU order.
+    SamplePtr sample(int slot) const { return m_entries.value(m_slots.value(slot)).sample; }
+    QString path(int slot) const { return m_slots.value(slot); }
+    SlotStats stats(int slot) const { return m_stats.value(slot); }
+    // Samples mapped from the store and samples decoded from source files.
+    quint64 storeLoads() const { return m_storeLoads; }
+    quint64 decodes() const { return m_decodes; }
+
+    // Pages touched by the last warming pass and how long it took.
+    qint64 warmedPages() const { return m_warmedPages; }
+    qint64 warmNs() const { return m_warmNs; }
+
+    // With streamAboveFrames set, a longer track is cut to headFrames and
+    // marked streamed.
+    static SamplePtr decode(const QString &path, const QAudioFormat &format, QString *errorString = nullptr,
+                            qint64 streamAboveFrames = 0, qint64 headFrames = 0);
+    // Appends the buffer as interleaved float frames with the given channel
+    // count. Mono sources are duplicated, extra channels dropped.
+    static void appendFloatFrames(QByteArray &pcm, const QAudioBuffer &buffer, int channels);
+    // Reads one byte per page of the first bytes of the PCM so they are
+    // resident; returns the pages touched.
+    static qint64 warm(const SamplePtr &sample, qsizetype bytes);
+
+signals:
+    void sampleReady(int slot, const QString &path);
+    void sampleFailed(int slot, const QString &path, const QString &errorString);
+    void sampleEvicted(int slot, const QString &path);
+
+private:
+    struct Entry {
+        SamplePtr sample;
+        double heat = 0.0;
+        // m_clock when heat was last brought up to date.
+        quint64 heatedAt = 0;
+    };
+
+    void decodeAsync(const QString &path);
+    void insert(const QString &path, const SamplePtr &sample);
+    void evict(qint64 required);
+    double heat(const Entry &entry) const;
+    qsizetype headBytes() const;
+    void warmHeads();
+
+    QAudioFormat m_format;
+    QSharedPointer<PcmStore> m_store;
+    quint64 m_storeLoads = 0;
+    quint64 m_decodes = 0;
+    qint64 m_budget = 256 * 1024 * 1024;
+    qint64 m_usage = 0;
+    // Counts plays; the heat's time base.
+    quint64 m_clock = 0;
+    int m_heatHalfLife = 32;
+    int m_streamAboveSeconds = 60;
+    int m_streamHeadMs = 3000;
+    int m_warmHeadMs = 1000;
+    QTimer *m_warmTimer = nullptr;
+    qint64 m_warmedPages = 0;
+    qint64 m_warmNs = 0;
+    bool m_warming = false;
+    QHash<int, QString> m_slots;
+    QHash<QString, Entry> m_entries;
+    QSet<QString> m_pending;
+    QHash<int, SlotStats> m_stats;
+};
+
+#endif // SAMPLECACHE_H
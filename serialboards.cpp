@@ -0,0 +1,183 @@
+#include "serialboards.h"
+#include "audioengine.h"
+#include "latencymetrics.h"
+#include "receiverthread.h"
+
+#include <QSettings>
+#include <QDebug>
+
+#include <functional>
+
+QList<SerialBoards::Board> SerialBoards::readSettings(QSettings &settings)
+{
+    QList<Board> boards;
+    const int size = settings.beginReadArray("boards");
+    for(int i = 0; i < size; ++i) {
+        settings.setArrayIndex(i);
+        Board board;
+        board.port = settings.value("port").toString();
+        board.baudRate = settings.value("baudrate", board.baudRate).toInt();
+        const QStringList mapping = settings.value("slots").toString().split(',', Qt::SkipEmptyParts);
+        for(const QString &slot : mapping)
+            board.slotMap.append(slot.trimmed().toInt() - 1);
+        boards.append(board);
+    }
+    settings.endArray();
+
+    settings.beginGroup("serial");
+    if(boards.isEmpty()) {
+        Board board;
+        board.port = settings.value("port").toString();
+        board.baudRate = settings.value("baudrate", board.baudRate).toInt();
+        boards.append(board);
+    }
+    for(Board &board : boards) {
+        board.reconnect = settings.value("reconnect", board.reconnect).toBool();
+        board.reconnectMaxMs = settings.value("reconnectMaxMs", board.reconnectMaxMs).toInt();
+    }
+    settings.endGroup();
+    return boards;
+}
+
+SerialBoards::SerialBoards(AudioEngine *engine, QObject *parent)
+    : QObject(parent)
+{
+    for(int board = 0; board < engine->inputQueueCount(); ++board) {
+        ReceiverThread *receiver = new ReceiverThread(engine->inputRoutes(board), this);
+        receiver->setObjectName(QString("SerialReceiver%1").arg(board));
+        receiver->setBoard(board);
+        connect(receiver, &ReceiverThread::opened, this, [this, board](const QString &portName, qint32 baudRate) {
+            m_connected[board] = true;
+            emit opened(board, portName, baudRate);
+        });
+        connect(receiver, &ReceiverThread::openFailed, this, [this, board](const QString &portName, const QString &errorString) {
+            m_connected[board] = false;
+            emit openFailed(board, portName, errorString);
+        });
+        connect(receiver, &ReceiverThread::errorOccurred, this, [this, board](QSerialPort::SerialPortError error, const QString &errorString) {
+            if(error == QSerialPort::ResourceError)
+                m_connected[board] = false;
+            emit errorOccurred(board, error, errorString);
+        });
+        connect(receiver, &ReceiverThread::disconnected, this, [this, board](const QString &portName) {
+            m_connected[board] = false;
+            emit disconnected(board, portName);
+        });
+        connect(receiver, &ReceiverThread::recovered, this, [this, board](const QString &portName, qint64 recoveryNs) {
+            qDebug() << "serial board" << board + 1 << portName << "recovered in" << recoveryNs / 1000000 << "ms";
+            emit recovered(board, portName, recoveryNs);
+        });
+        connect(receiver, &ReceiverThread::triggered, this, [this, board](quint64 slotBits) {
+            emit triggered(board, slotBits);
+        });
+        m_receivers.append(receiver);
+    }
+    m_started.fill(false, m_receivers.size());
+    m_connected.fill(false, m_receivers.size());
+
+    LatencyMetrics::instance().addCollector(this, [this](QByteArray *out) {
+        appendMetrics(out);
+    });
+}
+
+SerialBoards::~SerialBoards()
+{
+    LatencyMetrics::instance().removeCollector(this);
+    stop();
+}
+
+void SerialBoards::start(const QList<Board> &boards)
+{
+    if(boards.size() > m_receivers.size())
+        qWarning() << boards.size() << "serial boards configured, only" << m_receivers.size() << "are read";
+    for(int board = 0; board < qMin(boards.size(), m_receivers.size()); ++board)
+        startBoard(board, boards.at(board));
+}
+
+void SerialBoards::startBoard(int board, const Board &config)
+{
+    ReceiverThread *receiver = m_receivers.value(board);
+    if(!receiver || config.port.isEmpty())
+        return;
+    m_started[board] = true;
+    m_connected[board] = false;
+    receiver->setSlotMap(config.slotMap);
+    receiver->setReconnect(config.reconnect, config.reconnectMaxMs);
+    receiver->startReceiver(config.port, config.baudRate);
+}
+
+void SerialBoards::stop()
+{
+    for(ReceiverThread *receiver : std::as_const(m_receivers))
+        receiver->stopReceiver();
+    m_started.fill(false);
+    m_connected.fill(false);
+}
+
+void SerialBoards::setSlotMask(quint64 mask)
+{
+    for(ReceiverThread *receiver : std::as_const(m_receivers))
+        receiver->setSlotMask(mask);
+}
+
+int SerialBoards::connectedCount() const
+{
+    return int(m_connected.count(true));
+}
+
+QString SerialBoards::summary() const
+{
+    const int started = int(m_started.count(true));
+    const int connected = connectedCount();
+    if(connected == 0)
+        return "disconnected";
+    if(connected == started)
+        return "connected";
+    return QString("%1 of %2 connected").arg(connected).arg(started);
+}
+
+void SerialBoards::appendMetrics(QByteArray *out) const
+{
+    struct Series {
+        const char *name;
+        const char *type;
+        const char *help;
+        std::function<quint64(const ReceiverThread *)> value;
+    };
+    static const Series series[] = {
+        { "nb_serial_bytes_total", "counter", "Bytes read per serial board.",
+          [](const ReceiverThread *receiver) { return receiver->parserCounters().bytes; } },
+        { "nb_serial_frames_total", "counter", "Frames parsed per serial board.",
+          [](const ReceiverThread *receiver) { return receiver->parserCounters().frames; } },
+        { "nb_serial_malformed_total", "counter", "Malformed frames per serial board.",
+          [](const ReceiverThread *receiver) { return receiver->parserCounters().malformed; } },
+        { "nb_serial_errors_total", "counter", "Serial port errors per board.",
+          [](const ReceiverThread *receiver) { return receiver->serialErrors(); } },
+        { "nb_serial_events_dropped_total", "counter", "Input events dropped because the board's queue was full.",
+          [](const ReceiverThread *receiver) { return receiver->queueCounters().dropped; } },
+        { "nb_serial_queue_high_water", "gauge", "Deepest the board's input queue has been.",
+          [](const ReceiverThread *receiver) { return quint64(receiver->queueCounters().highWater); } },
+        { "nb_serial_reconnects_total", "counter", "Times the board's port was reopened after it went away.",
+          [](const ReceiverThread *receiver) { return receiver->reconnects(); } },
+    };
+
+    for(const Series &metric : series) {
+        *out += QByteArray("# HELP ") + metric.name + ' ' + metric.help + '\n';
+        *out += QByteArray("# TYPE ") + metric.name + ' ' + metric.type + '\n';
+        for(int board = 0; board < m_receivers.size(); ++board) {
+            const ReceiverThread *receiver = m_receivers.at(board);
+            *out += QByteArray(metric.name) + "{board=\"" + QByteArray::number(board)
+                    + "\",port=\"" + receiver->portName().toUtf8() + "\"} "
+                    + QByteArray::number(metric.value(receiver)) + '\n';
+        }
+    }
+
+    *out += "# HELP nb_serial_last_recovery_seconds Time from losing the board's port to its first frame after reopening.\n"
+            "# TYPE nb_serial_last_recovery_seconds gauge\n";
+    for(int board = 0; board < m_receivers.size(); ++board) {
+        const ReceiverThread *receiver = m_receivers.at(board);
+        *out += "nb_serial_last_recovery_seconds{board=\"" + QByteArray::number(board)
+                + "\",port=\"" + receiver->portName().toUtf8() + "\"} "
+                + QByteArray::number(receiver->lastRecoveryNs() / 1e9) + '\n';
+    }
+}
@@ -0,0 +1,71 @@
+#ifndef SERIALBOARDS_H
+#define SERIALBOARDS_H
+
+#include <QObject>
+#include <QList>
+#include <QSerialPort>
+#include <QString>
+#include <QVector>
+
+class AudioEngine;
+class QSettings;
+class ReceiverThread;
+
+// Several Arduinos read concurrently. Every board has its own receiver
+// thread, parser and input queue, so a board that stalls or floods only
+// delays itself; the mixer merges the queues by sequence number.
+class SerialBoards : public QObject
+{
+    Q_OBJECT
+
+public:
+    struct Board {
+        QString port;
+        qint32 baudRate = 115200;
+        // Slot per button of this board, empty for button n -> slot n.
+        QVector<int> slotMap;
+        // Reopen the port after it went away, see ReceiverThread.
+        bool reconnect = true;
+        int reconnectMaxMs = 2000;
+    };
+
+    // The boards array: port, baudrate and slots, the 1-based slot of every
+    // button as a comma separated list (0 ignores the button). Without it
+    // the single port from the serial group. serial/reconnect and
+    // serial/reconnectMaxMs apply to all boards.
+    static QList<Board> readSettings(QSettings &settings);
+
+    // One receiver per input queue of the engine.
+    explicit SerialBoards(AudioEngine *engine, QObject *parent = nullptr);
+    ~SerialBoards();
+
+    int count() const { return m_receivers.size(); }
+    ReceiverThread *receiver(int board) const { return m_receivers.value(board); }
+
+    // Boards beyond count() are ignored.
+    void start(const QList<Board> &boards);
+    void startBoard(int board, const Board &config);
+    void stop();
+    void setSlotMask(quint64 mask);
+
+    int connectedCount() const;
+    // "connected", "disconnected" or "1 of 2 connected" for the state channel.
+    QString summary() const;
+
+signals:
+    void opened(int board, const QString &portName, qint32 baudRate);
+    void openFailed(int board, const QString &portName, const QString &errorString);
+    void errorOccurred(int board, QSerialPort::SerialPortError error, const QString &errorString);
+    void disconnected(int board, const QString &portName);
+    void recovered(int board, const QString &portName, qint64 recoveryNs);
+    void triggered(int board, quint64 slotBits);
+
+private:
+    void appendMetrics(QByteArray *out) const;
+
+    QList<ReceiverThread *> m_receivers;
+    QVector<bool> m_started;
+    QVector<bool> m_connected;
+};
+
+#endif // SERIALBOARDS_H
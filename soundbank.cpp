@@ -0,0 +1,136 @@
+#include "soundbank.h"
+
+#include <QFileInfo>
+#include <QJsonObject>
+#include <QReadLocker>
+#include <QSettings>
+#include <QWriteLocker>
+
+SoundBank::SoundBank(int slotCount)
+{
+    resize(slotCount);
+}
+
+int SoundBank::slotCount() const
+{
+    QReadLocker locker(&m_lock);
+    return m_slots.size();
+}
+
+void SoundBank::resize(int slotCount)
+{
+    slotCount = qBound(1, slotCount, int(MaxSlots));
+
+    QWriteLocker locker(&m_lock);
+    while(m_slots.size() > slotCount)
+        m_slots.removeLast();
+    while(m_slots.size() < slotCount)
+        m_slots.append(Slot { defaultLabel(m_slots.size()), QString() });
+
+    m_slotMask.store(slotCount == 64 ? ~quint64(0) : (quint64(1) << slotCount) - 1, std::memory_order_relaxed);
+}
+
+void SoundBank::setSlots(const QList<Slot> &table)
+{
+    resize(int(table.size()));
+    QWriteLocker locker(&m_lock);
+    for(int i = 0; i < qMin(m_slots.size(), table.size()); ++i) {
+        m_slots[i] = table.at(i);
+        if(m_slots[i].label.isEmpty())
+            m_slots[i].label = defaultLabel(i);
+    }
+}
+
+SoundBank::Slot SoundBank::slot(int slot) const
+{
+    QReadLocker locker(&m_lock);
+    return m_slots.value(slot);
+}
+
+QList<SoundBank::Slot> SoundBank::allSlots() const
+{
+    QReadLocker locker(&m_lock);
+    return m_slots;
+}
+
+QString SoundBank::label(int slot) const
+{
+    QReadLocker locker(&m_lock);
+    return m_slots.value(slot).label;
+}
+
+QString SoundBank::path(int slot) const
+{
+    QReadLocker locker(&m_lock);
+    return m_slots.value(slot).path;
+}
+
+void SoundBank::setLabel(int slot, const QString &label)
+{
+    QWriteLocker locker(&m_lock);
+    if(slot >= 0 && slot < m_slots.size())
+        m_slots[slot].label = label.isEmpty() ? defaultLabel(slot) : label;
+}
+
+void SoundBank::setPath(int slot, const QString &path)
+{
+    QWriteLocker locker(&m_lock);
+    if(slot >= 0 && slot < m_slots.size() && m_slots.at(slot).path != path) {
+        m_slots[slot].path = path;
+        m_slots[slot].hash.clear();
+    }
+}
+
+float SoundBank::gain(int slot) const
+{
+    QReadLocker locker(&m_lock);
+    return slot >= 0 && slot < m_slots.size() ? m_slots.at(slot).gain : 1.0f;
+}
+
+void SoundBank::setGain(int slot, float gain)
+{
+    QWriteLocker locker(&m_lock);
+    if(slot >= 0 && slot < m_slots.size())
+        m_slots[slot].gain = qBound(0.0f, gain, 4.0f);
+}
+
+bool SoundBank::setHash(int slot, const QByteArray &hash)
+{
+    QWriteLocker locker(&m_lock);
+    if(slot < 0 || slot >= m_slots.size() || m_slots.at(slot).hash == hash)
+        return false;
+    m_slots[slot].hash = hash;
+    return true;
+}
+
+QJsonArray SoundBank::toJson() const
+{
+    const QList<Slot> bank = allSlots();
+    QJsonArray array;
+    for(int i = 0; i < bank.size(); ++i) {
+        array.append(QJsonObject {
+            { "slot", i },
+            { "id", QString::number(quint64(1) << i) },
+            { "label", bank[i].label },
+            { "file", QFileInfo(bank[i].path).fileName() },
+            { "gain", double(bank[i].gain) }
+        });
+    }
+    return array;
+}
+
+// [Buttons]
+// count=5
+// button0=/path/to/file.mp3
+// label0=Button 1
+void SoundBank::readSettings(QSettings &settings)
+{
+    settings.beginGroup("Buttons");
+    resize(settings.value("count", DefaultSlots).toInt());
+    const int count = slotCount();
+    for(int i = 0; i < count; ++i) {
+        setPath(i, settings.value(QString("button%1").arg(i)).toString());
+        setLabel(i, settings.value(QString("label%1").arg(i)).toString());
+    }
+    settings.endGroup();
+}
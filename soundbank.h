@@ -0,0 +1,65 @@
+#ifndef SOUNDBANK_H
+#define SOUNDBANK_H
+
+#include <QJsonArray>
+#include <QList>
+#include <QReadWriteLock>
+#include <QString>
+
+#include <atomic>
+
+class QSettings;
+
+// Table of the board's sound slots. Slot n answers to bit n of the serial id,
+// so a frame with several bits set triggers all of those slots at once. The
+// GUI rows, the HTTP routes and the bank file are all generated from this table.
+// All functions are thread-safe.
+class SoundBank
+{
+public:
+    static constexpr int MaxSlots = 64;
+    static constexpr int DefaultSlots = 5;
+
+    struct Slot {
+        QString label;
+        QString path;
+        QByteArray hash;    // content hash of path when it was last loaded
+        float gain = 1.0f;
+    };
+
+    explicit SoundBank(int slotCount = DefaultSlots);
+
+    int slotCount() const;
+    // Bit n is set for every slot n in the bank.
+    quint64 slotMask() const { return m_slotMask.load(std::memory_order_relaxed); }
+    bool contains(int slot) const { return slot >= 0 && slot < MaxSlots && (slotMask() & (quint64(1) << slot)); }
+
+    void resize(int slotCount);
+    void setSlots(const QList<Slot> &table);
+    Slot slot(int slot) const;
+    QList<Slot> allSlots() const;
+    QString label(int slot) const;
+    QString path(int slot) const;
+    void setLabel(int slot, const QString &label);
+    void setPath(int slot, const QString &path);
+    float gain(int slot) const;
+    void setGain(int slot, float gain);
+    // Returns true if the hash changed.
+    bool setHash(int slot, const QByteArray &hash);
+
+    // [{"slot": 0, "id": "1", "label": "Button 1", "file": "kick.mp3", "gain": 1}, ...]
+    QJsonArray toJson() const;
+
+    // Takes over the Buttons group older versions kept in QSettings; the bank
+    // itself now lives in a BankFile.
+    void readSettings(QSettings &settings);
+
+    static QString defaultLabel(int slot) { return QString("Button %1").arg(slot + 1); }
+
+private:
+    mutable QReadWriteLock m_lock;
+    QList<Slot> m_slots;
+    std::atomic<quint64> m_slotMask { 0 };
+};
+
+#endif // SOUNDBANK_H
@@ -0,0 +1,138 @@
+#ifndef SPSCQUEUE_H
+#define SPSCQUEUE_H
+
+#include <QtGlobal>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+// Bounded lock-free queue for exactly one producer and one consumer thread.
+// When the queue is full push() either drops the new element or waits for the
+// consumer for at most blockTimeout before dropping it.
+template<typename T>
+class SpscQueue
+{
+public:
+    enum class OverflowPolicy {
+        DropNewest,
+        Block
+    };
+
+    struct Counters {
+        quint64 pushed = 0;
+        quint64 popped = 0;
+        quint64 overflows = 0;
+        quint64 dropped = 0;
+        qsizetype highWater = 0;
+    };
+
+    explicit SpscQueue(qsizetype capacity, OverflowPolicy policy = OverflowPolicy::DropNewest,
+                       std::chrono::microseconds blockTimeout = std::chrono::milliseconds(5))
+        : m_buffer(roundUp(capacity)),
+        m_mask(quint64(m_buffer.size()) - 1),
+        m_policy(policy),
+        m_blockTimeout(blockTimeout)
+    {
+    }
+
+    qsizetype capacity() const { return qsizetype(m_buffer.size()); }
+    OverflowPolicy policy() const { return m_policy; }
+
+    qsizetype size() const
+    {
+        return qsizetype(m_tail.load(std::memory_order_acquire) - m_head.load(std::memory_order_acquire));
+    }
+
+    bool tryPush(const T &value)
+    {
+        const quint64 tail = m_tail.load(std::memory_order_relaxed);
+        if(tail - m_head.load(std::memory_order_acquire) >= quint64(m_buffer.size()))
+            return false;
+        m_buffer[tail & m_mask] = value;
+        m_tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Producer side; applies the overflow policy and keeps the counters.
+    bool push(const T &value)
+    {
+        bool accepted = tryPush(value);
+        if(!accepted) {
+            m_overflows.fetch_add(1, std::memory_order_relaxed);
+            if(m_policy == OverflowPolicy::Block) {
+                const auto deadline = std::chrono::steady_clock::now() + m_blockTimeout;
+                while(!accepted && std::chrono::steady_clock::now() < deadline) {
+                    std::this_thread::yield();
+                    accepted = tryPush(value);
+                }
+            }
+        }
+        if(!accepted) {
+            m_dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        m_pushed.fetch_add(1, std::memory_order_relaxed);
+        const qsizetype depth = size();
+        if(depth > m_highWater.load(std::memory_order_relaxed))
+            m_highWater.store(depth, std::memory_order_relaxed);
+        return true;
+    }
+
+    // Consumer side; the oldest element without removing it, nullptr when empty.
+    const T *front() const
+    {
+        const quint64 head = m_head.load(std::memory_order_relaxed);
+        if(head == m_tail.load(std::memory_order_acquire))
+            return nullptr;
+        return &m_buffer[head & m_mask];
+    }
+
+    bool tryPop(T *value)
+    {
+        const quint64 head = m_head.load(std::memory_order_relaxed);
+        if(head == m_tail.load(std::memory_order_acquire))
+            return false;
+        *value = std::move(m_buffer[head & m_mask]);
+        m_head.store(head + 1, std::memory_order_release);
+        m_popped.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    Counters counters() const
+    {
+        Counters counters;
+        counters.pushed = m_pushed.load(std::memory_order_relaxed);
+        counters.popped = m_popped.load(std::memory_order_relaxed);
+        counters.overflows = m_overflows.load(std::memory_order_relaxed);
+        counters.dropped = m_dropped.load(std::memory_order_relaxed);
+        counters.highWater = m_highWater.load(std::memory_order_relaxed);
+        return counters;
+    }
+
+private:
+    static qsizetype roundUp(qsizetype capacity)
+    {
+        qsizetype size = 2;
+        while(size < capacity)
+            size <<= 1;
+        return size;
+    }
+
+    std::vector<T> m_buffer;
+    const quint64 m_mask;
+    const OverflowPolicy m_policy;
+    const std::chrono::microseconds m_blockTimeout;
+
+    alignas(64) std::atomic<quint64> m_head { 0 };
+    alignas(64) std::atomic<quint64> m_tail { 0 };
+
+    alignas(64) std::atomic<quint64> m_pushed { 0 };
+    std::atomic<quint64> m_overflows { 0 };
+    std::atomic<quint64> m_dropped { 0 };
+    std::atomic<qsizetype> m_highWater { 0 };
+    alignas(64) std::atomic<quint64> m_popped { 0 };
+};
+
+#endif // SPSCQUEUE_H
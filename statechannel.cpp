@@ -0,0 +1,149 @@
+#include "statechannel.h"
+
+#include <QAbstractHttpServer>
+#include <QCborValue>
+#include <QDateTime>
+#include <QJsonDocument>
+#include <QThread>
+#include <QUrlQuery>
+#include <QWebSocket>
+#include <QDebug>
+
+#if QT_VERSION >= QT_VERSION_CHECK(6, 8, 0)
+#include <QHttpServerRequest>
+#include <QHttpServerWebSocketUpgradeResponse>
+#endif
+
+StateChannel::StateChannel(QAbstractHttpServer *server, QObject *parent)
+    : QObject(parent),
+    m_server(server),
+    m_epoch(QDateTime::currentMSecsSinceEpoch())
+{
+#if QT_VERSION >= QT_VERSION_CHECK(6, 8, 0)
+    m_server->addWebSocketUpgradeVerifier(this, [](const QHttpServerRequest &request) {
+        if(request.url().path() == QLatin1String("/state"))
+            return QHttpServerWebSocketUpgradeResponse::accept();
+        return QHttpServerWebSocketUpgradeResponse::passToNext();
+    });
+#endif
+    connect(m_server, &QAbstractHttpServer::newWebSocketConnection, this, &StateChannel::acceptConnections);
+}
+
+StateChannel::~StateChannel()
+{
+    for(QWebSocket *client : std::as_const(m_clients))
+        client->disconnect(this);
+}
+
+void StateChannel::publish(const QString &key, const QJsonValue &value)
+{
+    if(QThread::currentThread() != thread()) {
+        QMetaObject::invokeMethod(this, [this, key, value]() {
+            publish(key, value);
+        }, Qt::QueuedConnection);
+        return;
+    }
+
+    if(m_state.value(key) == value)
+        return;
+
+    m_state.insert(key, value);
+    ++m_sequence;
+    m_snapshotCurrent = false;
+
+    QJsonObject diff;
+    diff.insert("seq", qint64(m_sequence));
+    diff.insert(key, value);
+    const QString message = QString::fromUtf8(QJsonDocument(diff).toJson(QJsonDocument::Compact));
+
+    m_history.append(qMakePair(m_sequence, message));
+    if(m_history.size() > HistorySize)
+        m_history.removeFirst();
+
+    for(QWebSocket *client : std::as_const(m_clients))
+        client->sendTextMessage(message);
+}
+
+void StateChannel::publishLive(const QString &key, const QJsonValue &value)
+{
+    if(QThread::currentThread() != thread()) {
+        QMetaObject::invokeMethod(this, [this, key, value]() {
+            publishLive(key, value);
+        }, Qt::QueuedConnection);
+        return;
+    }
+
+    if(m_live.value(key) == value)
+        return;
+    m_live.insert(key, value);
+
+    QJsonObject message;
+    message.insert(key, value);
+    const QString text = QString::fromUtf8(QJsonDocument(message).toJson(QJsonDocument::Compact));
+    for(QWebSocket *client : std::as_const(m_clients))
+        client->sendTextMessage(text);
+}
+
+void StateChannel::acceptConnections()
+{
+    while(m_server->hasPendingWebSocketConnections()) {
+        QWebSocket *client = m_server->nextPendingWebSocketConnection().release();
+        if(!client)
+            continue;
+        client->setParent(this);
+
+        const QUrl url = client->requestUrl();
+        if(url.path() != QLatin1String("/state")) {
+            client->close(QWebSocketProtocol::CloseCodePolicyViolated);
+            client->deleteLater();
+            continue;
+        }
+
+        m_clients.append(client);
+        connect(client, &QWebSocket::disconnected, this, [this, client]() {
+            m_clients.removeOne(client);
+            client->deleteLater();
+        });
+
+        bool ok = false;
+        const quint64 since = QUrlQuery(url).queryItemValue("since").toULongLong(&ok);
+        if(ok)
+            catchUp(client, since);
+        else
+            client->sendTextMessage(QString::fromUtf8(snapshot().json));
+        if(!m_live.isEmpty())
+            client->sendTextMessage(QString::fromUtf8(QJsonDocument(m_live).toJson(QJsonDocument::Compact)));
+    }
+}
+
+void StateChannel::catchUp(QWebSocket *client, quint64 since)
+{
+    if(since == m_sequence)
+        return;
+
+    if(since > m_sequence || m_history.isEmpty() || m_history.first().first > since + 1) {
+        client->sendTextMessage(QString::fromUtf8(snapshot().json));
+        return;
+    }
+
+    for(const auto &entry : std::as_const(m_history)) {
+        if(entry.first > since)
+            client->sendTextMessage(entry.second);
+    }
+}
+
+const StateChannel::Snapshot &StateChannel::snapshot() const
+{
+    if(m_snapshotCurrent)
+        return m_snapshot;
+
+    QJsonObject message = m_state;
+    message.insert("seq", qint64(m_sequence));
+    message.insert("full", true);
+    m_snapshot.sequence = m_sequence;
+    m_snapshot.etag = "W/\"" + QByteArray::number(m_epoch, 36) + '-' + QByteArray::number(m_sequence) + '"';
+    m_snapshot.json = QJsonDocument(message).toJson(QJsonDocument::Compact);
+    m_snapshot.cbor = QCborValue::fromJsonValue(message).toCbor();
+    m_snapshotCurrent = true;
+    return m_snapshot;
+}
@@ -0,0 +1,72 @@
+#ifndef STATECHANNEL_H
+#define STATECHANNEL_H
+
+#include <QByteArray>
+#include <QObject>
+#include <QJsonObject>
+#include <QJsonValue>
+#include <QList>
+#include <QPair>
+#include <QString>
+
+class QAbstractHttpServer;
+class QWebSocket;
+
+// Pushes state changes to every connected web client over a WebSocket on the
+// HTTP server's port. Each change is a small JSON diff with a sequence number;
+// a client reconnecting to /state?since=<seq> gets the diffs it missed, or a
+// full snapshot when they are no longer in the history. Pollers get the same
+// state from snapshot(), serialised once per change however many ask.
+class StateChannel : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit StateChannel(QAbstractHttpServer *server, QObject *parent = nullptr);
+    ~StateChannel();
+
+    // May be called from any thread; the change is sent from the channel's thread.
+    void publish(const QString &key, const QJsonValue &value);
+    // For values that change every few hundred milliseconds, like the playback
+    // position: sent as they come without a sequence number, and kept out of
+    // the history and the snapshot so they do not change its ETag.
+    void publishLive(const QString &key, const QJsonValue &value);
+
+    // Only valid on the channel's thread.
+    quint64 sequence() const { return m_sequence; }
+    QJsonObject state() const { return m_state; }
+    QJsonObject live() const { return m_live; }
+    int clientCount() const { return m_clients.size(); }
+
+    // The whole state as of sequence, built on the first call after a change
+    // and shared by every caller until the next one. Channel's thread only.
+    struct Snapshot
+    {
+        quint64 sequence = 0;
+        QByteArray etag;
+        QByteArray json;
+        QByteArray cbor;
+    };
+    const Snapshot &snapshot() const;
+
+private slots:
+    void acceptConnections();
+
+private:
+    void catchUp(QWebSocket *client, quint64 since);
+
+    static constexpr int HistorySize = 256;
+
+    QAbstractHttpServer *m_server;
+    // Part of the ETag, so a tag from before a restart never matches.
+    qint64 m_epoch;
+    QList<QWebSocket *> m_clients;
+    QJsonObject m_state;
+    QJsonObject m_live;
+    quint64 m_sequence = 0;
+    QList<QPair<quint64, QString>> m_history;
+    mutable Snapshot m_snapshot;
+    mutable bool m_snapshotCurrent = false;
+};
+
+#endif // STATECHANNEL_H
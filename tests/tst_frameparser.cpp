@@ -0,0 +1,219 @@
+#include "frameparser.h"
+
+#include <QByteArray>
+#include <QList>
+#include <QtTest>
+
+#include <cstring>
+
+class TestFrameParser : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void singleFrame();
+    void frameSplitAcrossReads();
+    void framesAcrossRingWrap();
+    void garbageBeforeFrame();
+    void resyncAfterMalformedFrame_data();
+    void resyncAfterMalformedFrame();
+    void lineOverMaxFrameLength();
+    void resetDiscardsFragment();
+    void idRange();
+    void valueRange();
+
+private:
+    static QList<FrameParser::Frame> feed(FrameParser &parser, const QByteArray &data, int chunk = 0);
+};
+
+QList<FrameParser::Frame> TestFrameParser::feed(FrameParser &parser, const QByteArray &data, int chunk)
+{
+    QList<FrameParser::Frame> frames;
+    const auto handler = [&frames](const FrameParser::Frame &frame) { frames.append(frame); };
+    if(chunk <= 0)
+        chunk = int(data.size());
+    for(qsizetype offset = 0; offset < data.size(); offset += chunk)
+        parser.feed(data.constData() + offset, qMin(qsizetype(chunk), data.size() - offset), handler);
+    return frames;
+}
+
+void TestFrameParser::singleFrame()
+{
+    FrameParser parser;
+    const QList<FrameParser::Frame> frames = feed(parser, "12;200\r\n");
+    QCOMPARE(frames.size(), 1);
+    QCOMPARE(frames.first().id, quint64(12));
+    QCOMPARE(frames.first().value, 200);
+    QCOMPARE(parser.counters().frames, quint64(1));
+    QCOMPARE(parser.counters().bytes, quint64(8));
+    QCOMPARE(parser.pending(), qsizetype(0));
+}
+
+void TestFrameParser::frameSplitAcrossReads()
+{
+    FrameParser parser;
+    QCOMPARE(feed(parser, "4;1").size(), 0);
+    QCOMPARE(feed(parser, "7").size(), 0);
+    QCOMPARE(feed(parser, "\r").size(), 0);
+    QCOMPARE(parser.pending(), qsizetype(5));
+
+    const QList<FrameParser::Frame> frames = feed(parser, "\n8;0\r\n");
+    QCOMPARE(frames.size(), 2);
+    QCOMPARE(frames.at(0).id, quint64(4));
+    QCOMPARE(frames.at(0).value, 17);
+    QCOMPARE(frames.at(1).id, quint64(8));
+    QCOMPARE(frames.at(1).value, 0);
+    QCOMPARE(parser.counters().malformed, quint64(0));
+}
+
+// Odd sized reads through writePointer()/commit() put frames across the end
+// of the ring.
+void TestFrameParser::framesAcrossRingWrap()
+{
+    FrameParser parser;
+    QByteArray data;
+    for(int i = 0; i < 100; ++i)
+        data += QByteArray::number(i + 1) + ';' + QByteArray::number(i % 256) + "\r\n";
+    QVERIFY(data.size() > 2 * FrameParser::Capacity);
+
+    QList<FrameParser::Frame> frames;
+    const auto handler = [&frames](const FrameParser::Frame &frame) { frames.append(frame); };
+    qsizetype offset = 0;
+    while(offset < data.size()) {
+        qsizetype space = 0;
+        char *target = parser.writePointer(&space);
+        QVERIFY(target);
+        const qsizetype count = qMin(qMin(space, qsizetype(7)), data.size() - offset);
+        memcpy(target, data.constData() + offset, size_t(count));
+        parser.commit(count);
+        parser.parse(handler);
+        offset += count;
+    }
+
+    QCOMPARE(frames.size(), 100);
+    for(int i = 0; i < frames.size(); ++i) {
+        QCOMPARE(frames.at(i).id, quint64(i + 1));
+        QCOMPARE(frames.at(i).value, i % 256);
+    }
+    QCOMPARE(parser.counters().dropped, quint64(0));
+}
+
+// Bytes before the first line break, e.g. from a board that was already
+// sending when the port opened, cost that line only.
+void TestFrameParser::garbageBeforeFrame()
+{
+    FrameParser parser;
+    const QList<FrameParser::Frame> frames = feed(parser, QByteArray("\xff\x00\x13noise", 8) + "1;5\r\n2;6\r\n", 3);
+    QCOMPARE(frames.size(), 1);
+    QCOMPARE(frames.first().id, quint64(2));
+    QCOMPARE(frames.first().value, 6);
+    QCOMPARE(parser.counters().malformed, quint64(1));
+
+    FrameParser separated;
+    QCOMPARE(feed(separated, "garbage\r\n3;7\r\n").size(), 1);
+    QCOMPARE(separated.counters().malformed, quint64(1));
+}
+
+void TestFrameParser::resyncAfterMalformedFrame_data()
+{
+    QTest::addColumn<QByteArray>("line");
+
+    QTest::newRow("no separator") << QByteArray("12\r\n");
+    QTest::newRow("no id") << QByteArray(";5\r\n");
+    QTest::newRow("no value") << QByteArray("5;\r\n");
+    QTest::newRow("two separators") << QByteArray("1;;2\r\n");
+    QTest::newRow("three fields") << QByteArray("1;2;3\r\n");
+    QTest::newRow("letter") << QByteArray("1;2a\r\n");
+    QTest::newRow("sign") << QByteArray("-1;2\r\n");
+    QTest::newRow("space") << QByteArray("1; 2\r\n");
+    QTest::newRow("carriage return inside") << QByteArray("1\r;2\r\n");
+}
+
+void TestFrameParser::resyncAfterMalformedFrame()
+{
+    QFETCH(QByteArray, line);
+
+    FrameParser parser;
+    const QList<FrameParser::Frame> frames = feed(parser, line + "3;4\r\n");
+    QCOMPARE(frames.size(), 1);
+    QCOMPARE(frames.first().id, quint64(3));
+    QCOMPARE(frames.first().value, 4);
+    QCOMPARE(parser.counters().malformed, quint64(1));
+    QCOMPARE(parser.counters().frames, quint64(1));
+}
+
+void TestFrameParser::lineOverMaxFrameLength()
+{
+    // Leading zeros keep the id valid, so only the length decides.
+    const QByteArray longest = QByteArray(FrameParser::MaxFrameLength - 4, '0') + "1;5\r";
+    QCOMPARE(longest.size(), FrameParser::MaxFrameLength);
+
+    FrameParser parser;
+    QList<FrameParser::Frame> frames = feed(parser, longest + '\n');
+    QCOMPARE(frames.size(), 1);
+    QCOMPARE(frames.first().id, quint64(1));
+    QCOMPARE(parser.counters().dropped, quint64(0));
+
+    frames = feed(parser, '0' + longest + "\n2;6\r\n", 5);
+    QCOMPARE(frames.size(), 1);
+    QCOMPARE(frames.first().id, quint64(2));
+    QCOMPARE(frames.first().value, 6);
+    QCOMPARE(parser.counters().dropped, quint64(1));
+    QCOMPARE(parser.counters().resyncs, quint64(1));
+    QCOMPARE(parser.counters().malformed, quint64(0));
+
+    // Far beyond the ring, with no line break for a while.
+    frames = feed(parser, QByteArray(3 * FrameParser::Capacity, '7') + "\r\n3;7\r\n", 64);
+    QCOMPARE(frames.size(), 1);
+    QCOMPARE(frames.first().id, quint64(3));
+    QCOMPARE(parser.counters().dropped, quint64(2));
+    QCOMPARE(parser.counters().resyncs, quint64(2));
+}
+
+void TestFrameParser::resetDiscardsFragment()
+{
+    FrameParser parser;
+    QCOMPARE(feed(parser, "1;2").size(), 0);
+    parser.reset();
+    QCOMPARE(parser.pending(), qsizetype(0));
+    QCOMPARE(parser.counters().dropped, quint64(1));
+
+    // The port was reopened in the middle of a frame.
+    const QList<FrameParser::Frame> frames = feed(parser, "55\r\n4;9\r\n");
+    QCOMPARE(frames.size(), 1);
+    QCOMPARE(frames.first().id, quint64(4));
+    QCOMPARE(parser.counters().resyncs, quint64(1));
+    QCOMPARE(parser.counters().malformed, quint64(0));
+}
+
+void TestFrameParser::idRange()
+{
+    FrameParser parser;
+    QList<FrameParser::Frame> frames = feed(parser, "18446744073709551615;1\r\n");
+    QCOMPARE(frames.size(), 1);
+    QCOMPARE(frames.first().id, ~quint64(0));
+
+    frames = feed(parser, "18446744073709551616;1\r\n99999999999999999999;1\r\n");
+    QCOMPARE(frames.size(), 0);
+    QCOMPARE(parser.counters().malformed, quint64(2));
+}
+
+// The parser only bounds the value to nine digits so it cannot overflow;
+// scaling it to a volume is up to the receiver.
+void TestFrameParser::valueRange()
+{
+    FrameParser parser;
+    QList<FrameParser::Frame> frames = feed(parser, "0;255\r\n0;256\r\n0;999999999\r\n");
+    QCOMPARE(frames.size(), 3);
+    QCOMPARE(frames.at(0).value, 255);
+    QCOMPARE(frames.at(1).value, 256);
+    QCOMPARE(frames.at(2).value, 999999999);
+
+    frames = feed(parser, "0;1000000000\r\n0;0000000001\r\n");
+    QCOMPARE(frames.size(), 0);
+    QCOMPARE(parser.counters().malformed, quint64(2));
+}
+
+QTEST_APPLESS_MAIN(TestFrameParser)
+
+#include "tst_frameparser.moc"
@@ -0,0 +1,113 @@
+#include "webassets.h"
+
+#include <QCryptographicHash>
+#include <QFile>
+#include <QFileInfo>
+#include <QList>
+#include <QDebug>
+
+namespace {
+
+QByteArray readResource(const QString &path)
+{
+    QFile file(path);
+    if(!file.open(QIODevice::ReadOnly))
+        return QByteArray();
+    return file.readAll();
+}
+
+QByteArray contentTypeFor(const QString &name)
+{
+    const QString suffix = QFileInfo(name).suffix();
+    if(suffix == "html")
+        return "text/html; charset=utf-8";
+    if(suffix == "js")
+        return "text/javascript; charset=utf-8";
+    if(suffix == "css")
+        return "text/css; charset=utf-8";
+    if(suffix == "svg")
+        return "image/svg+xml";
+    return "application/octet-stream";
+}
+
+// q=0 in Accept-Encoding explicitly refuses a coding.
+bool accepts(const QByteArray &acceptEncoding, const QByteArray &coding)
+{
+    const QList<QByteArray> entries = acceptEncoding.split(',');
+    for(const QByteArray &entry : entries) {
+        const QList<QByteArray> parts = entry.split(';');
+        const QByteArray name = parts.first().trimmed().toLower();
+        if(name != coding && name != "*")
+            continue;
+        bool refused = false;
+        for(qsizetype i = 1; i < parts.size(); ++i) {
+            const QByteArray parameter = parts.at(i).trimmed();
+            if(parameter.startsWith("q=") && parameter.mid(2).toDouble() <= 0.0)
+                refused = true;
+        }
+        if(!refused)
+            return true;
+    }
+    return false;
+}
+
+} // namespace
+
+WebAssets::WebAssets(const QStringList &names)
+{
+    for(const QString &name : names) {
+        Asset asset;
+        asset.identity = readResource(":/assets/" + name);
+        if(asset.identity.isNull()) {
+            qWarning() << "web asset" << name << "is missing from the resources";
+            continue;
+        }
+        asset.gzip = readResource(":/assets/" + name + ".gz");
+        asset.brotli = readResource(":/assets/" + name + ".br");
+        asset.contentType = contentTypeFor(name);
+        asset.etag = "W/\"" + QCryptographicHash::hash(asset.identity, QCryptographicHash::Sha1).toHex().left(16) + '"';
+        m_assets.insert(name, asset);
+    }
+}
+
+const WebAssets::Asset *WebAssets::find(const QString &name) const
+{
+    const auto it = m_assets.constFind(name);
+    return it == m_assets.cend() ? nullptr : &*it;
+}
+
+WebAssets::Selection WebAssets::select(const Asset &asset, const QByteArray &acceptEncoding)
+{
+    Selection selection;
+    selection.body = &asset.identity;
+    if(!asset.brotli.isEmpty() && asset.brotli.size() < selection.body->size() && accepts(acceptEncoding, "br")) {
+        selection.body = &asset.brotli;
+        selection.encoding = "br";
+    } else if(!asset.gzip.isEmpty() && asset.gzip.size() < selection.body->size() && accepts(acceptEncoding, "gzip")) {
+        selection.body = &asset.gzip;
+        selection.encoding = "gzip";
+    }
+    return selection;
+}
+
+bool WebAssets::matches(const Asset &asset, const QByteArray &ifNoneMatch)
+{
+    return matches(asset.etag, ifNoneMatch);
+}
+
+bool WebAssets::matches(const QByteArray &etag, const QByteArray &ifNoneMatch)
+{
+    // Weak comparison: W/ prefixes are ignored on both sides.
+    const QByteArray own = etag.startsWith("W/") ? etag.mid(2) : etag;
+    const QList<QByteArray> tags = ifNoneMatch.split(',');
+    for(QByteArray tag : tags) {
+        tag = tag.trimmed();
+        if(tag == "*")
+            return true;
+        if(tag.startsWith("W/"))
+            tag = tag.mid(2);
+        if(tag == own)
+            return true;
+    }
+    return false;
+}
@@ -0,0 +1,42 @@
+#ifndef WEBASSETS_H
+#define WEBASSETS_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QString>
+
+// The web UI from the :/assets resource, loaded once. Next to every file the
+// build puts precompressed .gz (and .br) copies; the server picks the smallest
+// one the client accepts and answers revalidations from the ETag.
+class WebAssets
+{
+public:
+    struct Asset {
+        QByteArray contentType;
+        QByteArray etag;        // weak, the same for every encoding
+        QByteArray identity;
+        QByteArray gzip;
+        QByteArray brotli;
+    };
+
+    struct Selection {
+        const QByteArray *body = nullptr;
+        QByteArray encoding;    // empty for identity
+    };
+
+    // Loads the listed files from :/assets.
+    explicit WebAssets(const QStringList &names);
+
+    const Asset *find(const QString &name) const;
+
+    // Best encoding for an Accept-Encoding header value.
+    static Selection select(const Asset &asset, const QByteArray &acceptEncoding);
+    // Whether an If-None-Match header value matches the asset's ETag.
+    static bool matches(const Asset &asset, const QByteArray &ifNoneMatch);
+    static bool matches(const QByteArray &etag, const QByteArray &ifNoneMatch);
+
+private:
+    QHash<QString, Asset> m_assets;
+};
+
+#endif // WEBASSETS_H